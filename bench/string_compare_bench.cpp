@@ -0,0 +1,121 @@
+/*
+ *  PearBox
+ *  string_compare_bench.cpp
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/*
+ * Compares String::compare() with the ht_mismatch()/ht_mismatch_casefold()
+ * kernels against the per-character path, which calls the virtual
+ * compareChar() for every character (what String::compare() did before).
+ * The per-character path is forced by reporting stringCharCompareCustom.
+ *
+ * usage: string_compare_bench [iterations]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "tools/str.h"
+
+class PerCharString: public String {
+protected:
+	virtual	StringCharCompare charCompare() const
+	{
+		return stringCharCompareCustom;
+	}
+};
+
+class PerCharIString: public IString {
+protected:
+	virtual	StringCharCompare charCompare() const
+	{
+		return stringCharCompareCustom;
+	}
+};
+
+static volatile int gSink;
+
+/*
+ *	@returns ns per compare of |a| with each of the |n| strings in |b|
+ */
+static double run(const String &a, const String *const *b, int n, long iterations)
+{
+	auto start = std::chrono::steady_clock::now();
+	int r = 0;
+	for (long i = 0; i < iterations; i++) {
+		r += a.compare(*b[i % n]);
+	}
+	auto end = std::chrono::steady_clock::now();
+	gSink = r;
+	return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+/*
+ *	fills |s| with |len| characters: a common prefix (in alternating
+ *	case if |mixed|), the last character differs by |variant|
+ */
+static void key(String &s, int len, bool mixed, int variant)
+{
+	String k;
+	for (int i = 0; i < len - 1; i++) {
+		char c = 'a' + i % 26;
+		if (mixed && (i & 1)) c -= 'a' - 'A';
+		k += c;
+	}
+	k += (char)('0' + variant % 10);
+	s.assign(k);
+}
+
+#define KEYS		8
+
+template <class Fast, class Slow>
+static void bench(const char *name, int len, bool mixed, long iterations)
+{
+	Fast fa, fb[KEYS];
+	Slow sa, sb[KEYS];
+	const String *fp[KEYS], *sp[KEYS];
+	key(fa, len, false, 0);
+	key(sa, len, false, 0);
+	for (int i = 0; i < KEYS; i++) {
+		key(fb[i], len, mixed, i);
+		key(sb[i], len, mixed, i);
+		fp[i] = &fb[i];
+		sp[i] = &sb[i];
+	}
+	// both paths must agree
+	for (int i = 0; i < KEYS; i++) {
+		int f = fa.compare(fb[i]), s = sa.compare(sb[i]);
+		if ((f < 0) != (s < 0) || (f > 0) != (s > 0)) {
+			printf("%s: results differ\n", name);
+			exit(1);
+		}
+	}
+	double slow = run(sa, sp, KEYS, iterations);
+	double fast = run(fa, fp, KEYS, iterations);
+	printf("%-28s %5d %12.1f %12.1f %8.1fx\n", name, len, slow, fast, slow / fast);
+}
+
+int main(int argc, char *argv[])
+{
+	long iterations = (argc > 1) ? atol(argv[1]) : 1000000;
+	printf("%-28s %5s %12s %12s %9s\n", "", "chars", "per-char ns", "kernel ns", "speedup");
+	bench<IString, PerCharIString>("IString, same case", 8, false, iterations);
+	bench<IString, PerCharIString>("IString, same case", 36, false, iterations);
+	bench<IString, PerCharIString>("IString, mixed case", 36, true, iterations);
+	bench<IString, PerCharIString>("IString, mixed case", 256, true, iterations);
+	bench<IString, PerCharIString>("IString, mixed case", 4096, true, iterations / 16);
+	bench<String, PerCharString>("String", 36, false, iterations);
+	bench<String, PerCharString>("String", 4096, false, iterations / 16);
+	return 0;
+}
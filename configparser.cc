@@ -22,12 +22,13 @@
 #include "configparser.h"
 #include "tools/except.h"
 #include "tools/snprintf.h"
+#include "tools/strtools.h"
 
 ConfigParser *gConfig;
 
-ConfigEntry::ConfigEntry(const String &aName, bool mandatory)
+ConfigEntry::ConfigEntry(const InternedString &aName, bool mandatory)
+	: mName(aName)
 {
-	mName = new String(aName);
 	mMandatory = mandatory;
 	mInitialized = false;
 	mSet = false;
@@ -35,7 +36,6 @@ ConfigEntry::ConfigEntry(const String &aName, bool mandatory)
 
 ConfigEntry::~ConfigEntry()
 {
-	delete mName;
 }
 
 ConfigType ConfigEntry::getType() const
@@ -45,17 +45,22 @@ ConfigType ConfigEntry::getType() const
 
 int ConfigEntry::asInt() const
 {
-	throw MsgfException("cannot interprete config entry %y as integer", mName);
+	throw MsgfException("cannot interprete config entry %y as integer", &mName);
 }
 
 String &ConfigEntry::asString(String &result) const
 {
-	throw MsgfException("cannot interprete config entry %y as string", mName);
+	throw MsgfException("cannot interprete config entry %y as string", &mName);
+}
+
+String ConfigEntry::takeString()
+{
+	throw MsgfException("cannot interprete config entry %y as string", &mName);
 }
 
 int ConfigEntry::compareTo(const Object *obj) const
 {
-	return mName->compareTo(((ConfigEntry *)obj)->mName);
+	return mName.compareTo(&((ConfigEntry *)obj)->mName);
 }
 
 bool ConfigEntry::isSet() const
@@ -129,12 +134,25 @@ public:
 		mInitialized = true;
 		mSet = true;
 	}
+
+	void set(String &&s)
+	{
+		value = std::move(s);
+		mInitialized = true;
+		mSet = true;
+	}
 	
 	virtual String &asString(String &result) const
 	{
 		result = value;
 		return result;
 	}
+
+	virtual String takeString()
+	{
+		mInitialized = false;
+		return std::move(value);
+	}
 };
 
 ConfigParser::ConfigParser()
@@ -201,10 +219,12 @@ byte mapchar[]={
 
 void ConfigParser::loadConfig(Stream &in)
 {
-	read(in);
+	// the tokenizer reads byte by byte
+	BufferedStream b(&in, false);
+	read(b);
 	foreach(ConfigEntry, e, *entries, {
 		if (e->mMandatory && !e->isInitialized()) {
-			throw MsgfException("config entry '%y' is not set.", e->mName);
+			throw MsgfException("config entry '%y' is not set.", &e->mName);
 		}
 	});
 }
@@ -244,7 +264,7 @@ void ConfigParser::read(Stream &in)
 		
 		ConfigEntry *e = getEntry(ident);
 		if (!e) throw MsgfException("unknown identifier '%y' in line %d.", &ident, line);
-		if (e->isSet()) throw MsgfException("config entry '%y' is already set in line %d.", e->mName, line);
+		if (e->isSet()) throw MsgfException("config entry '%y' is already set in line %d.", &e->mName, line);
 		
 		if (!skipWhite(in)) throw MsgfException("%s expected in line %d.", "'='", line);
 		if (cur != '=') throw MsgfException("%s expected in line %d.", "'='", line);
@@ -271,7 +291,7 @@ void ConfigParser::read(Stream &in)
 				}
 			}
 			uint64 u;
-			if (!n.toInt64(u)) throw MsgfException("%s expected in line %d.", "integer", line);
+			if (!parseIntBuf(n.contentChar(), n.length(), u)) throw MsgfException("%s expected in line %d.", "integer", line);
 			((ConfigEntryInt *)e)->set(u);
 		} else {
 			if (m != '"') throw MsgfException("%s expected in line %d.", "'\"'", line);
@@ -284,7 +304,7 @@ void ConfigParser::read(Stream &in)
 				if (m == '\n') line++;
 			} while (m != '"');
 			s.del(0, 1);
-			((ConfigEntryString *)e)->set(s);
+			((ConfigEntryString *)e)->set(std::move(s));
 			if (!in.read(&cur, 1)) cur = ' ';
 		}
 		if (!skipWhite(in)) return;
@@ -295,14 +315,16 @@ void ConfigParser::read(Stream &in)
 
 ConfigEntry *ConfigParser::getEntry(const String &name)
 {
-	ConfigEntry empty(name, false);
+	InternedString iname;
+	// names that were never interned can't be entries
+	if (!InternedString::find(name, iname)) return NULL;
+	ConfigEntry empty(iname, false);
 	return (ConfigEntry *)entries->get(entries->find(&empty));
 }
 
 int ConfigParser::getConfigInt(const String &name)
 {
-	ConfigEntry empty(name, false);
-	ConfigEntry *entry = (ConfigEntry *)entries->get(entries->find(&empty));
+	ConfigEntry *entry = getEntry(name);
 	if (!entry) throw MsgfException("unknown entry '%y'", &name);
 	if (!entry->isInitialized()) throw MsgfException("%y is not set!", &name);
 	return entry->asInt();
@@ -310,17 +332,28 @@ int ConfigParser::getConfigInt(const String &name)
 
 String &ConfigParser::getConfigString(const String &name, String &result)
 {
-	ConfigEntry empty(name, false);
-	ConfigEntry *entry = (ConfigEntry *)entries->get(entries->find(&empty));
+	ConfigEntry *entry = getEntry(name);
 	if (!entry) throw MsgfException("unknown entry '%y'", &name);
 	if (!entry->isInitialized()) throw MsgfException("%y is not set!", &name);
 	return entry->asString(result);
 }
 
+String ConfigParser::takeConfigString(const String &name)
+{
+	ConfigEntry *entry = getEntry(name);
+	if (!entry) throw MsgfException("unknown entry '%y'", &name);
+	if (!entry->isInitialized()) throw MsgfException("%y is not set!", &name);
+	return entry->takeString();
+}
+
+InternedString ConfigParser::getConfigInterned(const String &name)
+{
+	String s;
+	return InternedString(getConfigString(name, s));
+}
+
 bool ConfigParser::haveKey(const String &name)
 {
-	ConfigEntry empty(name, false);
-	ConfigEntry *entry = (ConfigEntry *)entries->get(entries->find(&empty));
+	ConfigEntry *entry = getEntry(name);
 	return entry && entry->isSet();
 }
-
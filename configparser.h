@@ -22,6 +22,7 @@
 #define __CONFIGPARSER_H__
 
 #include "tools/data.h"
+#include "tools/intern.h"
 #include "tools/str.h"
 #include "tools/stream.h"
 
@@ -32,15 +33,16 @@ enum ConfigType {
 
 class ConfigEntry: public Object {
 public:
-	String *mName;
+	InternedString mName;
 	bool mMandatory;
 	bool mInitialized;
 	bool mSet;
 	
-			ConfigEntry(const String &aName, bool mandatory);
+			ConfigEntry(const InternedString &aName, bool mandatory);
 	virtual 	~ConfigEntry();
 	virtual int	asInt() const;
 	virtual String	&asString(String &result) const;
+	virtual String	takeString();
 	virtual ConfigType getType() const;
 	virtual bool	isSet() const;
 	virtual bool	isInitialized() const;
@@ -48,7 +50,7 @@ public:
 };
 
 class ConfigParser: public Object {
-	Container *entries;
+	AVLTree *entries;
 	byte cur;
 	int line;
 public:
@@ -67,6 +69,10 @@ public:
 		// these will throw an exception if key isn't set!
 		int	getConfigInt(const String &name);
 		String &getConfigString(const String &name, String &result);
+		// moves the value out of the entry, which is uninitialized afterwards
+		String	takeConfigString(const String &name);
+		// for enum-like values (few distinct values repeated everywhere)
+		InternedString getConfigInterned(const String &name);
 protected:
 		bool	skipWhite(Stream &in);
 		void	read(Stream &in);
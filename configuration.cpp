@@ -19,21 +19,20 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#include <fstream>
-
 #include "configuration.h"
-
-using namespace std;
+#include "tools/log.h"
+#include "tools/strbuilder.h"
 
 /**
  * Load Config for given path and store them to given structure
  * Returns true if succeeded, false otherwise.
  */
-bool load_config ( CONF& config, String path )
+bool load_config ( CONF& config, const String &path )
 {
 	bool bRet = false;
 	/* Load Configuration from path */
 	try {
+		delete gConfig;
 		gConfig = new ConfigParser();
 		/*                         Screen                            */
 		gConfig->acceptConfigEntryStringDef("ppc_start_resolution", "800x600x15");
@@ -77,23 +76,21 @@ bool load_config ( CONF& config, String path )
 		gConfig->acceptConfigEntryStringDef("nvram_file", "nvram");
 
 		try {
-			LocalFile *config;
-			config = new LocalFile(path);
-			gConfig->loadConfig(*config);
-			delete config;
+			LocalFileFD config(path, IOAM_READ, FOM_EXISTS);
+			gConfig->loadConfig(config);
 		} catch (const Exception &e) {
 			String res;
 			e.reason(res);
-			ht_printf("%y: %y\n", &path, &res);
+			ht_log(LOG_ERROR, HT_FMT("%y: %y\n"), path, res);
 			bRet = false;
 			exit(1);
 		}
 
-	ht_printf("\n[LOAD 1] Configuration loaded successfully from '%y'\n",&path);
+	ht_log(LOG_INFO, HT_FMT("\n[LOAD 1] Configuration loaded successfully from '%y'\n"), path);
 
 	/*             Save configuration in 'config' struct                */
 	/*                          Screen                                  */
-	gConfig->getConfigString("ppc_start_resolution", config.resolution);
+	config.resolution = gConfig->getConfigInterned("ppc_start_resolution");
 	config.full_screen = gConfig->getConfigInt("ppc_start_full_screen");
 	config.redraw = gConfig->getConfigInt("redraw_interval_msec");
 	/*                          Memory                                  */
@@ -102,122 +99,134 @@ bool load_config ( CONF& config, String path )
 	config.pvr = gConfig->getConfigInt("cpu_pvr");
 	config.pagetable = gConfig->getConfigInt("page_table_pa");
 	/*                         Key Codes                                */
-	gConfig->getConfigString("key_compose_dialog", config.compose_dialog);
-	gConfig->getConfigString("key_change_cd_0", config.change_cd);
-	gConfig->getConfigString("key_toggle_mouse_grab", config.mouse_grab);
-	gConfig->getConfigString("key_toggle_full_screen", config.fullscreen_k);
+	config.compose_dialog = gConfig->getConfigInterned("key_compose_dialog");
+	config.change_cd = gConfig->getConfigInterned("key_change_cd_0");
+	config.mouse_grab = gConfig->getConfigInterned("key_toggle_mouse_grab");
+	config.fullscreen_k = gConfig->getConfigInterned("key_toggle_full_screen");
 	/*                        Loader(PROM)                              */
-	gConfig->getConfigString("prom_bootmethod", config.bootmethod);
+	config.bootmethod = gConfig->getConfigInterned("prom_bootmethod");
 	// Check that if boot method is "force"
-	char *boot = config.bootmethod.contentChar();
-	if ( boot == "force" )
+	if ( config.bootmethod == "force" )
 	{
-		gConfig->getConfigString("prom_loadfile", config.loadfile);
-		gConfig->getConfigString("prom_env_bootpath", config.bootpath);
+		config.loadfile = gConfig->takeConfigString("prom_loadfile");
+		config.bootpath = gConfig->takeConfigString("prom_env_bootpath");
 	}
-	gConfig->getConfigString("prom_env_bootargs", config.bootargs);
-	gConfig->getConfigString("prom_env_machargs", config.machargs);
-	gConfig->getConfigString("prom_driver_graphic", config.driver_graph);
+	config.bootargs = gConfig->takeConfigString("prom_env_bootargs");
+	config.machargs = gConfig->takeConfigString("prom_env_machargs");
+	config.driver_graph = gConfig->takeConfigString("prom_driver_graphic");
 	/*                            IDE                                   */
 	config.ide0 = gConfig->getConfigInt("pci_ide0_master_installed");
-	gConfig->getConfigString("pci_ide0_master_type", config.ide0_type);
-	gConfig->getConfigString("pci_ide0_master_image", config.ide0_path);
+	config.ide0_type = gConfig->getConfigInterned("pci_ide0_master_type");
+	config.ide0_path = gConfig->takeConfigString("pci_ide0_master_image");
 	config.ide0_s = gConfig->getConfigInt("pci_ide0_slave_installed");
-	gConfig->getConfigString("pci_ide0_slave_type", config.ide0_s_type);
-	gConfig->getConfigString("pci_ide0_slave_image", config.ide0_s_path);
+	config.ide0_s_type = gConfig->getConfigInterned("pci_ide0_slave_type");
+	config.ide0_s_path = gConfig->takeConfigString("pci_ide0_slave_image");
 	/*                          Network                                 */
 	config.net_3c = gConfig->getConfigInt("pci_3c90x_installed");
-	gConfig->getConfigString("pci_3c90x_mac", config.net_3c_mac);
+	config.net_3c_mac = gConfig->takeConfigString("pci_3c90x_mac");
 	config.net_rtl = gConfig->getConfigInt("pci_rtl8139_installed");
-	gConfig->getConfigString("pci_rtl8139_mac", config.net_rtl_mac);
+	config.net_rtl_mac = gConfig->takeConfigString("pci_rtl8139_mac");
 	/*                            USB                                   */
 	config.usb = gConfig->getConfigInt("pci_usb_installed");
 	/*                           Serial                                 */
 	config.serial = gConfig->getConfigInt("pci_serial_installed");
 	/*                           NVRAM                                  */
-	gConfig->getConfigString("nvram_file", config.nvram);
+	config.nvram = gConfig->takeConfigString("nvram_file");
 
 	bRet = true; // Loaded successfully
-	ht_printf("\n[LOAD 2] Configuration stored successfully\n");
+	ht_log(LOG_INFO, HT_FMT("\n[LOAD 2] Configuration stored successfully\n"));
 
 	}catch (const std::exception &e) {
 		bRet = false;
-		ht_printf("\n[ERROR/LOAD] load_config() caught exception: %s\n", e.what());
+		ht_log(LOG_ERROR, HT_FMT("\n[ERROR/LOAD] load_config() caught exception: %s\n"), e.what());
 		return bRet;
 	} catch (const Exception &e) {
 		String res;
 		e.reason(res);
 		bRet = false;
-		ht_printf("\n[ERROR/LOAD] load_config() caught exception: %y\n", &res);
+		ht_log(LOG_ERROR, HT_FMT("\n[ERROR/LOAD] load_config() caught exception: %y\n"), res);
 		return bRet;
 	}
 	return bRet;
 }
 
+static void put_string ( StringBuilder &out, const char *key, const char *value )
+{
+	out.append(key).append(" = \"").append(value).append("\"\n");
+}
+
+static void put_int ( StringBuilder &out, const char *key, int value )
+{
+	out.append(key).append(" = ").appendInt(value).appendChar('\n');
+}
+
+static void put_hex ( StringBuilder &out, const char *key, uint32 value )
+{
+	out.append(key).append(" = 0x").appendHex(value).appendChar('\n');
+}
+
 /**
  * Save Configuration from structure to path.
  * Returns True if succeed, false otherwise.
  */
-bool save_config ( CONF& cnf, String path )
+bool save_config ( CONF& cnf, const String &path )
 {
-	ofstream fout;
+	StringBuilder out;
 	bool bRet = false;
 
-	fout.open(path.contentChar(),ios::out);
-	fout.exceptions ( ifstream::failbit | ifstream::badbit );
-	try{
-		/*                               Screen                                     */
-		fout << "ppc_start_resolution = \"" << cnf.resolution.contentChar() << "\"" << endl;
-		fout << "ppc_start_full_screen = " << cnf.full_screen << endl;
-		fout << "redraw_interval_msec = " << cnf.redraw << endl;
-		/*                             Key Codes                                    */
-		fout << "key_compose_dialog = \"" << cnf.compose_dialog.contentChar() << "\"" << endl;
-		fout << "key_change_cd_0 = \"" << cnf.change_cd.contentChar() << "\"" << endl;
-		fout << "key_toggle_mouse_grab = \"" << cnf.mouse_grab.contentChar() << "\"" << endl;
-		fout << "key_toggle_full_screen = \"" << cnf.fullscreen_k.contentChar() << "\"" << endl;
-		/*                            Loader(PROM)                                  */
-		fout << "prom_bootmethod = \"" << cnf.bootmethod.contentChar() << "\"" << endl;
-		// Check that if boot method is "force"
-		char *boot = cnf.bootmethod.contentChar();
-		if ( boot == "force" )
-		{
-			fout << "prom_loadfile = \"" << cnf.loadfile.contentChar() << "\"" << endl;
-			fout << "prom_env_bootpath = \"" << cnf.bootpath.contentChar() << "\"" << endl;
-		}
-		fout << "prom_env_bootargs = \"" << cnf.bootargs.contentChar() << "\"" << endl;
-		fout << "prom_env_machargs = \"" << cnf.machargs.contentChar() << "\"" << endl;
-		fout << "prom_driver_graphic = \"" << cnf.driver_graph.contentChar() << "\"" << endl;
-		/*                               CPU                                         */
-		fout << "cpu_pvr = " << hex << cnf.pvr << endl;
-		fout << "page_table_pa = " << hex << cnf.pagetable << endl;
-		/*                             Memory                                        */
-		fout << "memory_size = " << hex << cnf.memory << endl;
-		/*                               IDE                                         */
-		fout << "pci_ide0_master_installed = " << cnf.ide0 << endl;
-		fout << "pci_ide0_master_image = \"" << cnf.ide0_path.contentChar() << "\"" << endl;
-		fout << "pci_ide0_master_type = \"" << cnf.ide0_type.contentChar() << "\"" << endl;
-		fout << "pci_ide0_slave_installed = " << cnf.ide0_s << endl;
-		fout << "pci_ide0_slave_image = \"" << cnf.ide0_s_path.contentChar() << "\"" << endl;
-		fout << "pci_ide0_slave_type = \"" << cnf.ide0_s_type.contentChar() << "\"" << endl;
-		/*                             Network                                       */
-		fout << "pci_3c90x_installed = " << cnf.net_3c << endl;
-		fout << "pci_3c90x_mac = \"" << cnf.net_3c_mac.contentChar() << "\"" << endl;
-		fout << "pci_rtl8139_installed = " << cnf.net_rtl << endl;
-		fout << "pci_rtl8139_mac = \"" << cnf.net_rtl_mac.contentChar() << "\"" << endl;
-		/*                              USB                                          */
-		fout << "pci_usb_installed = " << cnf.usb << endl;
-		/*                          Serial Port                                      */
-		fout << "pci_serial_installed = " << cnf.serial << endl;
-		/*                             NVRAM                                         */
-		fout << "nvram_file = \"" << cnf.nvram.contentChar() << "\"" << endl;
+	/*                               Screen                                     */
+	put_string(out, "ppc_start_resolution", cnf.resolution.contentChar());
+	put_int(out, "ppc_start_full_screen", cnf.full_screen);
+	put_int(out, "redraw_interval_msec", cnf.redraw);
+	/*                             Key Codes                                    */
+	put_string(out, "key_compose_dialog", cnf.compose_dialog.contentChar());
+	put_string(out, "key_change_cd_0", cnf.change_cd.contentChar());
+	put_string(out, "key_toggle_mouse_grab", cnf.mouse_grab.contentChar());
+	put_string(out, "key_toggle_full_screen", cnf.fullscreen_k.contentChar());
+	/*                            Loader(PROM)                                  */
+	put_string(out, "prom_bootmethod", cnf.bootmethod.contentChar());
+	// Check that if boot method is "force"
+	if ( cnf.bootmethod == "force" )
+	{
+		put_string(out, "prom_loadfile", cnf.loadfile.contentChar());
+		put_string(out, "prom_env_bootpath", cnf.bootpath.contentChar());
+	}
+	put_string(out, "prom_env_bootargs", cnf.bootargs.contentChar());
+	put_string(out, "prom_env_machargs", cnf.machargs.contentChar());
+	put_string(out, "prom_driver_graphic", cnf.driver_graph.contentChar());
+	/*                               CPU                                         */
+	put_hex(out, "cpu_pvr", cnf.pvr);
+	put_hex(out, "page_table_pa", cnf.pagetable);
+	/*                             Memory                                        */
+	put_hex(out, "memory_size", cnf.memory);
+	/*                               IDE                                         */
+	put_int(out, "pci_ide0_master_installed", cnf.ide0);
+	put_string(out, "pci_ide0_master_image", cnf.ide0_path.contentChar());
+	put_string(out, "pci_ide0_master_type", cnf.ide0_type.contentChar());
+	put_int(out, "pci_ide0_slave_installed", cnf.ide0_s);
+	put_string(out, "pci_ide0_slave_image", cnf.ide0_s_path.contentChar());
+	put_string(out, "pci_ide0_slave_type", cnf.ide0_s_type.contentChar());
+	/*                             Network                                       */
+	put_int(out, "pci_3c90x_installed", cnf.net_3c);
+	put_string(out, "pci_3c90x_mac", cnf.net_3c_mac.contentChar());
+	put_int(out, "pci_rtl8139_installed", cnf.net_rtl);
+	put_string(out, "pci_rtl8139_mac", cnf.net_rtl_mac.contentChar());
+	/*                              USB                                          */
+	put_int(out, "pci_usb_installed", cnf.usb);
+	/*                          Serial Port                                      */
+	put_int(out, "pci_serial_installed", cnf.serial);
+	/*                             NVRAM                                         */
+	put_string(out, "nvram_file", cnf.nvram.contentChar());
 
-		fout.close();
+	try{
+		LocalFileFD fout(path, IOAM_WRITE, FOM_CREATE);
+		out.flush(fout);
 
-		ht_printf("\n[SAVE] Configuration file '%y' saved successfully.\n",&path);
+		ht_log(LOG_INFO, HT_FMT("\n[SAVE] Configuration file '%y' saved successfully.\n"), path);
 		bRet = true;
-	}catch (ifstream::failure e) {
-		ht_printf("\n[ERROR/SAVE] Configuration file '%y' cannot be saved.  \
-		           Because a error occursed when opening/writing the configuration file\n",&path);
+	}catch (const Exception &e) {
+		ht_log(LOG_ERROR, HT_FMT("\n[ERROR/SAVE] Configuration file '%y' cannot be saved.  \
+		           Because a error occursed when opening/writing the configuration file\n"), path);
 		bRet = false;
 	}
 
@@ -25,16 +25,16 @@
 
 typedef struct
 {
-	String resolution;
+	InternedString resolution;
 	int full_screen;
 	int redraw;
 	/* Key Codes */
-	String compose_dialog;
-	String change_cd;
-	String mouse_grab;
-	String fullscreen_k;
+	InternedString compose_dialog;
+	InternedString change_cd;
+	InternedString mouse_grab;
+	InternedString fullscreen_k;
 	/* Loader */
-	String bootmethod;
+	InternedString bootmethod;
 	String loadfile;
 	String bootpath;
 	String bootargs;
@@ -48,10 +48,10 @@ typedef struct
 	/* IDE */
 	int ide0;
 	String ide0_path;
-	String ide0_type;
+	InternedString ide0_type;
 	int ide0_s;
 	String ide0_s_path;
-	String ide0_s_type;
+	InternedString ide0_s_type;
 	/* Network */
 	int net_3c;
 	String net_3c_mac;
@@ -65,5 +65,5 @@ typedef struct
 	String nvram;
 } CONF;
 
-bool load_config ( CONF& config, String path );
-bool save_config ( CONF& cnf, String path );
+bool load_config ( CONF& config, const String &path );
+bool save_config ( CONF& cnf, const String &path );
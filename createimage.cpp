@@ -46,7 +46,6 @@
 
 /* TODO:
  * - Add code for Big Endian systems
- * - Fix fatal in fileset()
  */
 
 #include <cstdio>
@@ -56,13 +55,17 @@
 
 //#include "../osdep.h"
 //#include "bswap.h"
+#include "tools/except.h"
+#include "tools/log.h"
+#include "tools/stream.h"
+#include "tools/sysfile.h"
 #include "tools/types.h"
 
 #define BX_MAX_CYL_BITS 24 // 8 TB
 
 const int bx_max_hd_megs = (int)(((1 << BX_MAX_CYL_BITS) - 1) * 16.0 * 63.0 / 2048.0);
 
-typedef bool (*WRITE_IMAGE)(FILE*, uint64);
+typedef bool (*WRITE_IMAGE)(File*, uint64);
 
 #ifndef __BIG_ENDIAN__  // GCC 4.x
 #define BX_LITTLE_ENDIAN 1 // Host is Little Endian (x86...etc)
@@ -106,55 +109,85 @@ typedef bool (*WRITE_IMAGE)(FILE*, uint64);
 #endif
 /*               End               */
 
-// fileset is like memset but for a file handle
-void fileset(FILE * fp, int c, size_t n)
+// pieces queued for one writev()
+#define IMAGE_IOV_MAX 64
+// fill blocks for image_set()
+#define IMAGE_BLOCK_SIZE (32*1024)
+// buffer for images written with IOAM_DIRECT
+#define IMAGE_STAGE_SIZE (1024*1024)
+// appended to the image name for the file of block checksums
+#define IMAGE_CHECKSUM_SUFFIX ".crc32c"
+
+// collects the pieces of an image header, so that they are written
+// with as few system calls as possible
+typedef struct
 {
-#define BLOCK_SIZE (1024)
- int block[BLOCK_SIZE];
- size_t left_to_write = n;
-
- memset(block, c, sizeof(block));
-
- while(left_to_write > 0)
- {
-   size_t write = sizeof(block);
-   if (write > left_to_write) write = left_to_write;
+  File *file;
+  struct iovec iov[IMAGE_IOV_MAX];
+  int count;
+  // with IOAM_DIRECT, the pieces are copied into an aligned buffer
+  // instead, so that they can bypass the page cache
+  byte *stage;
+  size_t staged;
+} image_writer_t;
+
+static void image_flush(image_writer_t &w)
+{
+  if (w.stage) {
+    if (w.staged) w.file->writex(w.stage, w.staged);
+    w.staged = 0;
+    return;
+  }
+  if (w.count) w.file->writevx(w.iov, w.count);
+  w.count = 0;
+}
 
-   if (1 != fwrite(block, write, 1, fp))
-   {
-     fclose(fp);
-     //fatal("\nERROR: The disk image is not complete - could not write data block!");
-   }
+static void image_put(image_writer_t &w, const void *buf, size_t n)
+{
+  if (w.stage) {
+    const byte *p = (const byte *)buf;
+    while (n > 0) {
+      size_t k = IMAGE_STAGE_SIZE - w.staged;
+      if (k > n) k = n;
+      memcpy(w.stage + w.staged, p, k);
+      w.staged += k;
+      p += k;
+      n -= k;
+      if (w.staged == IMAGE_STAGE_SIZE) image_flush(w);
+    }
+    return;
+  }
+  if (w.count == IMAGE_IOV_MAX) image_flush(w);
+  w.iov[w.count].iov_base = (void *)buf;
+  w.iov[w.count].iov_len = n;
+  w.count++;
+}
 
-   left_to_write -= write;
- }
+// image_set is like memset but for the image, |block| holds
+// IMAGE_BLOCK_SIZE bytes of the fill value (and is referenced, not copied)
+static void image_set(image_writer_t &w, const byte *block, size_t n)
+{
+  while (n > 0)
+  {
+    size_t k = n;
+    if (k > IMAGE_BLOCK_SIZE) k = IMAGE_BLOCK_SIZE;
+    image_put(w, block, k);
+    n -= k;
+  }
 }
 
 /* produce a flat image file */
-bool make_flat_image(FILE *fp, uint64 sec)
+bool make_flat_image(File *f, uint64 sec)
 {
   bool bRet = false;
  /*
-  * seek to sec*512-1 and write a single character.
-  * can't just do: fseek(fp, 512*sec-1, SEEK_SET)
-  * because 512*sec may be too large for signed int.
+  * write a single byte at the end and leave the rest as a hole.
   */
-  while(sec > 0)
-  {
-    /* temp <-- min(sec, 4194303)
-     * 4194303 is (int)(0x7FFFFFFF/512)
-     */
-    long temp = (long)((sec < 4194303) ? sec : 4194303);
-    fseek(fp, 512*temp, SEEK_CUR);
-    sec -= temp;
-  }
-
-  fseek(fp, -1, SEEK_CUR);
-  if (fputc('\0', fp) == EOF)
-  {
-    fclose(fp);
+  try {
+    f->writeAtx(sec * 512 - 1, "", 1);
+  } catch (const IOException &e) {
     bRet = false;
-    printf("\nERROR: The disk image is not complete! (image larger then free space?)");
+    ht_log(LOG_ERROR, HT_FMT("\nERROR: The disk image is not complete! (image larger then free space?)"));
     return bRet;
   }
   bRet = true; // File Created!
@@ -163,7 +196,7 @@ bool make_flat_image(FILE *fp, uint64 sec)
 }
 
 /* produce a sparse image file */
-bool make_sparse_image(FILE *fp, uint64 sec)
+bool make_sparse_image(File *f, uint64 sec)
 {
   uint64 numpages;
   sparse_header_t header;
@@ -183,70 +216,103 @@ bool make_sparse_image(FILE *fp, uint64 sec)
 
   if (numpages != dtoh32(header.numpages))
   {
-    fclose(fp);
-    printf("\nERROR: The disk image is too large for a sparse image!");
+    ht_log(LOG_ERROR, HT_FMT("\nERROR: The disk image is too large for a sparse image!"));
     bRet = false;
     return bRet;
     // Could increase page size here.
     // But note this only happens at 128 Terabytes!
   }
 
-  if (fwrite(&header, sizeof(header), 1, fp) != 1)
-  {
-    fclose(fp);
-    printf("\nERROR: The disk image is not complete - could not write header!");
-    bRet = false;
-    return bRet;
-  }
-
-  fileset(fp, 0xff, 4 * dtoh32(header.numpages));
-
   sizesofar = SPARSE_HEADER_SIZE + (4 * dtoh32(header.numpages));
   padtopagesize = dtoh32(header.pagesize) - (sizesofar & (dtoh32(header.pagesize) - 1));
 
-  fileset(fp, 0, padtopagesize);
+  // header, page table (all pages unallocated) and padding,
+  // gathered into few writes
+  byte unallocated[IMAGE_BLOCK_SIZE];
+  byte zero[IMAGE_BLOCK_SIZE];
+  memset(unallocated, 0xff, sizeof(unallocated));
+  memset(zero, 0, sizeof(zero));
+
+  image_writer_t w;
+  w.file = f;
+  w.count = 0;
+  w.stage = (f->getAccessMode() & IOAM_DIRECT) ? (byte *)directAlloc(IMAGE_STAGE_SIZE) : NULL;
+  w.staged = 0;
+  try {
+    image_put(w, &header, sizeof(header));
+    image_set(w, unallocated, 4 * dtoh32(header.numpages));
+    image_set(w, zero, padtopagesize);
+    image_flush(w);
+  } catch (const IOException &e) {
+    directFree(w.stage);
+    ht_log(LOG_ERROR, HT_FMT("\nERROR: The disk image is not complete - could not write header!"));
+    bRet = false;
+    return bRet;
+  }
+  directFree(w.stage);
   bRet = true; // File Created!
 
   return bRet;
 }
 
-/* produce the image file */
-bool make_image(uint64 sec, char *filename, WRITE_IMAGE write_image)
+/* save the block checksums recorded while writing the image */
+bool save_checksums(ChecksumFile *c, char *filename)
+{
+  String name(filename);
+  name += IMAGE_CHECKSUM_SUFFIX;
+  try {
+    LocalFileFD f(name, IOAM_WRITE, FOM_CREATE);
+    c->saveChecksums(f);
+  } catch (const IOException &e) {
+    ht_log(LOG_ERROR, HT_FMT("\nERROR: Could not write checksums of disk image"));
+    return false;
+  }
+  return true;
+}
+
+/* produce the image file, with |direct| bypassing the page cache and
+ * |checksums| recording CRC32C checksums of its blocks (in the same pass)
+ */
+bool make_image(uint64 sec, char *filename, WRITE_IMAGE write_image, bool direct, bool checksums)
 {
-  FILE *fp;
-  char buffer[1024];
+  pstat_t s;
   bool bRet = false;
 
   // check if it exists before trashing someone's disk image
-  fp = fopen(filename, "r");
-  if (fp) {
+  if (sys_pstat(s, filename) == 0) {
     // File Exists
     bRet = false;
-    fclose(fp);
     return bRet;
   }
 
   // okay, now open it for writing
-  fp = fopen(filename, "w");
-  if (fp == NULL) {
+  LocalFileFD *f;
+  try {
+    f = new LocalFileFD(filename, IOAM_WRITE | (direct ? IOAM_DIRECT : 0), FOM_CREATE);
+  } catch (const IOException &e) {
     // attempt to print an error
     bRet = false;
-    printf("\nERROR: Could not write disk image");
+    ht_log(LOG_ERROR, HT_FMT("\nERROR: Could not write disk image"));
     return bRet;
   }
 
-  if((*write_image)(fp, sec) != true) {
+  File *image = f;
+  ChecksumFile *c = NULL;
+  if (checksums) image = c = new ChecksumFile(f, true);
+
+  if((*write_image)(image, sec) != true) {
+    delete image;
     bRet = false;
-    printf("\nERROR: while writing disk image!");
+    ht_log(LOG_ERROR, HT_FMT("\nERROR: while writing disk image!"));
     return bRet;
   }
 
-  fclose(fp);
-  bRet = true; // File Created!
+  bRet = c ? save_checksums(c, filename) : true; // File Created!
+  delete image;
   return bRet;
 }
 
-bool Create_HD_Image ( int hdsize, char *path, bool sparse )
+bool Create_HD_Image ( int hdsize, char *path, bool sparse, bool direct, bool checksums )
 {
   uint64 sectors = 0;
   uint64 cyl;
@@ -267,15 +333,15 @@ bool Create_HD_Image ( int hdsize, char *path, bool sparse )
     write_function=make_sparse_image;
   }
 
-  bRet = make_image(sectors, path, write_function);
+  bRet = make_image(sectors, path, write_function, direct, checksums);
   if ( !bRet ) {
     // File Not Created!
-    printf("\n[Error] File not Created!");
+    ht_log(LOG_ERROR, HT_FMT("\n[Error] File not Created!"));
     return bRet;
   }
 
   // File Created!
-  printf("\n[CHDI] Disk image '%s' Created with size %d MB",path,hdsize);
+  ht_log(LOG_INFO, HT_FMT("\n[CHDI] Disk image '%s' Created with size %d MB"), path, hdsize);
   bRet = true;
 
   return bRet;
@@ -19,4 +19,4 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
- bool Create_HD_Image ( int hdsize, char *path, bool sparse );
+ bool Create_HD_Image ( int hdsize, char *path, bool sparse, bool direct = false, bool checksums = false );
@@ -23,7 +23,7 @@
 
 #include "configuration.h"
 #include "createimage.h"
-#include "tools/snprintf.h"
+#include "tools/log.h"
 
 
 int main ( int argc, char *argv[] )
@@ -33,10 +33,10 @@ int main ( int argc, char *argv[] )
 
 	ret = load_config(conf,"/home/mominul/src/ppccfg.ppc");
 
-	ht_printf("\nCompose Dialog = %y\n",&conf.compose_dialog);
-	ht_printf("\n3x mac = %y\n",&conf.net_3c_mac);
-	ht_printf("\npvr = %d\n",&conf.pvr);
-	ht_printf("\nmemory = %d\n",&conf.memory);
+	ht_log(LOG_INFO, HT_FMT("\nCompose Dialog = %y\n"), conf.compose_dialog);
+	ht_log(LOG_INFO, HT_FMT("\n3x mac = %y\n"), conf.net_3c_mac);
+	ht_log(LOG_INFO, HT_FMT("\npvr = 0x%08x\n"), conf.pvr);
+	ht_log(LOG_INFO, HT_FMT("\nmemory = %u\n"), conf.memory);
 
 	ret = save_config(conf,"/home/mominul/src/newcfg.ppc");
 	ret = load_config(conf,"/home/mominul/src/newcfg.ppc");
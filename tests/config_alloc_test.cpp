@@ -0,0 +1,202 @@
+/*
+ *  PearBox
+ *  config_alloc_test.cpp
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/*
+ * Counts the allocations of the config load path: load_config() must
+ * move the string values out of the parser (takeConfigString()), so
+ * afterwards each long value lives in exactly one buffer, owned by CONF.
+ *
+ * malloc() and friends are replaced by counting versions (glibc only),
+ * String and operator new both end up there.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <unistd.h>
+
+#include "configuration.h"
+#include "tools/log.h"
+#include "tools/stream.h"
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void __libc_free(void *p);
+}
+
+// values are this long, allocations of [VALUE_MIN, VALUE_MAX] bytes are tracked
+#define VALUE_LENGTH	3000
+#define VALUE_MIN	VALUE_LENGTH
+#define VALUE_MAX	(4*VALUE_LENGTH)
+#define MAX_TRACKED	256
+
+static std::mutex gLock;
+static bool gCounting;
+static long gAllocs;
+static void *gTracked[MAX_TRACKED];
+
+static void track(void *old, void *p, size_t size)
+{
+	std::lock_guard<std::mutex> l(gLock);
+	if (!gCounting) return;
+	for (int i = 0; i < MAX_TRACKED; i++) {
+		if (old && gTracked[i] == old) gTracked[i] = NULL;
+	}
+	if (p && size >= VALUE_MIN && size <= VALUE_MAX) {
+		for (int i = 0; i < MAX_TRACKED; i++) {
+			if (!gTracked[i]) {
+				gTracked[i] = p;
+				break;
+			}
+		}
+	}
+	if (p && p != old) gAllocs++;
+}
+
+extern "C" {
+void *malloc(size_t size)
+{
+	void *p = __libc_malloc(size);
+	track(NULL, p, size);
+	return p;
+}
+
+void *calloc(size_t n, size_t size)
+{
+	void *p = __libc_calloc(n, size);
+	track(NULL, p, n * size);
+	return p;
+}
+
+void *realloc(void *old, size_t size)
+{
+	void *p = __libc_realloc(old, size);
+	track(old, p, size);
+	return p;
+}
+
+void free(void *p)
+{
+	track(p, NULL, 0);
+	__libc_free(p);
+}
+}
+
+static int live()
+{
+	std::lock_guard<std::mutex> l(gLock);
+	int n = 0;
+	for (int i = 0; i < MAX_TRACKED; i++) if (gTracked[i]) n++;
+	return n;
+}
+
+static int failed = 0;
+
+static void check(bool ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failed++;
+}
+
+static String value(char c)
+{
+	return String(c, VALUE_LENGTH);
+}
+
+static bool tracked(const void *p)
+{
+	std::lock_guard<std::mutex> l(gLock);
+	for (int i = 0; i < MAX_TRACKED; i++) {
+		if (gTracked[i] == p) return true;
+	}
+	return false;
+}
+
+static bool owns(const String &s, char c)
+{
+	// value() allocates, so not under gLock
+	return s == value(c) && tracked(s.content());
+}
+
+static const char *gKeys[] = {
+	"prom_loadfile", "prom_env_bootpath", "prom_env_bootargs",
+	"prom_env_machargs", "prom_driver_graphic", "pci_ide0_master_image",
+	"pci_ide0_slave_image", "pci_3c90x_mac", "pci_rtl8139_mac", "nvram_file",
+};
+#define KEY_COUNT	(int)(sizeof gKeys / sizeof gKeys[0])
+
+int main()
+{
+	static_assert(std::is_nothrow_move_constructible<String>::value, "String(String &&) must be noexcept");
+	static_assert(std::is_nothrow_move_assignable<String>::value, "operator =(String &&) must be noexcept");
+
+	logSetConsole(false);
+
+	char path[] = "/tmp/pearbox_config_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) return 1;
+	close(fd);
+	{
+		LocalFileFD f(path, IOAM_WRITE, FOM_CREATE);
+		String line;
+		line.assign("prom_bootmethod = \"force\"\n"
+			"pci_ide0_master_type = \"hd\"\n"
+			"pci_ide0_slave_type = \"cdrom\"\n");
+		f.writex(line.content(), line.length());
+		for (int i = 0; i < KEY_COUNT; i++) {
+			line.assign(gKeys[i]);
+			line += " = \"";
+			line += value('a' + i);
+			line += "\"\n";
+			f.writex(line.content(), line.length());
+		}
+	}
+
+	// stdio allocates its buffer on first use, get that out of the way
+	printf("loading %s\n", path);
+	fflush(stdout);
+
+	CONF conf;
+	gCounting = true;
+	bool ok = load_config(conf, path);
+	int after = live();
+	long allocs = gAllocs;
+	check(ok, "load_config()");
+	check(after == KEY_COUNT, "one buffer per long value after loading");
+	const String *fields[KEY_COUNT] = {
+		&conf.loadfile, &conf.bootpath, &conf.bootargs, &conf.machargs,
+		&conf.driver_graph, &conf.ide0_path, &conf.ide0_s_path,
+		&conf.net_3c_mac, &conf.net_rtl_mac, &conf.nvram,
+	};
+	bool moved = true;
+	for (int i = 0; i < KEY_COUNT; i++) moved = moved && owns(*fields[i], 'a' + i);
+	check(moved, "CONF owns the buffers the parser read into");
+
+	long before = gAllocs;
+	String s(std::move(conf.bootargs));
+	conf.nvram = std::move(s);
+	check(gAllocs == before, "moving a String doesn't allocate");
+	check(live() == KEY_COUNT - 1, "moved-over buffer is freed");
+
+	printf("%ld allocations while loading\n", allocs);
+	gCounting = false;
+	unlink(path);
+	doneLog();
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,322 @@
+/*
+ *  PearBox
+ *  mpmcqueue_test.cpp
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/*
+ * Multi-producer/multi-consumer stress test of MPMCQueue and
+ * SegmentedMPMCQueue. Producers mix single and batch en-queues (some
+ * larger than a segment), consumers mix the blocking, non-blocking and
+ * batch de-queues. Every element must arrive exactly once and each
+ * consumer must see each producer's elements in order.
+ *
+ * operator new and delete are replaced by versions counting the
+ * segment sized allocations (glibc only, for malloc_usable_size()),
+ * to check that drained segments are reclaimed while the queue is used.
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "tools/mpmcqueue.h"
+
+#define PRODUCERS	4
+#define CONSUMERS	4
+#define PER_PRODUCER	100000
+#define TOTAL		(PRODUCERS * PER_PRODUCER)
+// en-queued once per consumer after the producers are done
+#define STOP		0xffffffff
+// allocations of at least this size are counted as segments
+#define SEGMENT_MIN	(MPMC_SEGMENT_SIZE * sizeof(void*))
+#define SEGMENT_MAX	(SEGMENT_MIN + 256)
+
+static std::atomic<long> gSegments(0);
+static std::atomic<long> gSegmentsLive(0);
+
+static bool isSegment(void *p)
+{
+	size_t size = malloc_usable_size(p);
+	return size >= SEGMENT_MIN && size <= SEGMENT_MAX;
+}
+
+static void *allocate(size_t size)
+{
+	void *p = malloc(size ? size : 1);
+	if (p && isSegment(p)) {
+		gSegments++;
+		gSegmentsLive++;
+	}
+	return p;
+}
+
+static void deallocate(void *p)
+{
+	if (p && isSegment(p)) gSegmentsLive--;
+	free(p);
+}
+
+void *operator new(size_t size)
+{
+	void *p = allocate(size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return allocate(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	deallocate(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	deallocate(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	deallocate(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	deallocate(p);
+}
+
+static int failed = 0;
+
+static void check(bool ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failed++;
+}
+
+static std::atomic<int> gDestroyed(0);
+
+class Item: public UInt {
+public:
+	Item(uint v) : UInt(v) {}
+	~Item() { gDestroyed++; }
+};
+
+/*
+ *	what the consumers saw
+ */
+struct Result {
+	std::vector<std::atomic<int>> seen;
+	std::atomic<bool> ordered;
+
+	Result() : seen(TOTAL), ordered(true)
+	{
+		for (int i = 0; i < TOTAL; i++) seen[i] = 0;
+	}
+
+	bool complete() const
+	{
+		for (int i = 0; i < TOTAL; i++) if (seen[i] != 1) return false;
+		return true;
+	}
+};
+
+/*
+ *	en-queues objs[0..PER_PRODUCER), with batches of 1 to 64 elements,
+ *	and now and then one larger than a segment
+ */
+template <class Queue>
+static void produce(Queue &q, Object **objs, uint seed)
+{
+	int i = 0;
+	while (i < PER_PRODUCER) {
+		seed = seed * 1103515245 + 12345;
+		uint r = seed >> 16;
+		int n;
+		if (r % 101 == 0) {
+			n = MPMC_SEGMENT_SIZE + r % 512;
+		} else {
+			n = 1 + r % 64;
+		}
+		n = MIN(n, PER_PRODUCER - i);
+		if (n == 1 || r & 1) {
+			for (int j = 0; j < n; j++) q.enQueue(objs[i+j]);
+		} else {
+			q.enQueueBatch(objs + i, n);
+		}
+		i += n;
+	}
+}
+
+/*
+ *	takes one element of a de-queued batch
+ *	@returns false on STOP
+ */
+static bool take(Result &res, uint *last, Object *obj)
+{
+	uint v = ((UInt*)obj)->value;
+	if (v == STOP) return false;
+	res.seen[v]++;
+	uint p = v / PER_PRODUCER;
+	if (last[p] != STOP && v <= last[p]) res.ordered = false;
+	last[p] = v;
+	return true;
+}
+
+template <class Queue>
+static void consume(Queue &q, Result &res, uint seed)
+{
+	uint last[PRODUCERS];
+	for (int p = 0; p < PRODUCERS; p++) last[p] = STOP;
+	Object *buf[32];
+	while (true) {
+		seed = seed * 1103515245 + 12345;
+		uint n;
+		switch ((seed >> 16) % 4) {
+			case 0:
+				buf[0] = q.deQueue();
+				n = 1;
+				break;
+			case 1:
+				n = q.deQueueBatch(buf, 1 + (seed >> 20) % 32);
+				break;
+			case 2:
+				n = q.tryDeQueue(buf[0]) ? 1 : 0;
+				break;
+			default:
+				n = q.tryDeQueueBatch(buf, 32);
+				break;
+		}
+		for (uint i = 0; i < n; i++) {
+			if (!take(res, last, buf[i])) {
+				// STOPs come last, the rest of the batch can only be STOPs
+				if (i+1 < n) q.enQueueBatch(buf+i+1, n-i-1);
+				return;
+			}
+		}
+		if (!n) std::this_thread::yield();
+	}
+}
+
+template <class Queue>
+static void stress(Queue &q, Result &res)
+{
+	std::vector<Item> items;
+	items.reserve(TOTAL);
+	for (int i = 0; i < TOTAL; i++) items.emplace_back(i);
+	std::vector<Object *> objs(TOTAL);
+	for (int i = 0; i < TOTAL; i++) objs[i] = &items[i];
+	Item stop(STOP);
+
+	std::vector<std::thread> producers, consumers;
+	for (int c = 0; c < CONSUMERS; c++) {
+		consumers.emplace_back([&, c] { consume(q, res, c + 1); });
+	}
+	for (int p = 0; p < PRODUCERS; p++) {
+		producers.emplace_back([&, p] { produce(q, &objs[p * PER_PRODUCER], p + 100); });
+	}
+	for (auto &t : producers) t.join();
+	for (int c = 0; c < CONSUMERS; c++) q.enQueue(&stop);
+	for (auto &t : consumers) t.join();
+}
+
+static void testBounded()
+{
+	printf("MPMCQueue\n");
+	Result res;
+	{
+		// small, so the producers have to wait
+		MPMCQueue q(256, false);
+		check(q.capacity() == 256, "capacity()");
+		stress(q, res);
+		check(q.count() == 0, "empty afterwards");
+	}
+	check(res.complete(), "every element de-queued exactly once");
+	check(res.ordered, "each producer's elements in order");
+
+	gDestroyed = 0;
+	{
+		MPMCQueue q(4, true);
+		Object *objs[] = {new Item(1), new Item(2), new Item(3)};
+		q.enQueueBatch(objs, 3);
+		check(q.tryEnQueue(new Item(4)), "tryEnQueue() if not full");
+		Item *extra = new Item(5);
+		check(!q.tryEnQueue(extra), "tryEnQueue() if full");
+		delete extra;
+		Object *obj;
+		check(q.tryDeQueue(obj) && ((UInt*)obj)->value == 1, "tryDeQueue()");
+		delete obj;
+	}
+	check(gDestroyed == 5, "destructor deletes the remaining elements");
+}
+
+static void testSegmented()
+{
+	printf("SegmentedMPMCQueue\n");
+	Result res;
+	long segments = gSegments;
+	{
+		SegmentedMPMCQueue q(false);
+		stress(q, res);
+		long allocated = gSegments - segments;
+		long live = gSegmentsLive;
+		// the current one plus those retired, but not scanned yet
+		long bound = 1 + (PRODUCERS + CONSUMERS + 1) * MPMC_RETIRE_THRESHOLD;
+		printf("%ld segments allocated, %ld alive\n", allocated, live);
+		check(allocated >= TOTAL / MPMC_SEGMENT_SIZE, "segments allocated");
+		check(live <= bound, "drained segments are reclaimed");
+		Object *obj;
+		check(!q.tryDeQueue(obj), "empty afterwards");
+	}
+	check(gSegmentsLive == 0, "destructor frees all segments");
+	check(res.complete(), "every element de-queued exactly once");
+	check(res.ordered, "each producer's elements in order");
+
+	gDestroyed = 0;
+	{
+		SegmentedMPMCQueue q(true);
+		for (int i = 0; i < 3000; i++) q.enQueue(new Item(i));
+		Object *objs[1000];
+		uint n = q.tryDeQueueBatch(objs, 1000);
+		bool ordered = n == 1000;
+		for (uint i = 0; i < n; i++) {
+			ordered = ordered && ((UInt*)objs[i])->value == i;
+			delete objs[i];
+		}
+		check(ordered, "tryDeQueueBatch() in order");
+	}
+	check(gDestroyed == 3000, "destructor deletes the remaining elements");
+}
+
+int main()
+{
+	testBounded();
+	testSegmented();
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,224 @@
+/*
+ *	PearBox
+ *	crc32c.cc
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstring>
+#include <stdint.h>
+
+#include "crc32c.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define HAVE_CRC32C_SSE42
+#endif
+
+/*
+ *	the polynomial, bit-reflected (bit 31 is x^0)
+ */
+#define CRC32C_POLY		0x82f63b78
+
+/*
+ *	lane lengths of the three-way interleaved loop
+ */
+#define CRC32C_LONG		8192
+#define CRC32C_SHORT		256
+
+typedef uint32 (*crc32c_func)(uint32 crc, const byte *p, size_t n);
+
+static uint32 gCrc32cTable[8][256];
+// x^(2^k) mod P
+static uint32 gCrc32cPow2[64];
+
+/*
+ *	a * b mod P
+ */
+static uint32 multModP(uint32 a, uint32 b)
+{
+	uint32 p = 0;
+	for (int i = 0; i < 32; i++) {
+		if (a & (0x80000000 >> i)) p ^= b;
+		b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return p;
+}
+
+/*
+ *	x^|e| mod P
+ */
+static uint32 xPowModP(uint64 e)
+{
+	uint32 p = 0x80000000;
+	for (int k = 0; e; k++, e >>= 1) {
+		if (e & 1) p = multModP(p, gCrc32cPow2[k]);
+	}
+	return p;
+}
+
+/*
+ *	slicing-by-8, byte order independent
+ */
+static uint32 crc32cTable(uint32 crc, const byte *p, size_t n)
+{
+	const uint32 (*t)[256] = gCrc32cTable;
+	while (n >= 8) {
+		uint32 lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32)p[3] << 24));
+		uint32 hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32)p[7] << 24);
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff]
+			^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+			^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff]
+			^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+		p += 8;
+		n -= 8;
+	}
+	while (n--) crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#ifdef HAVE_CRC32C_SSE42
+
+// x^(8*len - 33) mod P, see crc32cShift()
+static uint32 gCrc32cLong1, gCrc32cLong2, gCrc32cShort1, gCrc32cShort2;
+
+static inline uint64 load64(const byte *p)
+{
+	uint64 w;
+	memcpy(&w, p, 8);
+	return w;
+}
+
+__attribute__((target("sse4.2")))
+static uint32 crc32cSse42(uint32 crc, const byte *p, size_t n)
+{
+	uint64 c = crc;
+	while (n && ((uintptr_t)p & 7)) {
+		c = _mm_crc32_u8(c, *p++);
+		n--;
+	}
+	while (n >= 8) {
+		c = _mm_crc32_u64(c, load64(p));
+		p += 8;
+		n -= 8;
+	}
+	while (n--) c = _mm_crc32_u8(c, *p++);
+	return c;
+}
+
+/*
+ *	|crc| * x^(8*len) mod P for |k| = x^(8*len - 33) mod P:
+ *	the carry-less product is |crc| * |k| * x, the crc32
+ *	instruction multiplies by x^32 and reduces.
+ */
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32 crc32cShift(uint32 crc, uint32 k)
+{
+	__m128i t = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc), _mm_cvtsi32_si128(k), 0);
+	return _mm_crc32_u64(0, _mm_cvtsi128_si64(t));
+}
+
+/*
+ *	three independent crc32 chains hide the instruction's latency,
+ *	their results are combined with crc32cShift()
+ */
+__attribute__((target("sse4.2,pclmul")))
+static uint32 crc32cPclmul(uint32 crc, const byte *p, size_t n)
+{
+	uint64 c0 = crc;
+	while (n && ((uintptr_t)p & 7)) {
+		c0 = _mm_crc32_u8(c0, *p++);
+		n--;
+	}
+	while (n >= 3 * CRC32C_LONG) {
+		uint64 c1 = 0, c2 = 0;
+		const byte *end = p + CRC32C_LONG;
+		do {
+			c0 = _mm_crc32_u64(c0, load64(p));
+			c1 = _mm_crc32_u64(c1, load64(p + CRC32C_LONG));
+			c2 = _mm_crc32_u64(c2, load64(p + 2 * CRC32C_LONG));
+			p += 8;
+		} while (p < end);
+		c0 = crc32cShift(c0, gCrc32cLong2) ^ crc32cShift(c1, gCrc32cLong1) ^ c2;
+		p += 2 * CRC32C_LONG;
+		n -= 3 * CRC32C_LONG;
+	}
+	while (n >= 3 * CRC32C_SHORT) {
+		uint64 c1 = 0, c2 = 0;
+		const byte *end = p + CRC32C_SHORT;
+		do {
+			c0 = _mm_crc32_u64(c0, load64(p));
+			c1 = _mm_crc32_u64(c1, load64(p + CRC32C_SHORT));
+			c2 = _mm_crc32_u64(c2, load64(p + 2 * CRC32C_SHORT));
+			p += 8;
+		} while (p < end);
+		c0 = crc32cShift(c0, gCrc32cShort2) ^ crc32cShift(c1, gCrc32cShort1) ^ c2;
+		p += 2 * CRC32C_SHORT;
+		n -= 3 * CRC32C_SHORT;
+	}
+	return crc32cSse42(c0, p, n);
+}
+
+#endif /* HAVE_CRC32C_SSE42 */
+
+static crc32c_func crc32cInit()
+{
+	for (uint32 n = 0; n < 256; n++) {
+		uint32 c = n;
+		for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		gCrc32cTable[0][n] = c;
+	}
+	for (uint32 n = 0; n < 256; n++) {
+		uint32 c = gCrc32cTable[0][n];
+		for (int k = 1; k < 8; k++) {
+			c = gCrc32cTable[0][c & 0xff] ^ (c >> 8);
+			gCrc32cTable[k][n] = c;
+		}
+	}
+	gCrc32cPow2[0] = 0x40000000;
+	for (int k = 1; k < 64; k++) {
+		gCrc32cPow2[k] = multModP(gCrc32cPow2[k-1], gCrc32cPow2[k-1]);
+	}
+#ifdef HAVE_CRC32C_SSE42
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		if (!__builtin_cpu_supports("pclmul")) return crc32cSse42;
+		gCrc32cLong1 = xPowModP(8 * CRC32C_LONG - 33);
+		gCrc32cLong2 = xPowModP(2 * 8 * CRC32C_LONG - 33);
+		gCrc32cShort1 = xPowModP(8 * CRC32C_SHORT - 33);
+		gCrc32cShort2 = xPowModP(2 * 8 * CRC32C_SHORT - 33);
+		return crc32cPclmul;
+	}
+#endif
+	return crc32cTable;
+}
+
+static crc32c_func crc32cImpl()
+{
+	static crc32c_func f = crc32cInit();
+	return f;
+}
+
+uint32 crc32c(uint32 crc, const void *buf, size_t size)
+{
+	return ~crc32cImpl()(~crc, (const byte *)buf, size);
+}
+
+uint32 crc32cZeros(uint32 crc, uint64 size)
+{
+	// the tables must be set up
+	crc32cImpl();
+	return ~multModP(xPowModP(size * 8), ~crc);
+}
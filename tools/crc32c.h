@@ -0,0 +1,46 @@
+/*
+ *	PearBox
+ *	crc32c.h
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <cstddef>
+
+#include "types.h"
+
+/*
+ *	CRC32C (Castagnoli polynomial, as used by iSCSI, ext4 and btrfs)
+ *
+ *	uint32 crc = crc32c(0, buf1, size1);
+ *	crc = crc32c(crc, buf2, size2);
+ *
+ *	On x86-64 CPUs with SSE4.2 the crc32 instruction is used, with
+ *	PCLMUL three interleaved streams are combined. Otherwise a
+ *	slicing-by-8 table is used. The choice is made at runtime.
+ */
+
+/**
+ *	@returns CRC32C of |size| bytes at |buf|, continuing |crc| (0 to start)
+ */
+uint32	crc32c(uint32 crc, const void *buf, size_t size);
+/**
+ *	Like <i>crc32c()</i> for |size| 0-bytes, but in O(log |size|).
+ */
+uint32	crc32cZeros(uint32 crc, uint64 size);
+
+#endif /* __CRC32C_H__ */
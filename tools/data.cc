@@ -22,6 +22,9 @@
 #include <new>
 #include <cstring>
 #include <cstdlib>
+#include <exception>
+#include <system_error>
+#include <thread>
 #include <typeinfo>
 
 #include "data.h"
@@ -35,6 +38,7 @@
 #include "debug.h"
 #include "snprintf.h"
 #include "stream.h"
+#include "strtools.h"
 
 int autoCompare(const Object *a, const Object *b)
 {
@@ -64,6 +68,15 @@ int Object::compareTo(const Object *obj) const
 #endif
 }
 
+uint64 Object::hash() const
+{
+#ifdef HAVE_HT_OBJECTS
+	throw NotImplementedException(HERE);
+#else
+	return 0;
+#endif
+}
+
 int Object::toString(char *buf, int buflen) const
 {
 #ifdef HAVE_HT_OBJECTS
@@ -860,6 +873,37 @@ ObjectID Queue::getObjectID() const
 }
 #endif
 
+/*
+ *	BinTreeIterator
+ */
+BinTreeIterator::BinTreeIterator(const BinTreeIterator &i)
+{
+	mStack = mStackBuf;
+	mDepth = 0;
+	mSize = BINTREE_ITERATOR_STACK;
+	*this = i;
+}
+
+BinTreeIterator &BinTreeIterator::operator =(const BinTreeIterator &i)
+{
+	if (this == &i) return *this;
+	while (mSize < i.mDepth) grow();
+	memcpy(mStack, i.mStack, i.mDepth * sizeof *mStack);
+	mDepth = i.mDepth;
+	return *this;
+}
+
+void BinTreeIterator::grow()
+{
+	uint n = mSize * 2;
+	BinTreeNode **s = (BinTreeNode**)malloc(n * sizeof *s);
+	if (!s) throw std::bad_alloc();
+	memcpy(s, mStack, mDepth * sizeof *s);
+	if (mStack != mStackBuf) free(mStack);
+	mStack = s;
+	mSize = n;
+}
+
 /*
  *	BinaryTree
  */
@@ -1044,6 +1088,39 @@ BinTreeNode **BinaryTree::getRightmostPtr(BinTreeNode **p) const
 	return p;
 }
 
+/*
+ *	Link the <i>n</i> (sorted) nodes <i>nodes</i> into a perfectly
+ *	balanced tree, returns its root and height.
+ */
+BinTreeNode *BinaryTree::buildTreeR(BinTreeNode **nodes, uint n, int &height) const
+{
+	if (!n) {
+		height = 0;
+		return NULL;
+	}
+	uint m = n/2;
+	int hl, hr;
+	BinTreeNode *node = nodes[m];
+	node->left = buildTreeR(nodes, m, hl);
+	node->right = buildTreeR(nodes+m+1, n-m-1, hr);
+	node->unbalance = hr - hl;
+	height = MAX(hl, hr) + 1;
+	return node;
+}
+
+/*
+ *	Store all nodes of subtree <i>node</i> in order to <i>nodes</i>
+ *	and advance <i>nodes</i> accordingly.
+ */
+void BinaryTree::getNodesR(BinTreeNode *node, BinTreeNode **&nodes) const
+{
+	while (node) {
+		getNodesR(node->left, nodes);
+		*nodes++ = node;
+		node = node->right;
+	}
+}
+
 void BinaryTree::cloneR(BinTreeNode *node)
 {
 	if (!node) return;
@@ -1250,24 +1327,108 @@ AVLTree::AVLTree(bool aOwnObjects, Comparator aComparator)
 
 }
 
-void AVLTree::cloneR(BinTreeNode *node)
+AVLTree::AVLTree(bool aOwnObjects, const Array &aSorted, Comparator aComparator)
+ : BinaryTree(aOwnObjects, aComparator)
 {
-	if (!node) return;
-	Object *o = own_objects ? node->key->clone() : node->key;
-	// SB: nicht gut: (unnoetige compares)
-	insert(o);
-
-	cloneR(node->left);
-	cloneR(node->right);
+	loadSorted(aSorted);
 }
 
 AVLTree *AVLTree::clone() const
 {
 	AVLTree *c = new AVLTree(own_objects, compare);
-	c->cloneR(root);
+	BinTreeNode **nodes = new BinTreeNode*[ecount];
+	BinTreeNode **p = nodes;
+	getNodesR(root, p);
+	Object **objs = new Object*[ecount];
+	for (uint i = 0; i < ecount; i++) {
+		objs[i] = own_objects ? nodes[i]->key->clone() : nodes[i]->key;
+	}
+	c->loadSortedR(objs, ecount, false);
+	delete[] objs;
+	delete[] nodes;
 	return c;
 }
 
+/*
+ *	if |dropped| isn't NULL, the duplicates skipped are appended to it
+ */
+void AVLTree::loadSortedR(Object * const *objs, uint count, bool unique, Array *dropped)
+{
+	BinTreeNode **nodes = new BinTreeNode*[count];
+	uint k = 0;
+	try {
+		for (uint i = 0; i < count; i++) {
+			if (i) {
+				int c = compareObjects(objs[i-1], objs[i]);
+				if (c > 0 || (c == 0 && !unique)) {
+					throw IllegalArgumentException(HERE);
+				}
+				if (c == 0) continue;
+			}
+			BinTreeNode *n = allocNode();
+			n->key = objs[i];
+			nodes[k++] = n;
+		}
+		if (dropped && k < count) {
+			/* not the very same object as the one inserted */
+			uint j = 0;
+			for (uint i = 0; i < count; i++) {
+				if (j < k && objs[i] == nodes[j]->key) {
+					j++;
+				} else if (objs[i] != nodes[j-1]->key) {
+					dropped->insert(objs[i]);
+				}
+			}
+		}
+	} catch (...) {
+		while (k) deleteNode(nodes[--k]);
+		delete[] nodes;
+		throw;
+	}
+
+	delAll();
+	for (uint i = 0; i < k; i++) notifyInsertOrSet(nodes[i]->key);
+	int height;
+	root = buildTreeR(nodes, k, height);
+	ecount = k;
+	delete[] nodes;
+}
+
+void AVLTree::loadSortedR(const Array &sorted, bool unique, Array *dropped)
+{
+	uint count = sorted.count();
+	Object **objs = new Object*[count];
+	Object **p = objs;
+	for (Object *o : sorted) *p++ = o;
+	try {
+		loadSortedR(objs, count, unique, dropped);
+	} catch (...) {
+		delete[] objs;
+		throw;
+	}
+	delete[] objs;
+}
+
+void AVLTree::loadSorted(Object * const *objs, uint count)
+{
+	loadSortedR(objs, count, false);
+}
+
+void AVLTree::loadSorted(const Array &sorted)
+{
+	loadSortedR(sorted, false);
+}
+
+void AVLTree::loadSortedUnique(Object * const *objs, uint count, Array *dropped)
+{
+	loadSortedR(objs, count, true, dropped);
+}
+
+void AVLTree::loadSortedUnique(const Array &sorted, Array *dropped)
+{
+	loadSortedR(sorted, true, dropped);
+}
+
 
 ObjectID AVLTree::getObjectID() const
 {
@@ -1538,16 +1699,100 @@ ObjectID Set::getObjectID() const
 
 void Set::intersectWith(Set *b)
 {
-	foreach(Object, elem, *this,
-		if (!b->contains(elem)) delObj(elem);
-	);
+	if (!ecount) return;
+	uint na = ecount, nb = b->ecount;
+	BinTreeNode **a = new BinTreeNode*[na];
+	BinTreeNode **drop = new BinTreeNode*[na];
+	BinTreeNode **bn = new BinTreeNode*[nb];
+	BinTreeNode **p = a;
+	getNodesR(root, p);
+	p = bn;
+	b->getNodesR(b->root, p);
+
+	/* merge, the tree itself stays untouched until everything is compared */
+	uint i = 0, j = 0, k = 0, d = 0;
+	try {
+		while (i < na && j < nb) {
+			int c = compareObjects(a[i]->key, bn[j]->key);
+			if (c < 0) {
+				drop[d++] = a[i++];
+			} else if (c > 0) {
+				j++;
+			} else {
+				a[k++] = a[i++];
+				j++;
+			}
+		}
+	} catch (...) {
+		delete[] a;
+		delete[] drop;
+		delete[] bn;
+		throw;
+	}
+	while (i < na) drop[d++] = a[i++];
+
+	for (i = 0; i < d; i++) {
+		freeObj(drop[i]->key);
+		deleteNode(drop[i]);
+	}
+	int height;
+	root = buildTreeR(a, k, height);
+	ecount = k;
+	delete[] a;
+	delete[] drop;
+	delete[] bn;
 }
 
 void Set::unionWith(Set *b)
 {
-	foreach(Object, elem, *b,
-		if (!contains(elem)) insert(own_objects ? elem->clone() : elem);
-	);
+	if (!b->ecount) return;
+	uint na = ecount, nb = b->ecount;
+	BinTreeNode **a = new BinTreeNode*[na];
+	BinTreeNode **bn = new BinTreeNode*[nb];
+	BinTreeNode **r = new BinTreeNode*[na+nb];
+	BinTreeNode **added = new BinTreeNode*[nb];
+	BinTreeNode **p = a;
+	getNodesR(root, p);
+	p = bn;
+	b->getNodesR(b->root, p);
+
+	uint i = 0, j = 0, k = 0, n = 0;
+	try {
+		while (i < na || j < nb) {
+			int c = (i == na) ? 1 : (j == nb) ? -1 : compareObjects(a[i]->key, bn[j]->key);
+			if (c <= 0) {
+				r[k++] = a[i++];
+				if (!c) j++;
+			} else {
+				BinTreeNode *node = allocNode();
+				node->key = NULL;
+				added[n++] = node;
+				node->key = own_objects ? bn[j]->key->clone() : bn[j]->key;
+				r[k++] = node;
+				j++;
+			}
+		}
+	} catch (...) {
+		/* tree is still intact, just throw away what we've added */
+		for (i = 0; i < n; i++) {
+			freeObj(added[i]->key);
+			deleteNode(added[i]);
+		}
+		delete[] a;
+		delete[] bn;
+		delete[] r;
+		delete[] added;
+		throw;
+	}
+
+	for (i = 0; i < n; i++) notifyInsertOrSet(added[i]->key);
+	int height;
+	root = buildTreeR(r, k, height);
+	ecount = k;
+	delete[] a;
+	delete[] bn;
+	delete[] r;
+	delete[] added;
 }
 
 /*
@@ -1578,6 +1823,11 @@ int KeyValue::compareTo(const Object *obj) const
 	return mKey->compareTo(((KeyValue*)obj)->mKey);
 }
 
+uint64 KeyValue::hash() const
+{
+	return mKey->hash();
+}
+
 int KeyValue::toString(char *buf, int buflen) const
 {
 	return ht_snprintf(buf, buflen, "[Key: %y; Value: %y]", mKey, mValue);
@@ -1616,6 +1866,11 @@ int SInt::compareTo(const Object *obj) const
 	return value - s->value;
 }
 
+uint64 SInt::hash() const
+{
+	return ht_hash64(&value, sizeof value);
+}
+
 int SInt::toString(char *buf, int buflen) const
 {
 	return ht_snprintf(buf, buflen, "%d", value);
@@ -1662,6 +1917,11 @@ int SInt64::compareTo(const Object *obj) const
 	}
 }
 
+uint64 SInt64::hash() const
+{
+	return ht_hash64(&value, sizeof value);
+}
+
 int SInt64::toString(char *buf, int buflen) const
 {
 	return ht_snprintf(buf, buflen, "%qd", value);
@@ -1707,6 +1967,11 @@ int UInt::compareTo(const Object *obj) const
 	}
 }
 
+uint64 UInt::hash() const
+{
+	return ht_hash64(&value, sizeof value);
+}
+
 int UInt::toString(char *buf, int buflen) const
 {
 	return ht_snprintf(buf, buflen, "%u", value);
@@ -1752,6 +2017,11 @@ int UInt64::compareTo(const Object *obj) const
 	}
 }
 
+uint64 UInt64::hash() const
+{
+	return ht_hash64(&value, sizeof value);
+}
+
 int UInt64::toString(char *buf, int buflen) const
 {
 	return ht_snprintf(buf, buflen, "%qu", value);
@@ -1798,6 +2068,13 @@ int Float::compareTo(const Object *obj) const
 	}
 }
 
+uint64 Float::hash() const
+{
+	// 0.0 == -0.0
+	double d = value ? value : 0.0;
+	return ht_hash64(&d, sizeof d);
+}
+
 int Float::toString(char *buf, int buflen) const
 {
 	return ht_snprintf(buf, buflen, "%f", value);
@@ -1861,6 +2138,11 @@ int MemArea::compareTo(const Object *obj) const
 	return memcmp(a->ptr, b->ptr, a->size);
 }
 
+uint64 MemArea::hash() const
+{
+	return ht_hash64(ptr, size);
+}
+
 int MemArea::toString(char *buf, int buflen) const
 {
 	throw NotImplementedException(HERE);
@@ -1902,8 +2184,209 @@ static void quickSortR(List &list, int l, int r)
 	if (l<R) quickSortR(list, l, R);
 }
 
+/*
+ *	Array sorter: introsort (quicksort with median-of-three pivot, falling
+ *	back to heapsort when recursing too deep) on the element buffer.
+ *	Partitions smaller than ARRAY_SORT_INSERTION_THRESHOLD are finished by
+ *	insertion sort. Arrays with at least ARRAY_SORT_PARALLEL_THRESHOLD
+ *	elements are split among up to ARRAY_SORT_MAX_THREADS threads and merged.
+ */
+#define ARRAY_SORT_INSERTION_THRESHOLD	16
+#define ARRAY_SORT_PARALLEL_THRESHOLD	(16*1024)
+#define ARRAY_SORT_MAX_THREADS		8
+
+struct ArrayCompareLess {
+	const Array &a;
+
+	ArrayCompareLess(const Array &aArray) : a(aArray) {}
+	bool operator ()(const Object *x, const Object *y) const
+	{
+		return a.compareObjects(x, y) < 0;
+	}
+};
+
+struct ComparatorLess {
+	Comparator compare;
+
+	ComparatorLess(Comparator aCompare) : compare(aCompare) {}
+	bool operator ()(const Object *x, const Object *y) const
+	{
+		return compare(x, y) < 0;
+	}
+};
+
+template <class Less>
+static void insertionSort(Object **a, size_t n, Less less)
+{
+	for (size_t i = 1; i < n; i++) {
+		Object *x = a[i];
+		size_t j = i;
+		while (j && less(x, a[j-1])) {
+			a[j] = a[j-1];
+			j--;
+		}
+		a[j] = x;
+	}
+}
+
+template <class Less>
+static void siftDown(Object **a, size_t i, size_t n, Less less)
+{
+	Object *x = a[i];
+	while (2*i+1 < n) {
+		size_t c = 2*i+1;
+		if (c+1 < n && less(a[c], a[c+1])) c++;
+		if (!less(x, a[c])) break;
+		a[i] = a[c];
+		i = c;
+	}
+	a[i] = x;
+}
+
+template <class Less>
+static void heapSort(Object **a, size_t n, Less less)
+{
+	for (size_t i = n/2; i--; ) siftDown(a, i, n, less);
+	while (n > 1) {
+		n--;
+		Object *t = a[0]; a[0] = a[n]; a[n] = t;
+		siftDown(a, 0, n, less);
+	}
+}
+
+template <class Less>
+static void introSortR(Object **a, size_t n, int depth, Less less)
+{
+	while (n > ARRAY_SORT_INSERTION_THRESHOLD) {
+		if (!depth--) {
+			heapSort(a, n, less);
+			return;
+		}
+		/* median of three */
+		size_t m = (n-1)/2;
+		Object *t;
+		if (less(a[m], a[0])) { t = a[m]; a[m] = a[0]; a[0] = t; }
+		if (less(a[n-1], a[m])) {
+			t = a[n-1]; a[n-1] = a[m]; a[m] = t;
+			if (less(a[m], a[0])) { t = a[m]; a[m] = a[0]; a[0] = t; }
+		}
+		Object *pivot = a[m];
+		/* Hoare partition, a[0] and a[n-1] act as sentinels */
+		ptrdiff_t i = 0, j = n-1;
+		while (true) {
+			while (less(a[i], pivot)) i++;
+			while (less(pivot, a[j])) j--;
+			if (i >= j) break;
+			t = a[i]; a[i] = a[j]; a[j] = t;
+			i++;
+			j--;
+		}
+		/* recurse into the smaller part, iterate on the larger */
+		size_t nl = j+1;
+		if (nl < n-nl) {
+			introSortR(a, nl, depth, less);
+			a += nl;
+			n -= nl;
+		} else {
+			introSortR(a+nl, n-nl, depth, less);
+			n = nl;
+		}
+	}
+	insertionSort(a, n, less);
+}
+
+template <class Less>
+static void introSort(Object **a, size_t n, Less less)
+{
+	int depth = 0;
+	for (size_t k = n; k > 1; k >>= 1) depth += 2;
+	introSortR(a, n, depth, less);
+}
+
+template <class Less>
+static void mergeRuns(Object **a, size_t nl, size_t n, Object **tmp, Less less)
+{
+	size_t i = 0, j = nl, k = 0;
+	while (i < nl && j < n) {
+		tmp[k++] = less(a[j], a[i]) ? a[j++] : a[i++];
+	}
+	while (i < nl) tmp[k++] = a[i++];
+	while (j < n) tmp[k++] = a[j++];
+	memcpy(a, tmp, n * sizeof *a);
+}
+
+template <class Less>
+static void parallelMergeSortR(Object **a, size_t n, Object **tmp, uint threads, Less less)
+{
+	if (threads < 2 || n < ARRAY_SORT_PARALLEL_THRESHOLD / 2) {
+		introSort(a, n, less);
+		return;
+	}
+	size_t nl = n/2;
+	std::exception_ptr error;
+	std::thread worker;
+	try {
+		worker = std::thread([&]() {
+			try {
+				parallelMergeSortR(a, nl, tmp, threads/2, less);
+			} catch (...) {
+				error = std::current_exception();
+			}
+		});
+	} catch (const std::system_error &) {
+		/* no more threads, sort this half ourselves */
+		parallelMergeSortR(a, nl, tmp, 1, less);
+	}
+	try {
+		parallelMergeSortR(a+nl, n-nl, tmp+nl, threads - threads/2, less);
+	} catch (...) {
+		if (worker.joinable()) worker.join();
+		throw;
+	}
+	if (worker.joinable()) worker.join();
+	if (error) std::rethrow_exception(error);
+	mergeRuns(a, nl, n, tmp, less);
+}
+
+template <class Less>
+static void sortElems(Object **a, size_t n, Less less)
+{
+	uint threads = std::thread::hardware_concurrency();
+	if (threads > ARRAY_SORT_MAX_THREADS) threads = ARRAY_SORT_MAX_THREADS;
+	if (n >= ARRAY_SORT_PARALLEL_THRESHOLD && threads > 1) {
+		Object **tmp = (Object**)malloc(n * sizeof *tmp);
+		if (tmp) {
+			try {
+				parallelMergeSortR(a, n, tmp, threads, less);
+			} catch (...) {
+				free(tmp);
+				throw;
+			}
+			free(tmp);
+			return;
+		}
+	}
+	introSort(a, n, less);
+}
+
+void Array::sort()
+{
+	sortElems(elems, ecount, ArrayCompareLess(*this));
+}
+
+void Array::sort(Comparator comparator)
+{
+	sortElems(elems, ecount, ComparatorLess(comparator));
+}
+
 bool quickSort(List &l)
 {
+#ifdef HAVE_HT_OBJECTS
+	if (l.instanceOf(OBJID_ARRAY)) {
+		((Array&)l).sort();
+		return true;
+	}
+#endif
 	int c = l.count();
 	if (c) quickSortR(l, 0, c-1);
 	return true;
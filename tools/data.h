@@ -96,6 +96,7 @@ inline PPCMallocRes ppc_malloc(size_t size)
 
 #define OBJID_STRING			MAGIC32("DAT\x50")
 #define OBJID_ISTRING			MAGIC32("DAT\x51")
+#define OBJID_INTERNED_STRING		MAGIC32("DAT\x52")
 
 #define OBJID_AUTO_COMPARE		MAGIC32("DAT\xc0")
 
@@ -123,6 +124,13 @@ public:
  *	@returns 0 for equality, negative number if |this<obj| and positive number if |this>obj|
  */
 	virtual	int		compareTo(const Object *obj) const;
+/**
+ *	Standard Object hash function.
+ *	Objects that are equal according to <i>compareTo()</i> must have
+ *	equal hashes.
+ *	@returns 64-bit hash of object
+ */
+	virtual	uint64		hash() const;
 /**
  *	Stringify object.
  *	Stringify object in string-buffer <i>s</i>. Never writes more than
@@ -166,6 +174,8 @@ typedef void* ObjHandle;
 #define InvObjHandle		NULL
 #define InvIdx			((uint)-1)
 
+class EnumeratorIterator;
+
 /**
  *	An Enumerator.
  */
@@ -311,12 +321,52 @@ public:
  *	is invalid.
  */
 		Object *	operator [] (int idx) const;
+/**
+ *	Iterate over all elements (range-for).
+ *	Containers hide these with iterators of their own concrete
+ *	type, this generic one uses <i>findFirst()</i>/<i>findNext()</i>.
+ */
+	inline	EnumeratorIterator begin() const;
+	inline	EnumeratorIterator end() const;
 };
 
+/**
+ *	Generic iterator, works on every Enumerator.
+ */
+class EnumeratorIterator {
+	const Enumerator *e;
+	ObjHandle h;
+public:
+	EnumeratorIterator(const Enumerator *aEnum, ObjHandle aHandle)
+		: e(aEnum), h(aHandle)
+	{
+	}
+	Object *operator *() const { return e->get(h); }
+	EnumeratorIterator &operator ++() { h = e->findNext(h); return *this; }
+	bool operator ==(const EnumeratorIterator &i) const { return h == i.h; }
+	bool operator !=(const EnumeratorIterator &i) const { return h != i.h; }
+	ObjHandle handle() const { return h; }
+};
+
+inline EnumeratorIterator Enumerator::begin() const
+{
+	return EnumeratorIterator(this, findFirst());
+}
+
+inline EnumeratorIterator Enumerator::end() const
+{
+	return EnumeratorIterator(this, InvObjHandle);
+}
+
+/*
+ *	Iterate over all elements of <i>E</i> (using <i>E</i>'s iterator type).
+ *	The iterator is advanced before <i>code</i> runs, but <i>code</i>
+ *	must not modify <i>E</i>.
+ */
 #define foreach(XTYPE, X, E, code...)\
-for (ObjHandle temp0815 = (E).findFirst(); temp0815 != InvObjHandle;) {\
-	XTYPE *X = (XTYPE*)(E).get(temp0815);                          \
-	temp0815 = (E).findNext(temp0815);                             \
+for (auto temp0815 = (E).begin(), temp0816 = (E).end(); temp0815 != temp0816;) {\
+	XTYPE *X = (XTYPE*)*temp0815;                                  \
+	++temp0815;                                                    \
 	{code;}                                                        \
 }
 
@@ -521,6 +571,20 @@ public:
 
 #define ARRAY_CONSTR_ALLOC_DEFAULT		4
 
+/**
+ *   Array's iterator (a pointer into the element buffer)
+ */
+class ArrayIterator {
+	Object * const *p;
+public:
+	explicit ArrayIterator(Object * const *aPtr) : p(aPtr) {}
+	Object *operator *() const { return *p; }
+	ArrayIterator &operator ++() { p++; return *this; }
+	bool operator ==(const ArrayIterator &i) const { return p == i.p; }
+	bool operator !=(const ArrayIterator &i) const { return p != i.p; }
+	ObjHandle handle() const { return (ObjHandle)p; }
+};
+
 /**
  *   An array
  */
@@ -574,6 +638,22 @@ public:
 	{
 		return get(findByIdx(aIndex));
 	}	
+	inline	ArrayIterator	begin() const { return ArrayIterator(elems); }
+	inline	ArrayIterator	end() const { return ArrayIterator(elems+ecount); }
+/**
+ *	Sort elements.
+ *	Sort elements in place according to <i>compareObjects()</i>.
+ *	Works directly on the element buffer (introsort), large arrays
+ *	are sorted by a parallel merge sort.
+ */
+		void		sort();
+/**
+ *	Sort elements.
+ *	Like <i>sort()</i>, but order elements according to <i>comparator</i>.
+ *
+ *	@param comparator comparator to use
+ */
+		void		sort(Comparator comparator);
 };
 
 /**
@@ -599,6 +679,20 @@ struct LinkedListNode {
 	LinkedListNode *next;
 };
 
+/**
+ *   LinkedList's iterator
+ */
+class LinkedListIterator {
+	LinkedListNode *n;
+public:
+	explicit LinkedListIterator(LinkedListNode *aNode) : n(aNode) {}
+	Object *operator *() const { return n->obj; }
+	LinkedListIterator &operator ++() { n = n->next; return *this; }
+	bool operator ==(const LinkedListIterator &i) const { return n == i.n; }
+	bool operator !=(const LinkedListIterator &i) const { return n != i.n; }
+	ObjHandle handle() const { return (ObjHandle)n; }
+};
+
 /**
  *   A (simply) linked list
  */
@@ -644,6 +738,9 @@ public:
 	virtual	bool		moveTo(ObjHandle from, ObjHandle to);
 	virtual	bool		set(ObjHandle h, Object *obj);
 	virtual	bool		swap(ObjHandle h, ObjHandle i);
+/* new */
+	inline	LinkedListIterator begin() const { return LinkedListIterator(first); }
+	inline	LinkedListIterator end() const { return LinkedListIterator(NULL); }
 };
 
 /*
@@ -697,6 +794,59 @@ struct BinTreeNode {
 	int unbalance;
 };
 
+/*
+ *	enough for AVL trees of any size, deeper (unbalanced) trees
+ *	make the iterator allocate its stack
+ */
+#define BINTREE_ITERATOR_STACK		48
+
+/**
+ *   BinaryTree's (in-order) iterator.
+ *   Keeps the path to the current node on an explicit stack.
+ */
+class BinTreeIterator {
+	BinTreeNode *mStackBuf[BINTREE_ITERATOR_STACK];
+	BinTreeNode **mStack;
+	uint mDepth;
+	uint mSize;
+
+		void		grow();
+	inline	void		pushLeft(BinTreeNode *n)
+	{
+		while (n) {
+			if (mDepth == mSize) grow();
+			mStack[mDepth++] = n;
+			n = n->left;
+		}
+	}
+	inline	BinTreeNode *	current() const
+	{
+		return mDepth ? mStack[mDepth-1] : NULL;
+	}
+public:
+	explicit BinTreeIterator(BinTreeNode *root)
+		: mStack(mStackBuf), mDepth(0), mSize(BINTREE_ITERATOR_STACK)
+	{
+		pushLeft(root);
+	}
+	BinTreeIterator(const BinTreeIterator &i);
+	~BinTreeIterator()
+	{
+		if (mStack != mStackBuf) free(mStack);
+	}
+	BinTreeIterator &operator =(const BinTreeIterator &i);
+	Object *operator *() const { return mStack[mDepth-1]->key; }
+	BinTreeIterator &operator ++()
+	{
+		BinTreeNode *n = mStack[--mDepth];
+		pushLeft(n->right);
+		return *this;
+	}
+	bool operator ==(const BinTreeIterator &i) const { return current() == i.current(); }
+	bool operator !=(const BinTreeIterator &i) const { return current() != i.current(); }
+	ObjHandle handle() const { return (ObjHandle)current(); }
+};
+
 /**
  *   A simple binary tree
  */
@@ -708,6 +858,7 @@ protected:
 	Comparator compare;
 
 		BinTreeNode *	allocNode() const;
+		BinTreeNode *	buildTreeR(BinTreeNode **nodes, uint n, int &height) const;
 		void		cloneR(BinTreeNode *node);
 	virtual	void		deleteNode(BinTreeNode *node) const;
 		BinTreeNode *	findNode(BinTreeNode *node, const Object *obj) const;
@@ -722,6 +873,7 @@ protected:
 		BinTreeNode *	getRightmost(BinTreeNode *node) const;
 		BinTreeNode **	getLeftmostPtr(BinTreeNode **nodeptr) const;
 		BinTreeNode **	getRightmostPtr(BinTreeNode **nodeptr) const;
+		void		getNodesR(BinTreeNode *node, BinTreeNode **&nodes) const;
 		ObjHandle	findByIdxR(BinTreeNode *n, int &i) const;
 		ObjHandle	insertR(BinTreeNode *&node, Object *obj);
 	virtual	void		setNodeIdentity(BinTreeNode *node, BinTreeNode *newident);
@@ -754,6 +906,9 @@ public:
 	virtual	bool		del(ObjHandle h);
 	virtual	ObjHandle	insert(Object *obj);
 	virtual	Object *	remove(ObjHandle h);
+	/* new */
+	inline	BinTreeIterator	begin() const { return BinTreeIterator(root); }
+	inline	BinTreeIterator	end() const { return BinTreeIterator(NULL); }
 };
 
 
@@ -762,12 +917,59 @@ public:
  */
 class AVLTree: public BinaryTree {
 private:
-		void		cloneR(BinTreeNode *node);
+		void		loadSortedR(Object * const *objs, uint count, bool unique, Array *dropped = NULL);
+		void		loadSortedR(const Array &sorted, bool unique, Array *dropped = NULL);
 		BinTreeNode *	removeR(Object *key, BinTreeNode *&root, int &change, int cmp);
 public:
 				AVLTree(bool own_objects, Comparator comparator = autoCompare);
+/**
+ *	Bulk-load constructor.
+ *	Builds the tree from <i>sorted</i>, see <i>loadSorted()</i>.
+ */
+				AVLTree(bool own_objects, const Array &sorted, Comparator comparator = autoCompare);
 
 		void		debugOut();
+/**
+ *	Bulk load.
+ *	Replace the contents of this tree (which are deleted) by the
+ *	<i>count</i> objects <i>objs</i>. The objects are inserted, not
+ *	cloned and must be strictly ascending according to
+ *	<i>compareObjects()</i>. Builds a perfectly balanced tree in O(n),
+ *	without any rotations.
+ *
+ *	@param objs objects to load
+ *	@param count number of objects
+ *	@throws IllegalArgumentException if <i>objs</i> is not strictly
+ *	ascending (the tree is left unchanged)
+ */
+		void		loadSorted(Object * const *objs, uint count);
+		void		loadSorted(const Array &sorted);
+	template <class Iter>
+		void		loadSorted(Iter first, Iter last)
+	{
+		Array a(false);
+		for (; first != last; ++first) a.insert(*first);
+		loadSorted(a);
+	}
+/**
+ *	Bulk load, dropping duplicates.
+ *	Like <i>loadSorted()</i>, but <i>objs</i> only has to be ascending.
+ *	Of a run of equal objects only the first is inserted. The others
+ *	are never freed (they stay the caller's), but appended to
+ *	<i>dropped</i> if given, e.g. an owning Array that frees them.
+ *	An object that is the very same as the one inserted is not dropped.
+ *
+ *	@param dropped receives the duplicates not inserted (may be NULL)
+ */
+		void		loadSortedUnique(Object * const *objs, uint count, Array *dropped = NULL);
+		void		loadSortedUnique(const Array &sorted, Array *dropped = NULL);
+	template <class Iter>
+		void		loadSortedUnique(Iter first, Iter last, Array *dropped = NULL)
+	{
+		Array a(false);
+		for (; first != last; ++first) a.insert(*first);
+		loadSortedUnique(a, dropped);
+	}
 		bool		expensiveCheck() const;
 	/* extends Object */
 	virtual	AVLTree *	clone() const;
@@ -784,7 +986,22 @@ class Set: public AVLTree {
 public:
 				Set(bool own_objects);
 /* new */
+/**
+ *	Intersect with set <i>b</i>.
+ *	Deletes all elements not contained in <i>b</i>. Both sets are
+ *	walked in order once and the tree is rebuilt in O(n).
+ *
+ *	@param b set to intersect with (must use the same order)
+ */
 			void	intersectWith(Set *b);
+/**
+ *	Unite with set <i>b</i>.
+ *	Inserts all elements of <i>b</i> not yet contained (clones them if
+ *	this set owns its objects). Both sets are walked in order once
+ *	and the tree is rebuilt in O(n).
+ *
+ *	@param b set to unite with (must use the same order)
+ */
 			void	unionWith(Set *b);
 	inline	bool	operator &(Object *obj) const
 	{
@@ -812,6 +1029,7 @@ public:
 
 	virtual	KeyValue *	clone() const;
 	virtual	int		compareTo(const Object *obj) const;
+	virtual	uint64		hash() const;
 	virtual	int		toString(char *buf, int buflen) const;
 #ifdef HAVE_HT_OBJECTS
 	virtual	bool		instanceOf(ObjectID id) const;
@@ -830,6 +1048,7 @@ public:
 /* extends Object */
 	virtual	SInt *		clone() const;
 	virtual	int		compareTo(const Object *obj) const;
+	virtual	uint64		hash() const;
 	virtual	int		toString(char *buf, int buflen) const;
 #ifdef HAVE_HT_OBJECTS
 	virtual	bool		instanceOf(ObjectID id) const;
@@ -850,6 +1069,7 @@ public:
 /* extends Object */
 	virtual	SInt64 *	clone() const;
 	virtual	int		compareTo(const Object *obj) const;
+	virtual	uint64		hash() const;
 	virtual	int		toString(char *buf, int buflen) const;
 #ifdef HAVE_HT_OBJECTS
 	virtual	bool		instanceOf(ObjectID id) const;
@@ -868,6 +1088,7 @@ public:
 /* extends Object */
 	virtual	UInt *		clone() const;
 	virtual	int		compareTo(const Object *obj) const;
+	virtual	uint64		hash() const;
 	virtual	int		toString(char *buf, int buflen) const;
 #ifdef HAVE_HT_OBJECTS
 	virtual	bool		instanceOf(ObjectID id) const;
@@ -886,6 +1107,7 @@ public:
 /* extends Object */
 	virtual	UInt64 *	clone() const;
 	virtual	int		compareTo(const Object *obj) const;
+	virtual	uint64		hash() const;
 	virtual	int		toString(char *buf, int buflen) const;
 #ifdef HAVE_HT_OBJECTS
 	virtual	bool		instanceOf(ObjectID id) const;
@@ -904,6 +1126,7 @@ public:
 /* extends Object */
 	virtual	Float *		clone() const;
 	virtual	int		compareTo(const Object *obj) const;
+	virtual	uint64		hash() const;
 	virtual	int		toString(char *buf, int buflen) const;
 #ifdef HAVE_HT_OBJECTS
 	virtual	bool		instanceOf(ObjectID id) const;
@@ -936,6 +1159,7 @@ public:
 /* extends Object */
 	virtual	MemArea *	clone() const;
 	virtual	int		compareTo(const Object *obj) const;
+	virtual	uint64		hash() const;
 	virtual	int		toString(char *buf, int buflen) const;
 #ifdef HAVE_HT_OBJECTS
 	virtual	bool		instanceOf(ObjectID id) const;
@@ -946,6 +1170,11 @@ public:
 /*
  *	sorter
  */
+
+/**
+ *	Sort list <i>l</i> according to <i>l.compareObjects()</i>.
+ *	Arrays are sorted by <i>Array::sort()</i>.
+ */
 bool quickSort(List &l);
 
 /*
@@ -0,0 +1,294 @@
+/*
+ *	PearBox
+ *	format.cc
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "format.h"
+#include "snprintf.h"
+#include "stream.h"
+
+/*
+ *	size of the intermediate buffer used for files and streams
+ */
+#define FORMAT_BUFFER_SIZE	1024
+
+static inline void outFlush(FormatOutput &out)
+{
+	if (out.flush) {
+		out.flush(out);
+		out.total += out.pos;
+		out.pos = 0;
+	}
+}
+
+static void outWrite(FormatOutput &out, const char *p, size_t n)
+{
+	while (n) {
+		if (out.pos == out.size) {
+			if (!out.flush) return;
+			outFlush(out);
+		}
+		size_t c = MIN(n, out.size - out.pos);
+		memcpy(out.buf + out.pos, p, c);
+		out.pos += c;
+		p += c;
+		n -= c;
+	}
+}
+
+static void outFill(FormatOutput &out, char ch, int n)
+{
+	while (n > 0) {
+		if (out.pos == out.size) {
+			if (!out.flush) return;
+			outFlush(out);
+		}
+		size_t c = MIN((size_t)n, out.size - out.pos);
+		memset(out.buf + out.pos, ch, c);
+		out.pos += c;
+		n -= c;
+	}
+}
+
+/*
+ *	like fmtqword() in snprintf.cc
+ */
+static void fmtInt(FormatOutput &out, uint64 uvalue, bool negative, int base, int min, int max, int flags)
+{
+	const char *digits = (flags & FMT_F_UP) ? "0123456789ABCDEF" : "0123456789abcdef";
+	char convert[64];
+	char *p = convert + sizeof convert;
+	do {
+		*--p = digits[uvalue % base];
+		uvalue /= base;
+	} while (uvalue);
+	int place = convert + sizeof convert - p;
+
+	char signvalue = 0;
+	if (negative) {
+		signvalue = '-';
+	} else if (flags & FMT_F_PLUS) {
+		signvalue = '+';
+	} else if (flags & FMT_F_SPACE) {
+		signvalue = ' ';
+	}
+
+	if (max < 0) max = 0;
+	int zpadlen = max - place;
+	int spadlen = min - MAX(max, place) - (signvalue ? 1 : 0);
+	if (zpadlen < 0) zpadlen = 0;
+	if (spadlen < 0) spadlen = 0;
+	if (flags & FMT_F_ZERO) {
+		zpadlen = MAX(zpadlen, spadlen);
+		spadlen = 0;
+	}
+
+	if (!(flags & FMT_F_MINUS)) outFill(out, ' ', spadlen);
+	if (signvalue) outWrite(out, &signvalue, 1);
+	outFill(out, '0', zpadlen);
+	outWrite(out, p, place);
+	if (flags & FMT_F_MINUS) outFill(out, ' ', spadlen);
+}
+
+/*
+ *	like fmtstr() in snprintf.cc, but for (possibly binary) text of
+ *	length |len|. 0-bytes are output as spaces (like String::toString()).
+ */
+static void fmtStr(FormatOutput &out, const char *s, int len, int min, int max, int flags)
+{
+	if (max >= 0 && len > max) len = max;
+	int padlen = min - len;
+	if (!(flags & FMT_F_MINUS)) outFill(out, ' ', padlen);
+	const char *e = s + len;
+	while (s < e) {
+		const char *z = (const char *)memchr(s, 0, e - s);
+		if (!z) z = e;
+		outWrite(out, s, z - s);
+		if (z < e) outWrite(out, " ", 1);
+		s = z + 1;
+	}
+	if (flags & FMT_F_MINUS) outFill(out, ' ', padlen);
+}
+
+static void fmtObject(FormatOutput &out, const Object *obj, int min, int max, int flags)
+{
+	char tmp[256];
+	char *buf = tmp;
+	int size = sizeof tmp;
+	int len;
+	while (true) {
+		len = obj->toString(buf, size);
+		if (len < size-1 || size >= 64*1024) break;
+		if (buf != tmp) free(buf);
+		size *= 2;
+		buf = (char *)malloc(size);
+		if (!buf) throw std::bad_alloc();
+	}
+	fmtStr(out, buf, len, min, max, flags);
+	if (buf != tmp) free(buf);
+}
+
+/*
+ *	floats are rare, let ht_snprintf() do the work
+ */
+static void fmtFloat(FormatOutput &out, double value, int min, int max, int flags)
+{
+	char spec[32];
+	char *p = spec;
+	*p++ = '%';
+	if (flags & FMT_F_MINUS) *p++ = '-';
+	if (flags & FMT_F_PLUS) *p++ = '+';
+	if (flags & FMT_F_SPACE) *p++ = ' ';
+	if (flags & FMT_F_ZERO) *p++ = '0';
+	strcpy(p, "*.*f");
+	char buf[400];
+	int len = ht_snprintf(buf, sizeof buf, spec, MIN(min, 64), MIN(max, 64), value);
+	outWrite(out, buf, len);
+}
+
+static uint64 maskInt(const FormatArg &a)
+{
+	return (a.size < 8) ? a.u & ((1ULL << (a.size*8)) - 1) : a.u;
+}
+
+void htFormat(FormatOutput &out, const char *fmt, const FormatDirective *d, const FormatArg *args)
+{
+	for (;; d++) {
+		outWrite(out, fmt + d->litStart, d->litLen);
+		if (!d->conv) break;
+		if (d->conv == '%') continue;
+		int flags = d->flags;
+		int min = d->min;
+		int max = d->max;
+		if (flags & FMT_F_MINARG) {
+			min = (args++)->s;
+			if (min < 0) {
+				flags |= FMT_F_MINUS;
+				min = -min;
+			}
+		}
+		if (flags & FMT_F_MAXARG) {
+			max = (args++)->s;
+			if (max < 0) max = -1;
+		}
+		const FormatArg &a = *args++;
+		switch (d->conv) {
+		case 'd':
+		case 'i':
+			if (a.type == FAT_SINT && a.s < 0) {
+				fmtInt(out, -a.u, true, 10, min, max, flags);
+			} else {
+				fmtInt(out, a.u, false, 10, min, max, flags);
+			}
+			break;
+		case 'u':
+			fmtInt(out, maskInt(a), false, 10, min, max, flags & ~(FMT_F_PLUS | FMT_F_SPACE));
+			break;
+		case 'x':
+		case 'X':
+			fmtInt(out, maskInt(a), false, 16, min, max, flags & ~(FMT_F_PLUS | FMT_F_SPACE));
+			break;
+		case 'o':
+			fmtInt(out, maskInt(a), false, 8, min, max, flags & ~(FMT_F_PLUS | FMT_F_SPACE));
+			break;
+		case 'b':
+			fmtInt(out, maskInt(a), false, 2, min, max, flags & ~(FMT_F_PLUS | FMT_F_SPACE));
+			break;
+		case 'p':
+			fmtInt(out, (uintptr_t)a.ptr, false, 16, min, max, flags & ~(FMT_F_PLUS | FMT_F_SPACE));
+			break;
+		case 'c': {
+			char c = a.u;
+			outWrite(out, &c, 1);
+			break;
+		}
+		case 'f':
+			fmtFloat(out, a.f, min, max, flags);
+			break;
+		case 's':
+		case 'y':
+			if (a.type == FAT_STRING) {
+				fmtStr(out, (const char *)a.str->content(), a.str->length(), min, max, flags);
+			} else if (a.type == FAT_OBJECT) {
+				fmtObject(out, a.obj, min, max, flags);
+			} else if (a.cstr) {
+				fmtStr(out, a.cstr, strlen(a.cstr), min, max, flags);
+			} else {
+				fmtStr(out, "(null)", 6, min, max, flags);
+			}
+			break;
+		}
+	}
+}
+
+int htFormatBuffer(char *str, size_t count, const char *fmt, const FormatDirective *d, const FormatArg *args)
+{
+	if (!count) return 0;
+	FormatOutput out;
+	out.buf = str;
+	out.pos = 0;
+	out.size = count-1;
+	out.total = 0;
+	out.flush = NULL;
+	out.context = NULL;
+	htFormat(out, fmt, d, args);
+	str[out.pos] = 0;
+	return out.pos;
+}
+
+static void flushFile(FormatOutput &out)
+{
+	fwrite(out.buf, 1, out.pos, (FILE *)out.context);
+}
+
+int htFormatFile(FILE *file, const char *fmt, const FormatDirective *d, const FormatArg *args)
+{
+	char buf[FORMAT_BUFFER_SIZE];
+	FormatOutput out;
+	out.buf = buf;
+	out.pos = 0;
+	out.size = sizeof buf;
+	out.total = 0;
+	out.flush = flushFile;
+	out.context = file;
+	htFormat(out, fmt, d, args);
+	outFlush(out);
+	return out.total;
+}
+
+static void flushStream(FormatOutput &out)
+{
+	((Stream *)out.context)->writex(out.buf, out.pos);
+}
+
+uint htFormatStream(Stream &stream, const char *fmt, const FormatDirective *d, const FormatArg *args)
+{
+	char buf[FORMAT_BUFFER_SIZE];
+	FormatOutput out;
+	out.buf = buf;
+	out.pos = 0;
+	out.size = sizeof buf;
+	out.total = 0;
+	out.flush = flushStream;
+	out.context = &stream;
+	htFormat(out, fmt, d, args);
+	outFlush(out);
+	return out.total;
+}
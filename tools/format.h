@@ -0,0 +1,444 @@
+/*
+ *	PearBox
+ *	format.h
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __FORMAT_H__
+#define __FORMAT_H__
+
+#include <cstddef>
+#include <cstdio>
+#include <type_traits>
+
+#include "data.h"
+#include "str.h"
+
+class Stream;
+
+/*
+ *	Type-safe formatting
+ *
+ *	ht_printf(HT_FMT("%d: %y\n"), i, name);
+ *
+ *	The format string is parsed and checked against the argument types
+ *	while compiling, a mismatch (or a wrong number of arguments) is a
+ *	build error. At run time the pre-parsed directives are used and the
+ *	arguments are written directly to the destination.
+ *
+ *	Conversions are those of ht_snprintf() with these differences:
+ *	- integers are formatted with the width of the argument, so the
+ *	  length modifiers (h, l, ll, L, q) are accepted but not needed
+ *	- %y takes an Object (like a String) by reference, not a pointer
+ *	- %s takes a C string or a String
+ *	- %e, %g and %n are not supported
+ */
+
+enum FormatArgType {
+	FAT_INVALID,
+	FAT_SINT,
+	FAT_UINT,
+	FAT_DOUBLE,
+	FAT_CSTR,
+	FAT_STRING,
+	FAT_OBJECT,
+	FAT_POINTER,
+};
+
+struct FormatArg {
+	FormatArgType type;
+	int size;		// of integers, in bytes
+	union {
+		sint64 s;
+		uint64 u;
+		double f;
+		const char *cstr;
+		const String *str;
+		const Object *obj;
+		const void *ptr;
+	};
+};
+
+#define FMT_F_MINUS	(1 << 0)
+#define FMT_F_PLUS	(1 << 1)
+#define FMT_F_SPACE	(1 << 2)
+#define FMT_F_NUM	(1 << 3)
+#define FMT_F_ZERO	(1 << 4)
+#define FMT_F_UP	(1 << 5)
+#define FMT_F_MINARG	(1 << 6)
+#define FMT_F_MAXARG	(1 << 7)
+
+/*
+ *	one conversion, preceded by |litLen| characters of literal text
+ *	starting at |litStart|. The last directive of a format has
+ *	|conv| == 0 and only holds the trailing text.
+ */
+struct FormatDirective {
+	int litStart;
+	int litLen;
+	char conv;
+	byte flags;
+	int min;
+	int max;
+
+	constexpr FormatDirective()
+		: litStart(0), litLen(0), conv(0), flags(0), min(0), max(-1)
+	{
+	}
+};
+
+enum FormatCheckResult {
+	FCR_OK,
+	FCR_BAD_CONVERSION,
+	FCR_TOO_FEW_ARGS,
+	FCR_TOO_MANY_ARGS,
+	FCR_TYPE_MISMATCH,
+};
+
+/*
+ *	compile-time part
+ */
+
+/*
+ *	parses the directive starting at |fmt|[|pos|] (literal text, then
+ *	one conversion) into |d|.
+ *	@returns position after the directive, -1 on malformed formats
+ */
+constexpr int htParseDirective(const char *fmt, int pos, FormatDirective &d)
+{
+	d = FormatDirective();
+	d.litStart = pos;
+	while (fmt[pos] && fmt[pos] != '%') pos++;
+	d.litLen = pos - d.litStart;
+	if (!fmt[pos]) return pos;
+	pos++;
+	if (fmt[pos] == '%') {
+		// literal text including the first '%', no argument
+		d.litLen++;
+		d.conv = '%';
+		return pos+1;
+	}
+	while (true) {
+		switch (fmt[pos]) {
+		case '-': d.flags |= FMT_F_MINUS; pos++; continue;
+		case '+': d.flags |= FMT_F_PLUS; pos++; continue;
+		case ' ': d.flags |= FMT_F_SPACE; pos++; continue;
+		case '#': d.flags |= FMT_F_NUM; pos++; continue;
+		case '0': d.flags |= FMT_F_ZERO; pos++; continue;
+		}
+		break;
+	}
+	if (fmt[pos] == '*') {
+		d.flags |= FMT_F_MINARG;
+		pos++;
+	} else {
+		while (fmt[pos] >= '0' && fmt[pos] <= '9') {
+			d.min = d.min*10 + fmt[pos++] - '0';
+		}
+	}
+	if (fmt[pos] == '.') {
+		pos++;
+		d.max = 0;
+		if (fmt[pos] == '*') {
+			d.flags |= FMT_F_MAXARG;
+			pos++;
+		} else {
+			while (fmt[pos] >= '0' && fmt[pos] <= '9') {
+				d.max = d.max*10 + fmt[pos++] - '0';
+			}
+		}
+	}
+	switch (fmt[pos]) {
+	case 'h':
+	case 'L':
+	case 'q':
+		pos++;
+		break;
+	case 'l':
+		pos++;
+		if (fmt[pos] == 'l') pos++;
+		break;
+	}
+	switch (fmt[pos]) {
+	case 'X':
+		d.flags |= FMT_F_UP;
+	case 'b': case 'c': case 'd': case 'i': case 'o': case 'u': case 'x':
+	case 'f': case 'p': case 's': case 'y':
+		d.conv = fmt[pos];
+		return pos+1;
+	}
+	return -1;
+}
+
+/*
+ *	@returns number of directives in |fmt| (including the final one
+ *	holding the trailing text)
+ */
+constexpr int htCountDirectives(const char *fmt)
+{
+	FormatDirective d;
+	int n = 0;
+	int pos = 0;
+	while (true) {
+		pos = htParseDirective(fmt, pos, d);
+		if (pos < 0) return 1;
+		n++;
+		if (!d.conv) return n;
+	}
+}
+
+constexpr bool htFormatArgIsInt(FormatArgType t)
+{
+	return t == FAT_SINT || t == FAT_UINT;
+}
+
+constexpr bool htFormatArgMatches(char conv, FormatArgType t)
+{
+	switch (conv) {
+	case 'b': case 'c': case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+		return htFormatArgIsInt(t);
+	case 'f':
+		return t == FAT_DOUBLE;
+	case 'p':
+		return t == FAT_POINTER || t == FAT_CSTR;
+	case 's':
+		return t == FAT_CSTR || t == FAT_STRING;
+	case 'y':
+		return t == FAT_STRING || t == FAT_OBJECT;
+	}
+	return false;
+}
+
+constexpr FormatCheckResult htCheckFormatTypes(const char *fmt, const FormatArgType *types, int count)
+{
+	FormatDirective d;
+	int pos = 0;
+	int a = 0;
+	while (true) {
+		pos = htParseDirective(fmt, pos, d);
+		if (pos < 0) return FCR_BAD_CONVERSION;
+		if (!d.conv) break;
+		if (d.conv == '%') continue;
+		if (d.flags & FMT_F_MINARG) {
+			if (a == count) return FCR_TOO_FEW_ARGS;
+			if (!htFormatArgIsInt(types[a++])) return FCR_TYPE_MISMATCH;
+		}
+		if (d.flags & FMT_F_MAXARG) {
+			if (a == count) return FCR_TOO_FEW_ARGS;
+			if (!htFormatArgIsInt(types[a++])) return FCR_TYPE_MISMATCH;
+		}
+		if (a == count) return FCR_TOO_FEW_ARGS;
+		if (!htFormatArgMatches(d.conv, types[a++])) return FCR_TYPE_MISMATCH;
+	}
+	return (a == count) ? FCR_OK : FCR_TOO_MANY_ARGS;
+}
+
+template <typename T>
+constexpr FormatArgType htFormatArgType()
+{
+	typedef typename std::decay<T>::type D;
+	return (std::is_same<D, char *>::value || std::is_same<D, const char *>::value) ? FAT_CSTR
+		: std::is_base_of<String, D>::value ? FAT_STRING
+		: std::is_base_of<Object, D>::value ? FAT_OBJECT
+		: std::is_floating_point<D>::value ? FAT_DOUBLE
+		: (std::is_integral<D>::value || std::is_enum<D>::value)
+			? (std::is_signed<D>::value || std::is_enum<D>::value ? FAT_SINT : FAT_UINT)
+		: std::is_pointer<D>::value ? FAT_POINTER
+		: FAT_INVALID;
+}
+
+template <typename... Args>
+constexpr FormatCheckResult htCheckFormat(const char *fmt)
+{
+	// trailing element keeps the array non-empty
+	FormatArgType types[] = {htFormatArgType<Args>()..., FAT_INVALID};
+	return htCheckFormatTypes(fmt, types, sizeof...(Args));
+}
+
+template <int N>
+struct FormatProgram {
+	FormatDirective d[N];
+
+	constexpr FormatProgram(const char *fmt)
+		: d()
+	{
+		int pos = 0;
+		for (int i=0; i<N && pos >= 0; i++) pos = htParseDirective(fmt, pos, d[i]);
+	}
+};
+
+/**
+ *	Marks a format string literal for the checked ht_printf() family.
+ *	Every use creates a distinct type, so each call site gets its own
+ *	(compile-time) parsed copy of the format.
+ */
+struct FormatLiteral {};
+
+#define HT_FMT(s) ([] {								\
+	struct Fmt: FormatLiteral {						\
+		static constexpr const char *str() { return s; }		\
+	};									\
+	return Fmt();								\
+}())
+
+/*
+ *	run-time part
+ */
+
+inline FormatArg htFormatArg(sint64 v, int size = 8)
+{
+	FormatArg a;
+	a.type = FAT_SINT;
+	a.size = size;
+	a.s = v;
+	return a;
+}
+
+template <typename T>
+inline typename std::enable_if<htFormatArgType<T>() == FAT_SINT, FormatArg>::type htMakeFormatArg(const T &v)
+{
+	return htFormatArg((sint64)v, sizeof v);
+}
+
+template <typename T>
+inline typename std::enable_if<htFormatArgType<T>() == FAT_UINT, FormatArg>::type htMakeFormatArg(const T &v)
+{
+	FormatArg a;
+	a.type = FAT_UINT;
+	a.size = sizeof v;
+	a.u = v;
+	return a;
+}
+
+template <typename T>
+inline typename std::enable_if<htFormatArgType<T>() == FAT_DOUBLE, FormatArg>::type htMakeFormatArg(const T &v)
+{
+	FormatArg a;
+	a.type = FAT_DOUBLE;
+	a.f = v;
+	return a;
+}
+
+template <typename T>
+inline typename std::enable_if<htFormatArgType<T>() == FAT_CSTR, FormatArg>::type htMakeFormatArg(const T &v)
+{
+	FormatArg a;
+	a.type = FAT_CSTR;
+	a.cstr = v;
+	return a;
+}
+
+template <typename T>
+inline typename std::enable_if<htFormatArgType<T>() == FAT_STRING, FormatArg>::type htMakeFormatArg(const T &v)
+{
+	FormatArg a;
+	a.type = FAT_STRING;
+	a.str = &v;
+	return a;
+}
+
+template <typename T>
+inline typename std::enable_if<htFormatArgType<T>() == FAT_OBJECT, FormatArg>::type htMakeFormatArg(const T &v)
+{
+	FormatArg a;
+	a.type = FAT_OBJECT;
+	a.obj = &v;
+	return a;
+}
+
+template <typename T>
+inline typename std::enable_if<htFormatArgType<T>() == FAT_POINTER, FormatArg>::type htMakeFormatArg(const T &v)
+{
+	FormatArg a;
+	a.type = FAT_POINTER;
+	a.ptr = (const void *)v;
+	return a;
+}
+
+/*
+ *	destination of formatted output. Text is collected in |buf|, when
+ *	it is full |flush| is called (or, if NULL, output is truncated).
+ */
+struct FormatOutput {
+	char *buf;
+	size_t pos;
+	size_t size;
+	size_t total;
+	void (*flush)(FormatOutput &out);
+	void *context;
+};
+
+void htFormat(FormatOutput &out, const char *fmt, const FormatDirective *d, const FormatArg *args);
+int htFormatBuffer(char *str, size_t count, const char *fmt, const FormatDirective *d, const FormatArg *args);
+int htFormatFile(FILE *file, const char *fmt, const FormatDirective *d, const FormatArg *args);
+uint htFormatStream(Stream &stream, const char *fmt, const FormatDirective *d, const FormatArg *args);
+
+#define HT_FORMAT_CHECK(F, Args)								\
+	constexpr FormatCheckResult check = htCheckFormat<Args...>(F::str());		\
+	static_assert(check != FCR_BAD_CONVERSION,					\
+		"format: unknown or unsupported conversion");				\
+	static_assert(check != FCR_TOO_FEW_ARGS, "format: too few arguments");		\
+	static_assert(check != FCR_TOO_MANY_ARGS, "format: too many arguments");	\
+	static_assert(check != FCR_TYPE_MISMATCH,					\
+		"format: argument type doesn't match conversion");			\
+	static constexpr FormatProgram<htCountDirectives(F::str())> program(F::str());	\
+	const FormatArg args[] = {htMakeFormatArg(a)..., htFormatArg(0)}
+
+template <typename F>
+using FormatLiteralType = typename std::enable_if<std::is_base_of<FormatLiteral, F>::value, int>::type;
+
+/**
+ *	Checked version of ht_snprintf().
+ *	@returns number of characters written (without the terminating 0)
+ */
+template <typename F, typename... Args, FormatLiteralType<F> = 0>
+inline int ht_snprintf(char *str, size_t count, F, const Args &... a)
+{
+	HT_FORMAT_CHECK(F, Args);
+	return htFormatBuffer(str, count, F::str(), program.d, args);
+}
+
+/**
+ *	Checked version of ht_fprintf().
+ */
+template <typename F, typename... Args, FormatLiteralType<F> = 0>
+inline int ht_fprintf(FILE *file, F, const Args &... a)
+{
+	HT_FORMAT_CHECK(F, Args);
+	return htFormatFile(file, F::str(), program.d, args);
+}
+
+/**
+ *	Checked version of ht_printf().
+ */
+template <typename F, typename... Args, FormatLiteralType<F> = 0>
+inline int ht_printf(F, const Args &... a)
+{
+	HT_FORMAT_CHECK(F, Args);
+	return htFormatFile(stdout, F::str(), program.d, args);
+}
+
+/**
+ *	Formats directly to |stream|.
+ *	@returns number of bytes written
+ */
+template <typename F, typename... Args, FormatLiteralType<F> = 0>
+inline uint ht_printf(Stream &stream, F, const Args &... a)
+{
+	HT_FORMAT_CHECK(F, Args);
+	return htFormatStream(stream, F::str(), program.d, args);
+}
+
+#endif /* __FORMAT_H__ */
@@ -0,0 +1,205 @@
+/*
+ *	PearBox
+ *	intern.cc
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include "debug.h"
+#include "intern.h"
+#include "strtools.h"
+
+/*
+ *	The pool
+ */
+
+struct InternShard {
+	std::mutex mutex;
+	InternEntry **buckets;
+	uint mask;
+	uint count;
+	byte *block;
+	uint blockFree;
+};
+
+static InternShard *internShards()
+{
+	// intentionally never freed, interned strings live forever
+	static InternShard *shards = new InternShard[INTERN_SHARDS]();
+	return shards;
+}
+
+static void *internAlloc(InternShard &sh, uint size)
+{
+	size = (size + 7) & ~7;
+	if (size > INTERN_BLOCK_SIZE/4) {
+		void *p = malloc(size);
+		if (!p) throw std::bad_alloc();
+		return p;
+	}
+	if (size > sh.blockFree) {
+		sh.block = (byte*)malloc(INTERN_BLOCK_SIZE);
+		if (!sh.block) throw std::bad_alloc();
+		sh.blockFree = INTERN_BLOCK_SIZE;
+	}
+	void *p = sh.block;
+	sh.block += size;
+	sh.blockFree -= size;
+	return p;
+}
+
+static void internGrow(InternShard &sh)
+{
+	uint newSize = sh.buckets ? (sh.mask+1)*2 : 64;
+	InternEntry **newBuckets = (InternEntry **)calloc(newSize, sizeof (InternEntry *));
+	if (!newBuckets) throw std::bad_alloc();
+	if (sh.buckets) {
+		for (uint i=0; i <= sh.mask; i++) {
+			InternEntry *e = sh.buckets[i];
+			while (e) {
+				InternEntry *next = e->next;
+				uint b = e->hash & (newSize-1);
+				e->next = newBuckets[b];
+				newBuckets[b] = e;
+				e = next;
+			}
+		}
+		free(sh.buckets);
+	}
+	sh.buckets = newBuckets;
+	sh.mask = newSize-1;
+}
+
+/*
+ *	@returns pool entry of |s| or NULL if not found and !|insert|
+ */
+static const InternEntry *intern(const void *s, int len, bool insert)
+{
+	uint64 hash = ht_hash64(s, len);
+	// high bits select the shard, low bits the bucket
+	InternShard &sh = internShards()[hash >> 32 & (INTERN_SHARDS-1)];
+	std::lock_guard<std::mutex> lock(sh.mutex);
+	if (sh.buckets) {
+		for (InternEntry *e = sh.buckets[hash & sh.mask]; e; e = e->next) {
+			if (e->hash == hash && e->length == len
+			 && memcmp(e->chars, s, len) == 0) return e;
+		}
+	}
+	if (!insert) return NULL;
+	if (!sh.buckets || sh.count > sh.mask) internGrow(sh);
+	InternEntry *e = (InternEntry *)internAlloc(sh, offsetof(InternEntry, chars) + len + 1);
+	e->hash = hash;
+	e->length = len;
+	memcpy(e->chars, s, len);
+	e->chars[len] = 0;
+	InternEntry **b = &sh.buckets[hash & sh.mask];
+	e->next = *b;
+	*b = e;
+	sh.count++;
+	return e;
+}
+
+/*
+ *	Class InternedString
+ */
+
+/**
+ *	creates the interned empty string
+ */
+InternedString::InternedString()
+{
+	mEntry = intern("", 0, true);
+}
+
+InternedString::InternedString(const char *s)
+{
+	mEntry = intern(s ? s : "", s ? strlen(s) : 0, true);
+}
+
+InternedString::InternedString(const byte *s, int aLength)
+{
+	ASSERT(aLength >= 0);
+	mEntry = intern(s, aLength, true);
+}
+
+InternedString::InternedString(const String &s)
+{
+	mEntry = intern(s.content(), s.length(), true);
+}
+
+bool InternedString::find(const String &s, InternedString &result)
+{
+	const InternEntry *e = intern(s.content(), s.length(), false);
+	if (!e) return false;
+	result.mEntry = e;
+	return true;
+}
+
+InternedString *InternedString::clone() const
+{
+	return new InternedString(*this);
+}
+
+int InternedString::compareTo(const Object *o) const
+{
+	const InternEntry *e = ((const InternedString *)o)->mEntry;
+	if (mEntry == e) return 0;
+	if (mEntry->hash != e->hash) return (mEntry->hash < e->hash) ? -1 : 1;
+	int r = memcmp(mEntry->chars, e->chars, MIN(mEntry->length, e->length));
+	if (r) return r;
+	return mEntry->length - e->length;
+}
+
+/**
+ *	assigns the content to |result|
+ */
+String &InternedString::getString(String &result) const
+{
+	result.assign((const byte *)mEntry->chars, mEntry->length);
+	return result;
+}
+
+bool InternedString::instanceOf(ObjectID id) const
+{
+	if (id == getObjectID()) return true;
+	return Object::instanceOf(id);
+}
+
+ObjectID InternedString::getObjectID() const
+{
+	return OBJID_INTERNED_STRING;
+}
+
+int InternedString::toString(char *buf, int buflen) const
+{
+	if (buflen <= 0) return 0;
+	int r = MIN(mEntry->length, buflen-1);
+	for (int i=0; i<r; i++) {
+		buf[i] = mEntry->chars[i] ? mEntry->chars[i] : ' ';
+	}
+	buf[r] = 0;
+	return r;
+}
+
+bool InternedString::operator ==(const char *s) const
+{
+	if (!s) return isEmpty();
+	return strlen(s) == (size_t)mEntry->length && memcmp(mEntry->chars, s, mEntry->length) == 0;
+}
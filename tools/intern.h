@@ -0,0 +1,131 @@
+/*
+ *	PearBox
+ *	intern.h
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __INTERN_H__
+#define __INTERN_H__
+
+#include "data.h"
+#include "str.h"
+
+/*
+ *	the pool is split into this many independently locked parts
+ *	(must be a power of 2)
+ */
+#define INTERN_SHARDS			16
+
+/*
+ *	entries are allocated from blocks of this size
+ */
+#define INTERN_BLOCK_SIZE		(16*1024)
+
+struct InternEntry {
+	InternEntry *next;
+	uint64 hash;
+	int length;
+	char chars[1];
+};
+
+/**
+ *	A handle to a string in the global intern pool.
+ *	Equal strings share one pool entry, so testing for equality is a
+ *	pointer compare and the hash is computed only once. Pool entries are
+ *	never freed, handles (and <i>contentChar()</i>) stay valid for the
+ *	lifetime of the program. Interning is thread-safe.
+ */
+class InternedString: public Object {
+	const InternEntry *mEntry;
+public:
+				InternedString();
+				InternedString(const char *s);
+				InternedString(const byte *s, int aLength);
+				InternedString(const String &s);
+
+/**
+ *	Looks up |s| in the pool without adding it.
+ *	@returns true if |s| has been interned before (and sets |result|)
+ */
+	static	bool		find(const String &s, InternedString &result);
+
+	virtual	InternedString *clone() const;
+/**
+ *	Orders by hash (then by content), ie. not lexicographically.
+ */
+	virtual	int		compareTo(const Object *o) const;
+	inline	const char *	contentChar() const;
+		String &	getString(String &result) const;
+	virtual	uint64		hash() const;
+#ifdef HAVE_HT_OBJECTS
+	virtual	bool		instanceOf(ObjectID id) const;
+	virtual	ObjectID	getObjectID() const;
+#endif
+	inline	bool		isEmpty() const;
+	inline	int		length() const;
+	virtual	int		toString(char *buf, int buflen) const;
+
+	inline	bool		operator ==(const InternedString &s) const;
+	inline	bool		operator !=(const InternedString &s) const;
+		bool		operator ==(const char *s) const;
+	inline	bool		operator !=(const char *s) const;
+};
+
+/*
+ *	inline functions
+ */
+
+/**
+ *	@returns 0-terminated content
+ */
+inline const char *InternedString::contentChar() const
+{
+	return mEntry->chars;
+}
+
+/**
+ *	@returns hash of the content, as computed by ht_hash64()
+ */
+inline uint64 InternedString::hash() const
+{
+	return mEntry->hash;
+}
+
+inline bool InternedString::isEmpty() const
+{
+	return mEntry->length == 0;
+}
+
+inline int InternedString::length() const
+{
+	return mEntry->length;
+}
+
+inline bool InternedString::operator ==(const InternedString &s) const
+{
+	return mEntry == s.mEntry;
+}
+
+inline bool InternedString::operator !=(const InternedString &s) const
+{
+	return mEntry != s.mEntry;
+}
+
+inline bool InternedString::operator !=(const char *s) const
+{
+	return !(*this == s);
+}
+
+#endif /* __INTERN_H__ */
@@ -0,0 +1,525 @@
+/*
+ *	PearBox
+ *	log.cc
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include "log.h"
+
+#define LOG_ALIGN(n)		(((n) + 7) & ~7)
+#define LOG_CACHELINE_SIZE	64
+
+std::atomic<int> gLogLevel(LOG_INFO);
+
+/*
+ *	A message in a ring buffer: the header, |count| FormatArgs, then
+ *	copies of the strings (referenced by offset from the header).
+ *	A header with |size| == 0 (or no room for a header) means
+ *	"continue at the start of the buffer".
+ */
+struct LogRecord {
+	uint32 size;
+	uint16 level;
+	uint16 count;
+	uint64 time;
+	const char *fmt;
+	const FormatDirective *d;
+};
+
+/*
+ *	single producer (the owning thread), single consumer (the writer)
+ */
+struct LogRing {
+	byte *buf;
+	LogRing *next;
+	std::atomic<bool> closed;
+	char pad0[LOG_CACHELINE_SIZE];
+	std::atomic<uint64> head;
+	char pad1[LOG_CACHELINE_SIZE];
+	std::atomic<uint64> tail;
+};
+
+enum LogWriterState {
+	LOG_WRITER_STOPPED,
+	LOG_WRITER_RUNNING,
+	LOG_WRITER_DONE,
+};
+
+struct LogState {
+	std::mutex mutex;		// protects the output side
+	std::mutex ringsMutex;		// protects |rings| and starting the writer
+	std::condition_variable wake;
+	std::condition_variable flushed;
+	std::thread writer;
+	std::atomic<int> state;
+	std::atomic<uint64> dropped;
+	uint64 droppedReported;
+	bool stopping;
+	uint64 flushRequests;
+	uint64 flushDone;
+	LogRing *rings;
+
+	bool console;
+	FILE *file;
+	String filePath;
+	uint64 fileSize;
+	uint64 maxSize;
+	int keep;
+
+	LogState()
+		: state(LOG_WRITER_STOPPED), dropped(0), droppedReported(0),
+		  stopping(false), flushRequests(0), flushDone(0), rings(NULL),
+		  console(true), file(NULL), fileSize(0),
+		  maxSize(LOG_ROTATE_SIZE), keep(LOG_ROTATE_KEEP)
+	{
+	}
+};
+
+static LogState &logState()
+{
+	// intentionally never freed, messages may be logged until the very end
+	static LogState *st = new LogState();
+	return *st;
+}
+
+static const char *logLevelName(int level)
+{
+	switch (level) {
+	case LOG_DEBUG: return "DEBUG";
+	case LOG_INFO: return "INFO ";
+	case LOG_WARN: return "WARN ";
+	case LOG_ERROR: return "ERROR";
+	}
+	return "?    ";
+}
+
+static uint64 logTime()
+{
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ *	output (called with st.mutex held)
+ */
+
+static void logRotate(LogState &st)
+{
+	fclose(st.file);
+	if (st.keep > 0) {
+		char from[4096], to[4096];
+		for (int i = st.keep-1; i >= 1; i--) {
+			ht_snprintf(from, sizeof from, HT_FMT("%y.%d"), st.filePath, i);
+			ht_snprintf(to, sizeof to, HT_FMT("%y.%d"), st.filePath, i+1);
+			rename(from, to);
+		}
+		ht_snprintf(to, sizeof to, HT_FMT("%y.1"), st.filePath);
+		rename(st.filePath.contentChar(), to);
+	}
+	st.file = fopen(st.filePath.contentChar(), "w");
+	st.fileSize = 0;
+}
+
+static void logOutput(LogState &st, int level, uint64 time, const char *msg, int len)
+{
+	if (st.console) fwrite(msg, 1, len, stdout);
+	if (!st.file) return;
+
+	// one line per message in the file: no leading newlines, but a trailing one
+	while (len && *msg == '\n') {
+		msg++;
+		len--;
+	}
+	if (!len) return;
+	time_t sec = time / 1000000000;
+	tm t;
+	localtime_r(&sec, &t);
+	char prefix[64];
+	int plen = ht_snprintf(prefix, sizeof prefix, HT_FMT("%04d-%02d-%02d %02d:%02d:%02d.%03d %s "),
+		t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec,
+		(int)(time % 1000000000 / 1000000), logLevelName(level));
+	fwrite(prefix, 1, plen, st.file);
+	fwrite(msg, 1, len, st.file);
+	st.fileSize += plen + len;
+	if (msg[len-1] != '\n') {
+		fputc('\n', st.file);
+		st.fileSize++;
+	}
+	if (st.fileSize >= st.maxSize) logRotate(st);
+}
+
+static void logFlushSinks(LogState &st)
+{
+	if (st.console) fflush(stdout);
+	if (st.file) fflush(st.file);
+}
+
+/*
+ *	the writer
+ */
+
+static LogRecord *logPeek(LogRing *r)
+{
+	uint64 h = r->head.load(std::memory_order_relaxed);
+	uint64 t = r->tail.load(std::memory_order_acquire);
+	while (h != t) {
+		uint pos = h & (LOG_RING_SIZE-1);
+		LogRecord *rec = (LogRecord *)(r->buf + pos);
+		if (LOG_RING_SIZE - pos >= sizeof (LogRecord) && rec->size) return rec;
+		h += LOG_RING_SIZE - pos;
+		r->head.store(h, std::memory_order_release);
+	}
+	return NULL;
+}
+
+/*
+ *	for each argument converted by %s or %y, call |f(index)|
+ */
+template <class F>
+static void logForTextArgs(const FormatDirective *d, F f)
+{
+	int a = 0;
+	for (; d->conv; d++) {
+		if (d->conv == '%') continue;
+		if (d->flags & FMT_F_MINARG) a++;
+		if (d->flags & FMT_F_MAXARG) a++;
+		if (d->conv == 's' || d->conv == 'y') f(a);
+		a++;
+	}
+}
+
+static void logWriteRecord(LogState &st, LogRecord *rec)
+{
+	FormatArg *args = (FormatArg *)(rec+1);
+	logForTextArgs(rec->d, [&](int i) {
+		// copied strings are stored as offsets
+		if (args[i].size) args[i].cstr = (const char *)rec + args[i].s;
+	});
+	char msg[LOG_MAX_MESSAGE];
+	int len = htFormatBuffer(msg, sizeof msg, rec->fmt, rec->d, args);
+	logOutput(st, rec->level, rec->time, msg, len);
+}
+
+/*
+ *	writes all pending messages, oldest first
+ */
+static void logDrain(LogState &st)
+{
+	/*
+	 *	new rings are only ever put in front, so the list
+	 *	starting at |rings| can be walked without the lock
+	 */
+	LogRing *rings;
+	{
+		std::lock_guard<std::mutex> lock(st.ringsMutex);
+		rings = st.rings;
+	}
+	while (true) {
+		LogRing *best = NULL;
+		LogRecord *bestRec = NULL;
+		for (LogRing *r = rings; r; r = r->next) {
+			LogRecord *rec = logPeek(r);
+			if (rec && (!bestRec || rec->time < bestRec->time)) {
+				best = r;
+				bestRec = rec;
+			}
+		}
+		if (!best) break;
+		logWriteRecord(st, bestRec);
+		best->head.store(best->head.load(std::memory_order_relaxed) + bestRec->size, std::memory_order_release);
+	}
+
+	// free rings of threads that have terminated
+	std::unique_lock<std::mutex> lock(st.ringsMutex);
+	LogRing **p = &st.rings;
+	while (*p) {
+		LogRing *r = *p;
+		if (r->closed.load(std::memory_order_acquire) && !logPeek(r)) {
+			*p = r->next;
+			free(r->buf);
+			delete r;
+		} else {
+			p = &r->next;
+		}
+	}
+	lock.unlock();
+
+	uint64 dropped = st.dropped.load(std::memory_order_relaxed);
+	if (dropped != st.droppedReported) {
+		char msg[64];
+		int len = ht_snprintf(msg, sizeof msg, HT_FMT("[LOG] %d messages dropped\n"), dropped - st.droppedReported);
+		logOutput(st, LOG_WARN, logTime(), msg, len);
+		st.droppedReported = dropped;
+	}
+	logFlushSinks(st);
+}
+
+static void logWriter()
+{
+	LogState &st = logState();
+	std::unique_lock<std::mutex> lock(st.mutex);
+	while (true) {
+		uint64 req = st.flushRequests;
+		bool stop = st.stopping;
+		logDrain(st);
+		st.flushDone = req;
+		st.flushed.notify_all();
+		if (stop) break;
+		st.wake.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL));
+	}
+}
+
+/*
+ *	the producers
+ */
+
+struct LogThreadRing {
+	LogRing *ring;
+
+	LogThreadRing() : ring(NULL) {}
+	~LogThreadRing()
+	{
+		if (ring) ring->closed.store(true, std::memory_order_release);
+		ring = NULL;
+	}
+};
+
+static thread_local LogThreadRing gThreadRing;
+
+/*
+ *	@returns the calling thread's ring, NULL if the writer isn't
+ *	running (anymore)
+ */
+static LogRing *logThreadRing(LogState &st)
+{
+	if (gThreadRing.ring) return gThreadRing.ring;
+	std::lock_guard<std::mutex> lock(st.ringsMutex);
+	if (st.state.load() == LOG_WRITER_STOPPED) {
+		try {
+			st.writer = std::thread(logWriter);
+		} catch (const std::exception &) {
+			st.state.store(LOG_WRITER_DONE);
+			return NULL;
+		}
+		st.state.store(LOG_WRITER_RUNNING);
+		atexit(doneLog);
+	}
+	if (st.state.load() != LOG_WRITER_RUNNING) return NULL;
+	LogRing *r = new LogRing();
+	r->buf = (byte *)malloc(LOG_RING_SIZE);
+	if (!r->buf) {
+		delete r;
+		throw std::bad_alloc();
+	}
+	r->closed.store(false);
+	r->head.store(0);
+	r->tail.store(0);
+	r->next = st.rings;
+	st.rings = r;
+	gThreadRing.ring = r;
+	return r;
+}
+
+/*
+ *	used before the writer has been started successfully and after
+ *	doneLog()
+ */
+static void logSync(LogState &st, LogLevel level, const char *fmt, const FormatDirective *d, const FormatArg *args)
+{
+	char msg[LOG_MAX_MESSAGE];
+	int len = htFormatBuffer(msg, sizeof msg, fmt, d, args);
+	std::lock_guard<std::mutex> lock(st.mutex);
+	logOutput(st, level, logTime(), msg, len);
+	logFlushSinks(st);
+}
+
+void htLogSubmit(LogLevel level, const char *fmt, const FormatDirective *d, const FormatArg *args, int count)
+{
+	LogState &st = logState();
+	LogRing *r = NULL;
+	if (st.state.load(std::memory_order_acquire) != LOG_WRITER_DONE) r = logThreadRing(st);
+	if (!r) {
+		logSync(st, level, fmt, d, args);
+		return;
+	}
+
+	/*
+	 *	measure, Objects are converted to text right away
+	 *	(they may change or vanish before the writer gets to them)
+	 */
+	const char *text[LOG_MAX_ARGS];
+	int textLen[LOG_MAX_ARGS];
+	char objText[LOG_MAX_MESSAGE];
+	int objUsed = 0;
+	uint size = sizeof (LogRecord) + count * sizeof (FormatArg);
+	logForTextArgs(d, [&](int i) {
+		const FormatArg &a = args[i];
+		switch (a.type) {
+		case FAT_CSTR:
+			text[i] = a.cstr;
+			textLen[i] = a.cstr ? strnlen(a.cstr, LOG_MAX_MESSAGE) : 0;
+			break;
+		case FAT_STRING:
+			text[i] = (const char *)a.str->content();
+			textLen[i] = MIN(a.str->length(), LOG_MAX_MESSAGE);
+			break;
+		default:
+			text[i] = objText + objUsed;
+			textLen[i] = a.obj->toString(objText + objUsed, sizeof objText - objUsed);
+			objUsed += textLen[i] + 1;
+			if (objUsed > (int)sizeof objText) objUsed = sizeof objText;
+			break;
+		}
+		if (text[i]) size += textLen[i] + 1;
+	});
+	size = LOG_ALIGN(size);
+	if (size > LOG_RING_SIZE/4) {
+		st.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	/*
+	 *	reserve
+	 */
+	uint64 t = r->tail.load(std::memory_order_relaxed);
+	uint64 h = r->head.load(std::memory_order_acquire);
+	uint pos = t & (LOG_RING_SIZE-1);
+	uint skip = (pos + size > LOG_RING_SIZE) ? LOG_RING_SIZE - pos : 0;
+	if (t + skip + size - h > LOG_RING_SIZE) {
+		st.dropped.fetch_add(1, std::memory_order_relaxed);
+		st.wake.notify_one();
+		return;
+	}
+	if (skip >= sizeof (LogRecord)) ((LogRecord *)(r->buf + pos))->size = 0;
+	pos = (pos + skip) & (LOG_RING_SIZE-1);
+
+	/*
+	 *	copy
+	 */
+	LogRecord *rec = (LogRecord *)(r->buf + pos);
+	rec->size = size;
+	rec->level = level;
+	rec->count = count;
+	rec->time = logTime();
+	rec->fmt = fmt;
+	rec->d = d;
+	FormatArg *recArgs = (FormatArg *)(rec+1);
+	memcpy(recArgs, args, count * sizeof (FormatArg));
+	uint ofs = sizeof (LogRecord) + count * sizeof (FormatArg);
+	logForTextArgs(d, [&](int i) {
+		FormatArg &a = recArgs[i];
+		a.type = FAT_CSTR;
+		a.size = 0;
+		if (!text[i]) {
+			a.cstr = NULL;
+			return;
+		}
+		char *dst = (char *)rec + ofs;
+		memcpy(dst, text[i], textLen[i]);
+		// 0-bytes would end the text early, String::toString() uses spaces too
+		for (char *z = dst; (z = (char *)memchr(z, 0, dst + textLen[i] - z)); ) *z = ' ';
+		dst[textLen[i]] = 0;
+		a.size = 1;
+		a.s = ofs;
+		ofs += textLen[i] + 1;
+	});
+	r->tail.store(t + skip + size, std::memory_order_release);
+
+	if (level >= LOG_ERROR || t + skip + size - h > LOG_RING_SIZE/2) st.wake.notify_one();
+}
+
+/*
+ *	configuration
+ */
+
+void logSetLevel(LogLevel level)
+{
+	gLogLevel.store(level, std::memory_order_relaxed);
+}
+
+void logSetConsole(bool enable)
+{
+	LogState &st = logState();
+	std::lock_guard<std::mutex> lock(st.mutex);
+	st.console = enable;
+}
+
+bool logSetFile(const String &path, uint64 maxSize, int keep)
+{
+	LogState &st = logState();
+	std::lock_guard<std::mutex> lock(st.mutex);
+	if (st.file) {
+		fclose(st.file);
+		st.file = NULL;
+	}
+	if (path.isEmpty()) return true;
+	st.file = fopen(path.contentChar(), "a");
+	if (!st.file) return false;
+	fseek(st.file, 0, SEEK_END);
+	st.fileSize = ftell(st.file);
+	st.filePath = path;
+	st.maxSize = maxSize;
+	st.keep = keep;
+	return true;
+}
+
+void logFlush()
+{
+	LogState &st = logState();
+	std::unique_lock<std::mutex> lock(st.mutex);
+	if (st.state.load() != LOG_WRITER_RUNNING) return;
+	uint64 req = ++st.flushRequests;
+	st.wake.notify_one();
+	st.flushed.wait(lock, [&] { return st.flushDone >= req; });
+}
+
+uint64 logDropped()
+{
+	return logState().dropped.load(std::memory_order_relaxed);
+}
+
+/**
+ *	Writes all pending messages and stops the writer thread.
+ *	Messages logged afterwards are written synchronously.
+ */
+void doneLog()
+{
+	LogState &st = logState();
+	{
+		std::lock_guard<std::mutex> lock(st.ringsMutex);
+		if (st.state.load() != LOG_WRITER_RUNNING) return;
+		st.state.store(LOG_WRITER_DONE);
+	}
+	{
+		std::lock_guard<std::mutex> lock(st.mutex);
+		st.stopping = true;
+		st.wake.notify_one();
+	}
+	st.writer.join();
+	// messages that slipped in during the last pass
+	std::lock_guard<std::mutex> lock(st.mutex);
+	logDrain(st);
+}
@@ -0,0 +1,116 @@
+/*
+ *	PearBox
+ *	log.h
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <atomic>
+
+#include "format.h"
+#include "str.h"
+
+/*
+ *	size of the per-thread ring buffer (must be a power of 2)
+ */
+#define LOG_RING_SIZE			(64*1024)
+
+/*
+ *	longer messages are truncated
+ */
+#define LOG_MAX_MESSAGE			4096
+
+/*
+ *	max. number of arguments of a message
+ */
+#define LOG_MAX_ARGS			16
+
+/*
+ *	the writer wakes up at least this often (in ms)
+ */
+#define LOG_FLUSH_INTERVAL		50
+
+/*
+ *	defaults for log file rotation
+ */
+#define LOG_ROTATE_SIZE			(4*1024*1024)
+#define LOG_ROTATE_KEEP			4
+
+enum LogLevel {
+	LOG_DEBUG,
+	LOG_INFO,
+	LOG_WARN,
+	LOG_ERROR,
+	LOG_NONE,
+};
+
+/*
+ *	Asynchronous logging
+ *
+ *	ht_log(LOG_INFO, HT_FMT("[SAVE] '%y' saved\n"), path);
+ *
+ *	The arguments are checked like those of the checked ht_printf()
+ *	and copied (strings included) into a lock-free ring buffer owned by
+ *	the calling thread. A background thread formats the messages and
+ *	writes them to the console and/or a log file. If a ring is full,
+ *	messages are dropped (and counted), logging never blocks.
+ *
+ *	The writer thread is started by the first message and stopped
+ *	(after writing everything) by doneLog() or at exit.
+ */
+
+extern std::atomic<int> gLogLevel;
+
+void	htLogSubmit(LogLevel level, const char *fmt, const FormatDirective *d, const FormatArg *args, int count);
+
+template <typename F, typename... Args, FormatLiteralType<F> = 0>
+inline void ht_log(LogLevel level, F, const Args &... a)
+{
+	static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "ht_log: too many arguments");
+	HT_FORMAT_CHECK(F, Args);
+	if (level < gLogLevel.load(std::memory_order_relaxed)) return;
+	htLogSubmit(level, F::str(), program.d, args, sizeof...(Args));
+}
+
+/**
+ *	Messages below |level| are discarded (default: LOG_INFO).
+ */
+void	logSetLevel(LogLevel level);
+/**
+ *	Write messages to stdout (default: true).
+ */
+void	logSetConsole(bool enable);
+/**
+ *	Also append messages (with time and level) to the file |path|.
+ *	If it grows beyond |maxSize| bytes, it is renamed to |path|.1
+ *	(|path|.1 to |path|.2 and so on, keeping |keep| old files) and a
+ *	new file is started. An empty |path| closes the log file.
+ *	@returns false if the file can't be opened
+ */
+bool	logSetFile(const String &path, uint64 maxSize = LOG_ROTATE_SIZE, int keep = LOG_ROTATE_KEEP);
+/**
+ *	Wait until all messages logged so far (by any thread) have been written.
+ */
+void	logFlush();
+/**
+ *	@returns number of messages dropped because of full ring buffers
+ */
+uint64	logDropped();
+
+void	doneLog();
+
+#endif /* __LOG_H__ */
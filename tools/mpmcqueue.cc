@@ -0,0 +1,485 @@
+/*
+ *	PearBox
+ *	mpmcqueue.cc
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <new>
+#include <cstdlib>
+#include <thread>
+
+#include "debug.h"
+#include "except.h"
+#include "mpmcqueue.h"
+
+/*
+ *	Class MPMCWaiter
+ */
+
+MPMCWaiter::MPMCWaiter()
+	: mWaiters(0)
+{
+}
+
+void MPMCWaiter::notify()
+{
+	/* pairs with the fence in wait(): either we see the sleeper or it sees our change */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (mWaiters.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(mMutex);
+		mCond.notify_all();
+	}
+}
+
+template <class TryOp>
+void MPMCWaiter::wait(TryOp tryOp)
+{
+	for (int i = 0; i < MPMC_SPIN_COUNT; i++) {
+		if (tryOp()) return;
+		std::this_thread::yield();
+	}
+	std::unique_lock<std::mutex> lock(mMutex);
+	mWaiters.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	while (!tryOp()) mCond.wait(lock);
+	mWaiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+static void freeObj(Object *obj)
+{
+	if (obj) {
+		obj->done();
+		delete obj;
+	}
+}
+
+/*
+ *	Class MPMCQueue
+ */
+
+MPMCQueue::MPMCQueue(uint aCapacity, bool aOwnObjects)
+{
+	size_t n = 2;
+	while (n < aCapacity) n *= 2;
+	mCells = (Cell*)malloc(n * sizeof *mCells);
+	if (!mCells) throw std::bad_alloc();
+	for (size_t i = 0; i < n; i++) {
+		new (&mCells[i].seq) std::atomic<size_t>(i);
+		mCells[i].obj = NULL;
+	}
+	mMask = n-1;
+	mOwnObjects = aOwnObjects;
+	mTail.store(0);
+	mHead.store(0);
+}
+
+MPMCQueue::~MPMCQueue()
+{
+	if (mOwnObjects) {
+		Object *obj;
+		while (tryDeQueue(obj)) freeObj(obj);
+	}
+	free(mCells);
+}
+
+uint MPMCQueue::capacity() const
+{
+	return mMask+1;
+}
+
+uint MPMCQueue::count() const
+{
+	size_t head = mHead.load(std::memory_order_relaxed);
+	size_t tail = mTail.load(std::memory_order_relaxed);
+	return (tail > head) ? tail-head : 0;
+}
+
+bool MPMCQueue::tryEnQueue(Object *obj)
+{
+	ASSERT(obj);
+	size_t pos = mTail.load(std::memory_order_relaxed);
+	Cell *cell;
+	while (true) {
+		cell = &mCells[pos & mMask];
+		size_t seq = cell->seq.load(std::memory_order_acquire);
+		ptrdiff_t dif = (ptrdiff_t)seq - (ptrdiff_t)pos;
+		if (dif == 0) {
+			if (mTail.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+		} else if (dif < 0) {
+			/* full */
+			return false;
+		} else {
+			pos = mTail.load(std::memory_order_relaxed);
+		}
+	}
+	cell->obj = obj;
+	cell->seq.store(pos+1, std::memory_order_release);
+	mNotEmpty.notify();
+	return true;
+}
+
+uint MPMCQueue::tryEnQueueBatch(Object * const *objs, uint count)
+{
+	if (!count) return 0;
+	size_t pos = mTail.load(std::memory_order_relaxed);
+	size_t k;
+	while (true) {
+		/* count free cells starting at pos */
+		ptrdiff_t dif = 0;
+		for (k = 0; k < count && k <= mMask; k++) {
+			size_t seq = mCells[(pos+k) & mMask].seq.load(std::memory_order_acquire);
+			dif = (ptrdiff_t)seq - (ptrdiff_t)(pos+k);
+			if (dif) break;
+		}
+		if (!k) {
+			if (dif < 0) return 0;
+			pos = mTail.load(std::memory_order_relaxed);
+			continue;
+		}
+		if (mTail.compare_exchange_weak(pos, pos+k, std::memory_order_relaxed)) break;
+	}
+	for (size_t i = 0; i < k; i++) {
+		Cell *cell = &mCells[(pos+i) & mMask];
+		ASSERT(objs[i]);
+		cell->obj = objs[i];
+		cell->seq.store(pos+i+1, std::memory_order_release);
+	}
+	mNotEmpty.notify();
+	return k;
+}
+
+void MPMCQueue::enQueue(Object *obj)
+{
+	if (tryEnQueue(obj)) return;
+	mNotFull.wait([&]() { return tryEnQueue(obj); });
+}
+
+void MPMCQueue::enQueueBatch(Object * const *objs, uint count)
+{
+	while (count) {
+		uint n = tryEnQueueBatch(objs, count);
+		if (!n) mNotFull.wait([&]() { return (n = tryEnQueueBatch(objs, count)) != 0; });
+		objs += n;
+		count -= n;
+	}
+}
+
+bool MPMCQueue::tryDeQueue(Object *&obj)
+{
+	size_t pos = mHead.load(std::memory_order_relaxed);
+	Cell *cell;
+	while (true) {
+		cell = &mCells[pos & mMask];
+		size_t seq = cell->seq.load(std::memory_order_acquire);
+		ptrdiff_t dif = (ptrdiff_t)seq - (ptrdiff_t)(pos+1);
+		if (dif == 0) {
+			if (mHead.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+		} else if (dif < 0) {
+			/* empty */
+			return false;
+		} else {
+			pos = mHead.load(std::memory_order_relaxed);
+		}
+	}
+	obj = cell->obj;
+	cell->seq.store(pos+mMask+1, std::memory_order_release);
+	mNotFull.notify();
+	return true;
+}
+
+uint MPMCQueue::tryDeQueueBatch(Object **objs, uint max)
+{
+	if (!max) return 0;
+	size_t pos = mHead.load(std::memory_order_relaxed);
+	size_t k;
+	while (true) {
+		/* count filled cells starting at pos */
+		ptrdiff_t dif = 0;
+		for (k = 0; k < max && k <= mMask; k++) {
+			size_t seq = mCells[(pos+k) & mMask].seq.load(std::memory_order_acquire);
+			dif = (ptrdiff_t)seq - (ptrdiff_t)(pos+k+1);
+			if (dif) break;
+		}
+		if (!k) {
+			if (dif < 0) return 0;
+			pos = mHead.load(std::memory_order_relaxed);
+			continue;
+		}
+		if (mHead.compare_exchange_weak(pos, pos+k, std::memory_order_relaxed)) break;
+	}
+	for (size_t i = 0; i < k; i++) {
+		Cell *cell = &mCells[(pos+i) & mMask];
+		objs[i] = cell->obj;
+		cell->seq.store(pos+i+mMask+1, std::memory_order_release);
+	}
+	mNotFull.notify();
+	return k;
+}
+
+Object *MPMCQueue::deQueue()
+{
+	Object *obj;
+	if (!tryDeQueue(obj)) mNotEmpty.wait([&]() { return tryDeQueue(obj); });
+	return obj;
+}
+
+uint MPMCQueue::deQueueBatch(Object **objs, uint max)
+{
+	uint n = tryDeQueueBatch(objs, max);
+	if (!n && max) mNotEmpty.wait([&]() { return (n = tryDeQueueBatch(objs, max)) != 0; });
+	return n;
+}
+
+/*
+ *	Class SegmentedMPMCQueue
+ */
+
+/* marks an item that was taken (or given up) by a consumer */
+static char gTakenMarker;
+#define MPMC_TAKEN	((Object*)&gTakenMarker)
+
+/*
+ *	Each thread using a SegmentedMPMCQueue gets a slot (0..MPMC_MAX_THREADS-1)
+ *	for its hazard pointer and retired segments, released when the thread exits.
+ */
+static std::atomic<bool> gThreadSlots[MPMC_MAX_THREADS];
+
+struct MPMCThreadSlot {
+	int id;
+
+	MPMCThreadSlot() : id(-1) {}
+	~MPMCThreadSlot()
+	{
+		if (id >= 0) gThreadSlots[id].store(false, std::memory_order_release);
+	}
+};
+
+static thread_local MPMCThreadSlot gThreadSlot;
+
+static int getThreadSlot()
+{
+	if (gThreadSlot.id < 0) {
+		for (int i = 0; i < MPMC_MAX_THREADS; i++) {
+			bool used = false;
+			if (gThreadSlots[i].compare_exchange_strong(used, true)) {
+				gThreadSlot.id = i;
+				return i;
+			}
+		}
+		throw MsgfException("more than %d threads using SegmentedMPMCQueue", MPMC_MAX_THREADS);
+	}
+	return gThreadSlot.id;
+}
+
+SegmentedMPMCQueue::Segment::Segment(Object * const *objs, uint count)
+	: deqIdx(0), enqIdx(count), next(NULL)
+{
+	for (uint i = 0; i < count; i++) items[i].store(objs[i], std::memory_order_relaxed);
+	for (uint i = count; i < MPMC_SEGMENT_SIZE; i++) items[i].store(NULL, std::memory_order_relaxed);
+}
+
+SegmentedMPMCQueue::SegmentedMPMCQueue(bool aOwnObjects)
+{
+	mOwnObjects = aOwnObjects;
+	Segment *s = new Segment(NULL, 0);
+	mHead.store(s);
+	mTail.store(s);
+	for (int i = 0; i < MPMC_MAX_THREADS; i++) {
+		mHazard[i].store(NULL);
+		mRetired[i].segs = NULL;
+		mRetired[i].count = 0;
+		mRetired[i].size = 0;
+	}
+}
+
+SegmentedMPMCQueue::~SegmentedMPMCQueue()
+{
+	Segment *s = mHead.load();
+	while (s) {
+		Segment *next = s->next.load();
+		if (mOwnObjects) {
+			uint from = s->deqIdx.load();
+			for (uint i = from; i < MPMC_SEGMENT_SIZE; i++) {
+				Object *obj = s->items[i].load();
+				if (obj != MPMC_TAKEN) freeObj(obj);
+			}
+		}
+		delete s;
+		s = next;
+	}
+	for (int i = 0; i < MPMC_MAX_THREADS; i++) {
+		for (uint j = 0; j < mRetired[i].count; j++) delete mRetired[i].segs[j];
+		free(mRetired[i].segs);
+	}
+}
+
+/*
+ *	Publish *src as our hazard pointer, so it won't be freed while we use it.
+ */
+SegmentedMPMCQueue::Segment *SegmentedMPMCQueue::protect(std::atomic<Segment *> &src, int tid)
+{
+	Segment *s = src.load();
+	while (true) {
+		mHazard[tid].store(s);
+		Segment *t = src.load();
+		if (t == s) return s;
+		s = t;
+	}
+}
+
+void SegmentedMPMCQueue::retire(Segment *seg, int tid)
+{
+	RetireList &r = mRetired[tid];
+	if (r.count == r.size) {
+		uint n = r.size ? r.size*2 : MPMC_RETIRE_THRESHOLD*2;
+		Segment **segs = (Segment**)::realloc(r.segs, n * sizeof *segs);
+		if (!segs) {
+			/* can't track it, leak it rather than risk a use after free */
+			return;
+		}
+		r.segs = segs;
+		r.size = n;
+	}
+	r.segs[r.count++] = seg;
+	if (r.count >= MPMC_RETIRE_THRESHOLD) scan(tid);
+}
+
+/*
+ *	Free all retired segments no thread holds a hazard pointer to.
+ */
+void SegmentedMPMCQueue::scan(int tid)
+{
+	RetireList &r = mRetired[tid];
+	uint k = 0;
+	for (uint i = 0; i < r.count; i++) {
+		Segment *s = r.segs[i];
+		bool hazardous = false;
+		for (int j = 0; j < MPMC_MAX_THREADS; j++) {
+			if (mHazard[j].load() == s) {
+				hazardous = true;
+				break;
+			}
+		}
+		if (hazardous) {
+			r.segs[k++] = s;
+		} else {
+			delete s;
+		}
+	}
+	r.count = k;
+}
+
+void SegmentedMPMCQueue::enQueue(Object *obj)
+{
+	enQueueBatch(&obj, 1);
+}
+
+void SegmentedMPMCQueue::enQueueBatch(Object * const *objs, uint count)
+{
+	if (!count) return;
+	int tid = getThreadSlot();
+	while (count) {
+		Segment *tail = protect(mTail, tid);
+		uint want = MIN(count, MPMC_SEGMENT_SIZE);
+		uint idx = tail->enqIdx.fetch_add(want);
+		if (idx < MPMC_SEGMENT_SIZE) {
+			uint n = MIN(want, MPMC_SEGMENT_SIZE - idx);
+			uint i;
+			for (i = 0; i < n; i++) {
+				ASSERT(objs[i]);
+				Object *expected = NULL;
+				/*
+				 *	fails if a consumer has given up on this item already,
+				 *	the rest of the claim is given up too (to keep the order)
+				 *	and claimed anew
+				 */
+				if (!tail->items[idx+i].compare_exchange_strong(expected, objs[i])) break;
+			}
+			objs += i;
+			count -= i;
+			continue;
+		}
+		/* segment is full */
+		if (tail != mTail.load()) continue;
+		Segment *next = tail->next.load();
+		if (!next) {
+			Segment *s = new Segment(objs, want);
+			if (tail->next.compare_exchange_strong(next, s)) {
+				mTail.compare_exchange_strong(tail, s);
+				objs += want;
+				count -= want;
+				continue;
+			}
+			delete s;
+		} else {
+			mTail.compare_exchange_strong(tail, next);
+		}
+	}
+	mHazard[tid].store(NULL, std::memory_order_release);
+	mNotEmpty.notify();
+}
+
+bool SegmentedMPMCQueue::tryDeQueue(Object *&obj)
+{
+	return tryDeQueueBatch(&obj, 1) != 0;
+}
+
+uint SegmentedMPMCQueue::tryDeQueueBatch(Object **objs, uint max)
+{
+	if (!max) return 0;
+	int tid = getThreadSlot();
+	uint n = 0;
+	while (n < max) {
+		Segment *head = protect(mHead, tid);
+		uint deq = head->deqIdx.load();
+		uint enq = MIN(head->enqIdx.load(), MPMC_SEGMENT_SIZE);
+		if (deq >= enq && !head->next.load()) break;
+		/* claim what seems to be there, at least one to notice a drained segment */
+		uint want = (enq > deq) ? MIN(max - n, enq - deq) : 1;
+		uint idx = head->deqIdx.fetch_add(want);
+		if (idx >= MPMC_SEGMENT_SIZE) {
+			/* segment is drained, move on */
+			Segment *next = head->next.load();
+			if (!next) break;
+			/* never let mHead pass mTail, mTail must not point to retired segments */
+			Segment *tail = head;
+			mTail.compare_exchange_strong(tail, next);
+			if (mHead.compare_exchange_strong(head, next)) retire(head, tid);
+			continue;
+		}
+		uint end = MIN(idx + want, MPMC_SEGMENT_SIZE);
+		for (uint i = idx; i < end; i++) {
+			Object *item = head->items[i].exchange(MPMC_TAKEN);
+			/* NULL: producer hasn't stored it yet, it will retry elsewhere */
+			if (item) objs[n++] = item;
+		}
+	}
+	mHazard[tid].store(NULL, std::memory_order_release);
+	return n;
+}
+
+Object *SegmentedMPMCQueue::deQueue()
+{
+	Object *obj;
+	if (!tryDeQueue(obj)) mNotEmpty.wait([&]() { return tryDeQueue(obj); });
+	return obj;
+}
+
+uint SegmentedMPMCQueue::deQueueBatch(Object **objs, uint max)
+{
+	uint n = tryDeQueueBatch(objs, max);
+	if (!n && max) mNotEmpty.wait([&]() { return (n = tryDeQueueBatch(objs, max)) != 0; });
+	return n;
+}
@@ -0,0 +1,230 @@
+/*
+ *	PearBox
+ *	mpmcqueue.h
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __MPMCQUEUE_H__
+#define __MPMCQUEUE_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include "data.h"
+
+#define MPMC_CACHELINE_SIZE		64
+
+/*
+ *	a blocking operation spins (yielding) this often before going to sleep
+ */
+#define MPMC_SPIN_COUNT			64
+
+/*
+ *	elements per segment of SegmentedMPMCQueue
+ */
+#define MPMC_SEGMENT_SIZE		1024
+
+/*
+ *	max. number of threads concurrently using SegmentedMPMCQueues
+ */
+#define MPMC_MAX_THREADS		128
+
+/*
+ *	retired segments are scanned against all hazard pointers
+ *	once a thread has retired this many
+ */
+#define MPMC_RETIRE_THRESHOLD		8
+
+/**
+ *	Parks threads of blocking queue operations.
+ *	Only touched if a queue is found full (or empty), the non-blocking
+ *	paths never take the mutex unless somebody is sleeping.
+ */
+class MPMCWaiter {
+	std::mutex mMutex;
+	std::condition_variable mCond;
+	std::atomic<int> mWaiters;
+public:
+				MPMCWaiter();
+/**
+ *	Wake up all sleepers. Called after each successful operation.
+ */
+		void		notify();
+/**
+ *	Call <i>tryOp</i> until it succeeds, spinning first and sleeping
+ *	until notified afterwards.
+ */
+	template <class TryOp>
+		void		wait(TryOp tryOp);
+};
+
+/**
+ *	A bounded lock-free multi-producer/multi-consumer queue.
+ *	Ring buffer with a sequence number per cell, producers and consumers
+ *	each claim positions with a single CAS and never lock.
+ *	<i>NULL</i> can't be en-queued.
+ */
+class MPMCQueue {
+	struct Cell {
+		std::atomic<size_t> seq;
+		Object *obj;
+	};
+
+	Cell *mCells;
+	size_t mMask;
+	bool mOwnObjects;
+	char mPad0[MPMC_CACHELINE_SIZE];
+	std::atomic<size_t> mTail;
+	char mPad1[MPMC_CACHELINE_SIZE - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> mHead;
+	char mPad2[MPMC_CACHELINE_SIZE - sizeof(std::atomic<size_t>)];
+	MPMCWaiter mNotFull;
+	MPMCWaiter mNotEmpty;
+
+				MPMCQueue(const MPMCQueue &);		// not implemented
+	MPMCQueue &		operator =(const MPMCQueue &);		// not implemented
+public:
+/**
+ *	@param capacity max. number of elements (rounded up to a power of 2)
+ *	@param own_objects if true, elements still en-queued are deleted by the destructor
+ */
+				MPMCQueue(uint capacity, bool own_objects);
+				~MPMCQueue();
+/**
+ *	@returns max. number of elements
+ */
+		uint		capacity() const;
+/**
+ *	@returns number of elements (a snapshot, may be outdated immediately)
+ */
+		uint		count() const;
+/**
+ *	En-queue element, wait while the queue is full.
+ */
+		void		enQueue(Object *obj);
+/**
+ *	En-queue element if the queue isn't full.
+ *	@returns true if <i>obj</i> has been en-queued
+ */
+		bool		tryEnQueue(Object *obj);
+/**
+ *	En-queue <i>count</i> elements (in order), wait while the queue is full.
+ */
+		void		enQueueBatch(Object * const *objs, uint count);
+/**
+ *	En-queue as many of the <i>count</i> elements as fit, claiming
+ *	all positions at once.
+ *	@returns number of elements en-queued (the first ones of <i>objs</i>)
+ */
+		uint		tryEnQueueBatch(Object * const *objs, uint count);
+/**
+ *	De-queue element, wait while the queue is empty.
+ */
+		Object *	deQueue();
+/**
+ *	De-queue element if the queue isn't empty.
+ *	@returns true if an element has been de-queued to <i>obj</i>
+ */
+		bool		tryDeQueue(Object *&obj);
+/**
+ *	De-queue up to <i>max</i> elements, wait while the queue is empty.
+ *	@returns number of elements de-queued (at least one)
+ */
+		uint		deQueueBatch(Object **objs, uint max);
+/**
+ *	De-queue up to <i>max</i> elements, claiming all positions at once.
+ *	@returns number of elements de-queued
+ */
+		uint		tryDeQueueBatch(Object **objs, uint max);
+};
+
+/**
+ *	An unbounded lock-free multi-producer/multi-consumer queue.
+ *	Linked list of fixed size segments, positions inside a segment are
+ *	claimed by fetch-and-add (a batch of them at once by the batch
+ *	operations). Drained segments are reclaimed using
+ *	hazard pointers. En-queueing never blocks.
+ *	<i>NULL</i> can't be en-queued.
+ */
+class SegmentedMPMCQueue {
+	struct Segment {
+		std::atomic<uint> deqIdx;
+		std::atomic<uint> enqIdx;
+		std::atomic<Segment *> next;
+		std::atomic<Object *> items[MPMC_SEGMENT_SIZE];
+
+		Segment(Object * const *objs, uint count);
+	};
+	struct RetireList {
+		Segment **segs;
+		uint count;
+		uint size;
+	};
+
+	bool mOwnObjects;
+	char mPad0[MPMC_CACHELINE_SIZE];
+	std::atomic<Segment *> mHead;
+	char mPad1[MPMC_CACHELINE_SIZE - sizeof(std::atomic<Segment *>)];
+	std::atomic<Segment *> mTail;
+	char mPad2[MPMC_CACHELINE_SIZE - sizeof(std::atomic<Segment *>)];
+	std::atomic<Segment *> mHazard[MPMC_MAX_THREADS];
+	RetireList mRetired[MPMC_MAX_THREADS];
+	MPMCWaiter mNotEmpty;
+
+		Segment *	protect(std::atomic<Segment *> &src, int tid);
+		void		retire(Segment *seg, int tid);
+		void		scan(int tid);
+
+				SegmentedMPMCQueue(const SegmentedMPMCQueue &);		// not implemented
+	SegmentedMPMCQueue &	operator =(const SegmentedMPMCQueue &);		// not implemented
+public:
+/**
+ *	@param own_objects if true, elements still en-queued are deleted by the destructor
+ */
+				SegmentedMPMCQueue(bool own_objects);
+				~SegmentedMPMCQueue();
+/**
+ *	En-queue element.
+ */
+		void		enQueue(Object *obj);
+/**
+ *	En-queue <i>count</i> elements (in order), claiming the positions
+ *	with one fetch-and-add per segment and waking consumers once.
+ */
+		void		enQueueBatch(Object * const *objs, uint count);
+/**
+ *	De-queue element, wait while the queue is empty.
+ */
+		Object *	deQueue();
+/**
+ *	De-queue element if the queue isn't empty.
+ *	@returns true if an element has been de-queued to <i>obj</i>
+ */
+		bool		tryDeQueue(Object *&obj);
+/**
+ *	De-queue up to <i>max</i> elements, wait while the queue is empty.
+ *	@returns number of elements de-queued (at least one)
+ */
+		uint		deQueueBatch(Object **objs, uint max);
+/**
+ *	De-queue up to <i>max</i> elements, claiming the positions filled
+ *	in a segment with one fetch-and-add.
+ *	@returns number of elements de-queued
+ */
+		uint		tryDeQueueBatch(Object **objs, uint max);
+};
+
+#endif /* __MPMCQUEUE_H__ */
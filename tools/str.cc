@@ -22,6 +22,7 @@
 #include <cctype>
 #include <cstdlib>
 #include <cstring>
+#include <new>
 
 #include "except.h"
 #include "debug.h"
@@ -47,7 +48,7 @@
  */
 String::String()
 {
-	mContent = NULL;
+	initContent();
 	realloc(0);
 }
 
@@ -56,7 +57,7 @@ String::String()
  */
 String::String(const char *s)
 {
-	mContent = NULL;
+	initContent();
 	assign(s);
 }
 
@@ -65,7 +66,7 @@ String::String(const char *s)
  */
 String::String(const String *s)
 {
-	mContent = NULL;
+	initContent();
 	assign(s);
 }
 
@@ -75,16 +76,25 @@ String::String(const String *s)
 String::String(const String &s)
 {
 	ASSERT(&s != this);
-	mContent = NULL;
+	initContent();
 	assign(s);
 }
 
+/**
+ *	move constructor, |s| will be empty afterwards
+ */
+String::String(String &&s) noexcept
+{
+	initContent();
+	assign(std::move(s));
+}
+
 /**
  *   creates string from array |s| size |aLength|
  */
 String::String(const byte *s, int aLength)
 {
-	mContent = NULL;
+	initContent();
 	assign(s, aLength);
 }
 
@@ -93,13 +103,13 @@ String::String(const byte *s, int aLength)
  */
 String::String(char c, int count)
 {
-	mContent = NULL;
+	initContent();
 	assign(c, count);
 }
 
 String::~String()
 {
-	if (mContent) free(mContent);
+	if (mContent != mInline) free(mContent);
 }
 
 /**
@@ -120,6 +130,27 @@ void String::assign(const String &s)
 	memcpy(mContent, s.mContent, mLength);
 }
 
+/**
+ *	(re-)assigns string to |s| by taking over its content.
+ *	|s| will be empty afterwards. Never allocates: inline content
+ *	always fits.
+ */
+void String::assign(String &&s) noexcept
+{
+	if (&s == this) return;
+	if (s.mContent == s.mInline) {
+		assign((const String &)s);
+	} else {
+		if (mContent != mInline) free(mContent);
+		mContent = s.mContent;
+		mLength = s.mLength;
+		mCapacity = s.mCapacity;
+		invalidateHash();
+		s.initContent();
+	}
+	s.realloc(0);
+}
+
 /**
  *	(re-)assigns string to char * |s|
  */
@@ -166,10 +197,11 @@ void String::assignFormat(const char *s, ...)
  */
 void String::append(const String &s)
 {
-	if (s.mLength) {
+	int slen = s.mLength;
+	if (slen) {
 		int oldLength = mLength;
-		realloc(mLength + s.mLength);
-		memcpy(&mContent[oldLength], s.mContent, s.mLength);
+		realloc(mLength + slen);
+		memcpy(&mContent[oldLength], s.mContent, slen);
 	}
 }
 
@@ -183,6 +215,15 @@ void String::append(const char *s)
 	}
 }
 
+void String::append(const byte *s, int aLength)
+{
+	if (aLength > 0) {
+		int oldLength = mLength;
+		realloc(mLength + aLength);
+		memcpy(&mContent[oldLength], s, aLength);
+	}
+}
+
 void String::appendChar(char c)
 {
 	realloc(mLength+1);
@@ -194,11 +235,12 @@ void String::appendChar(char c)
  */
 void String::prepend(const String &s)
 {
-	if (s.mLength) {
+	int slen = s.mLength;
+	if (slen) {
 		int oldLength = mLength;
-		realloc(mLength + s.mLength);
-		memmove(&mContent[s.mLength], &mContent[0], oldLength);
-		memcpy(&mContent[0], s.mContent, s.mLength);
+		realloc(mLength + slen);
+		memmove(&mContent[slen], &mContent[0], oldLength);
+		memcpy(&mContent[0], s.mContent, slen);
 	}
 }
 
@@ -218,6 +260,7 @@ String *String::clone() const
 /**
  *	compares to characters.
  *	used in compareTo() and findXXX() (and therefore replace())
+ *	Subclasses overriding this must also override charCompare().
  *	@returns 0 for equality, negative number if |c1<c2| and positive number if |c1>c2|
  */
 int String::compareChar(char c1, char c2) const
@@ -227,37 +270,34 @@ int String::compareChar(char c1, char c2) const
 	return 0;
 }
 
+/**
+ *	@returns stringCharCompareBinary if compareChar() compares bytes
+ *	(as signed chars), which allows searching with ht_memchr() and friends,
+ *	stringCharCompareCaseFold if two ASCII characters are equal to
+ *	compareChar() iff they are equal ignoring case
+ */
+StringCharCompare String::charCompare() const
+{
+	return stringCharCompareBinary;
+}
+
 int String::compare(const char *s) const
 {
-	if (!mLength) {
-		return (s) ? -1: 0;
-	}
 	if (!s) {
-		return 1;
-	}
-	int l = mLength;
-	for (int i=0; i < l; i++) {
-		if (!*s) return 1;
-		int r = compareChar(mContent[i], s[i]);
-		if (r) return r;
+		return mLength ? 1 : 0;
 	}
-	if (s[l]) return -1;
-	return 0;
+	int slen = strlen(s);
+	int r = compareContent(mContent, (const byte*)s, MIN(mLength, slen));
+	if (r) return r;
+	if (mLength < slen) return -1;
+	if (mLength == slen) return 0;
+	return 1;
 }
 
 int String::compare(const String &s) const
 {
-	if (!mContent) {
-		return (s.mContent) ? -1: 0;
-	}
-	if (!s.mContent) {
-		return 1;
-	}
-	int l = MIN(mLength, s.mLength);
-	for (int i=0; i<l; i++) {
-		int r = compareChar(mContent[i], s.mContent[i]);
-		if (r) return r;
-	}
+	int r = compareContent(mContent, s.mContent, MIN(mLength, s.mLength));
+	if (r) return r;
 	if (mLength < s.mLength) return -1;
 	if (mLength == s.mLength) return 0;
 	return 1;
@@ -269,25 +309,39 @@ int String::compare(const String &s) const
 int String::compare(const String &s, int aMax) const
 {
 	if (aMax <= 0) return 0;
-	if (!mContent) {
-		return (s.mContent) ? -1: 0;
-	}
-	if (!s.mContent) {
-		return 1;
-	}
 	int l = MIN(mLength, s.mLength);
-	l = MIN(l, aMax);
-	int i;
-	for (i=0; i<l; i++) {
-		int r = compareChar(mContent[i], s.mContent[i]);
-		if (r) return r;
-	}
-	if (i == aMax) return 0;
+	if (l >= aMax) return compareContent(mContent, s.mContent, aMax);
+	int r = compareContent(mContent, s.mContent, l);
+	if (r) return r;
 	if (mLength < s.mLength) return -1;
 	if (mLength == s.mLength) return 0;
 	return 1;
 }
 
+/*
+ *	compares |len| characters of |a| and |b| with compareChar().
+ *	Runs of characters known to be equal (see charCompare()) are
+ *	skipped with ht_mismatch()/ht_mismatch_casefold(), compareChar()
+ *	only decides where those stop.
+ */
+int String::compareContent(const byte *a, const byte *b, int len) const
+{
+	StringCharCompare cc = charCompare();
+	int i = 0;
+	while (i < len) {
+		if (cc == stringCharCompareBinary) {
+			i += ht_mismatch(a+i, b+i, len-i);
+		} else if (cc == stringCharCompareCaseFold) {
+			i += ht_mismatch_casefold(a+i, b+i, len-i);
+		}
+		if (i == len) break;
+		int r = compareChar(a[i], b[i]);
+		if (r) return r;
+		i++;
+	}
+	return 0;
+}
+
 int String::compareTo(const Object *o) const
 {
 	ASSERT(getObjectID() == o->getObjectID());
@@ -345,6 +399,10 @@ int String::findFirstChar(char c, int start) const
 	if (!mLength) return -1;
 	if (start >= mLength) return -1;
 	if (start < 0) start = 0;
+	if (charCompare() == stringCharCompareBinary) {
+		byte *p = ht_memchr(mContent+start, mLength-start, c);
+		return p ? p-mContent : -1;
+	}
 	for (int i=start; i<mLength; i++) {
 		if (compareChar(mContent[i], c) == 0) return i;
 	}
@@ -362,6 +420,10 @@ int String::findFirstString(const String &s, int start) const
 	if (!s.mLength) return 0;
 	if (start < 0) start = 0;
 	if (!mLength || (start+s.mLength > mLength)) return -1;
+	if (charCompare() == stringCharCompareBinary) {
+		byte *p = ht_memmem(mContent+start, mLength-start, s.mContent, s.mLength);
+		return p ? p-mContent : -1;
+	}
 	for (int i=start; (i+s.mLength <= mLength); i++) {
 		for (int j=i; (j>=0) && (j+s.mLength <= mLength) && (j-i < s.mLength); j++) {
 			if (compareChar(mContent[j], s.mContent[j-i])) goto notfound;
@@ -383,6 +445,10 @@ int String::findLastChar(char c, int start) const
 	if (!mLength) return -1;
 	if (start >= mLength) return -1;
 	if (start < 0) start = mLength-1;
+	if (charCompare() == stringCharCompareBinary) {
+		byte *p = ht_memrchr(mContent, start+1, c);
+		return p ? p-mContent : -1;
+	}
 	for (int i=start; i>=0; i--) {
 		if (compareChar(mContent[i], c) == 0) return i;
 	}
@@ -401,6 +467,31 @@ int String::findLastString(const String &s, int start) const
 	return -1;
 }
 
+/**
+ *	@returns hash of the string content (cached)
+ */
+uint64 String::hash() const
+{
+	// a racing thread at worst computes the same value again
+	uint64 h = mHash.load(std::memory_order_relaxed);
+	if (h == STRING_HASH_NONE) {
+		h = computeHash();
+		// the sentinel can't be cached
+		if (h == STRING_HASH_NONE) h = 1;
+		mHash.store(h, std::memory_order_relaxed);
+	}
+	return h;
+}
+
+/**
+ *	Computes the hash for hash(). Subclasses with a custom
+ *	compareChar() have to override this to stay consistent with compareTo().
+ */
+uint64 String::computeHash() const
+{
+	return ht_hash64(mContent, mLength);
+}
+
 /**
  *	inserts |s| at postion |pos| in string.
  */
@@ -438,24 +529,36 @@ ObjectID String::getObjectID() const
 	return OBJID_STRING;
 }
 
+/**
+ *	Sets the length of the string to |aNewSize| characters (content beyond
+ *	the old length is undefined). Never shrinks the capacity.
+ */
 void String::realloc(int aNewSize)
 {
+	if (aNewSize > mCapacity) growCapacity(aNewSize);
 	mLength = aNewSize;
-	mContent = (byte*)::realloc(mContent, mLength+1);
 	mContent[mLength] = 0;
-/*	if (mContent) {
-		if (aNewSize) {
-			mContent = (byte*)::realloc(mContent, aNewSize);
-		} else {
-			free(mContent);
-			mContent = NULL;
-		}
+	invalidateHash();
+}
+
+/**
+ *	Grows capacity to at least |aMinCapacity|, but at least by a factor of 1.5
+ */
+void String::growCapacity(int aMinCapacity)
+{
+	int newCapacity = mCapacity + mCapacity/2;
+	if (newCapacity < aMinCapacity) newCapacity = aMinCapacity;
+	byte *newContent;
+	if (mContent == mInline) {
+		newContent = (byte*)malloc(newCapacity+1);
+		if (!newContent) throw std::bad_alloc();
+		memcpy(newContent, mInline, mLength+1);
 	} else {
-		if (aNewSize) {
-			mContent = (byte*)malloc(aNewSize);
-		}
+		newContent = (byte*)::realloc(mContent, newCapacity+1);
+		if (!newContent) throw std::bad_alloc();
 	}
-	mLength = aNewSize;*/
+	mContent = newContent;
+	mCapacity = newCapacity;
 }
 
 /*bool String::regexMatch(const String &aRegEx, Container *resultStrings, int maxRegExMatches) const
@@ -483,6 +586,15 @@ void String::realloc(int aNewSize)
 	return result;
 }*/
 
+/**
+ *	Makes sure the string can hold |aCapacity| characters without
+ *	further reallocation.
+ */
+void String::reserve(int aCapacity)
+{
+	if (aCapacity > mCapacity) growCapacity(aCapacity);
+}
+
 /**
  *	replaces all occurences of |what| in string with |with|
  *	@param what searchstring
@@ -493,26 +605,37 @@ void String::realloc(int aNewSize)
  */
 int String::replace(const String &what, const String &with, int start, int maxReplacements)
 {
-	if (!maxReplacements) return 0;
-	int whatlen = what.length();
-	int withlen = with.length();
+	if (!maxReplacements || !what.mLength) return 0;
+	int whatlen = what.mLength;
+	int withlen = with.mLength;
 	int numRepl = 0;
 	int p = findFirstString(what, start);
-	while (p >= 0) {
-		if (whatlen == withlen) {
-			// replace in situ
+	if (p < 0) return 0;
+	if (whatlen == withlen) {
+		// replace in situ
+		invalidateHash();
+		do {
 			memmove(&mContent[p], with.mContent, withlen);
-		} else {
-			del(p, whatlen);
-			insert(with, p);
-		}
-		numRepl++;
-		if (maxReplacements > 0) {
-			maxReplacements--;
-			if (!maxReplacements) break;
-		}
-		p = findFirstString(what, p+withlen);
+			numRepl++;
+			if (numRepl == maxReplacements) break;
+			p = findFirstString(what, p+whatlen);
+		} while (p >= 0);
+		return numRepl;
 	}
+	// build the result in one pass
+	String result;
+	result.reserve(mLength);
+	int q = 0;
+	do {
+		result.append(&mContent[q], p-q);
+		result.append(with.mContent, withlen);
+		q = p+whatlen;
+		numRepl++;
+		if (numRepl == maxReplacements) break;
+		p = findFirstString(what, q);
+	} while (p >= 0);
+	result.append(&mContent[q], mLength-q);
+	assign(std::move(result));
 	return numRepl;
 }
 
@@ -553,6 +676,7 @@ int String::subString(int aStart, int aLength, String &result) const
  */
 void String::transformCase(StringCase c)
 {
+	invalidateHash();
 	if (c==stringCaseCaps) {
 	} else {
 		for (int i=0; i<mLength; i++) {
@@ -575,6 +699,7 @@ void String::translate(const String &inAlpha, const String &outAlpha)
 {
 	ASSERT(inAlpha.mLength == outAlpha.mLength);
 	if (inAlpha.isEmpty() || isEmpty()) return;
+	invalidateHash();
 	byte tr[256];
 	for (int i=0; i<256; i++) tr[i] = i;
 	for (int i=0; i<inAlpha.mLength; i++) {
@@ -597,39 +722,37 @@ int String::toArray(byte *buf, int buflen) const
 }
 
 /**
- *
+ *	Converts the string to an integer. Understands "0x" prefix and
+ *	PearPC suffix notation (see parseIntBuf()).
+ *	@returns false if the string isn't an integer or doesn't fit into 32 bit
  */
 bool String::toInt(int &i, int defaultbase) const
 {
-	const char *b = (const char*)mContent;
 	uint64 u64;
-	if (!parseIntStr(b, u64, defaultbase)) return false;
-	if (b-(const char*)mContent != mLength) return false;
+	if (!parseIntBuf((const char*)mContent, mLength, u64, defaultbase)) return false;
+	if (u64 > 0xffffffffULL) return false;
 	i = (sint64)u64;
 	return true;
 }
 
 /**
- *
+ *	like toInt()
  */
 bool String::toInt32(uint32 &u32, int defaultbase) const
 {
-	const char *b = (const char*)mContent;
 	uint64 u64;
-	if (!parseIntStr(b, u64, defaultbase)) return false;
-	if (b-(const char*)mContent != mLength) return false;
+	if (!parseIntBuf((const char*)mContent, mLength, u64, defaultbase)) return false;
+	if (u64 > 0xffffffffULL) return false;
 	u32 = u64;
 	return true;
 }
 
 /**
- *
+ *	like toInt(), but for 64 bit
  */
 bool String::toInt64(uint64 &u64, int defaultbase) const
 {
-	const char *b = (const char*)mContent;
-	if (!parseIntStr(b, u64, defaultbase)) return false;
-	return (b-(const char*)mContent == mLength);
+	return parseIntBuf((const char*)mContent, mLength, u64, defaultbase);
 }
 
 int String::toString(char *buf, int buflen) const
@@ -722,6 +845,21 @@ int IString::compareChar(char c1, char c2) const
 	return String::compareChar(c1, c2);
 }
 
+/*
+ *	hashes the lower case version, like compareChar() compares
+ */
+uint64 IString::computeHash() const
+{
+	String lower(*this);
+	lower.transformCase(stringCaseLower);
+	return ht_hash64(lower.content(), lower.length());
+}
+
+StringCharCompare IString::charCompare() const
+{
+	return stringCharCompareCaseFold;
+}
+
 bool IString::instanceOf(ObjectID id) const
 {
 	if (id == getObjectID()) return true;
@@ -22,32 +22,66 @@
 #ifndef __STR_H__
 #define __STR_H__
 
+#include <atomic>
+#include <utility>
+
 #include "data.h"
 
+/*
+ *	strings of up to this many characters are stored inside
+ *	the String object itself (no heap allocation)
+ */
+#define STRING_INLINE_CAPACITY		22
+
+/*
+ *	String::mHash of a string whose hash isn't computed yet
+ */
+#define STRING_HASH_NONE		0
+
 enum StringCase {
 	stringCaseLower,
 	stringCaseUpper,
 	stringCaseCaps
 };
 
+/*
+ *	how compareChar() compares, lets String use fast paths that
+ *	don't call compareChar() for each character
+ */
+enum StringCharCompare {
+	stringCharCompareCustom,
+	stringCharCompareBinary,
+	stringCharCompareCaseFold	// ASCII case-insensitive, only compareChar() knows about others
+};
+
 /**
  *	Class for easy string handling.
+ *	Keeps track of a capacity which grows geometrically, so appending
+ *	is amortized O(1). Short strings live in an inline buffer.
+ *	<i>hash()</i> is computed on first use and cached until the string is
+ *	modified (hashing a const String from several threads is safe). Modifications through <i>content()</i>, <i>at()</i> or
+ *	<i>operator []</i> aren't noticed, call <i>invalidateHash()</i> after those.
  */
 class String: public Object {
 protected:
 	int mLength;
+	int mCapacity;
 	byte *mContent;
+	mutable std::atomic<uint64> mHash;	// or STRING_HASH_NONE
+	byte mInline[STRING_INLINE_CAPACITY+1];
 public:
 				String();
 				String(const char *s);
 				String(const String *s);
 				String(const String &s);
+				String(String &&s) noexcept;
 				String(const byte *s, int aLength);
 				String(char c, int count = 1);
 	virtual			~String();
 
 		void		assign(const String *s);
 		void		assign(const String &s);
+		void		assign(String &&s) noexcept;
 		void		assign(const char *s);
 		void		assign(const byte *s, int aLength);
 		void		assign(char c, int count = 1);
@@ -55,8 +89,10 @@ public:
 
 		void		append(const String &s);
 		void		append(const char *s);
+		void		append(const byte *s, int aLength);
 		void		appendChar(char c);
 	inline	char &		at(int aIndex) const;
+	inline	int		capacity() const;
 	inline	bool		chop();
 		void		clear();
 	virtual	String *	clone() const;
@@ -74,12 +110,14 @@ public:
 	virtual	int		findLastChar(char c, int start = -1) const;
 	virtual	int		findLastString(const String &s, int start = -1) const;
 	inline	char		firstChar() const;
+	virtual	uint64		hash() const;
 		void		insert(const String &s, int pos);
 #ifdef HAVE_HT_OBJECTS
 	virtual	bool		instanceOf(ObjectID id) const;
 	inline	bool		isEmpty() const;
 	virtual	ObjectID	getObjectID() const;
 #endif
+	inline	void		invalidateHash();
 	inline	char		lastChar() const;
 	inline	int		length() const;
 		bool		leftSplit(char chr, String &initial, String &rem) const;
@@ -87,6 +125,7 @@ public:
 //		bool		regexMatch(const String &aRegEx, Container *resultStrings = NULL, int maxRegExMatches = 32) const;
 //		bool		regexReplace(const String &aRegEx, Container *resultStrings = NULL) const;
 		int		replace(const String &what, const String &with, int start = 0, int maxReplacements = -1);
+		void		reserve(int aCapacity);
 		bool		rightSplit(char chr, String &initial, String &rem) const;
 		int		subString(int aStart, int aLength, String &result) const;
 		void		transformCase(StringCase c);
@@ -102,6 +141,7 @@ public:
 	inline	char &	operator [](int aIndex) const;
 
 	inline	String &	operator =(const String &s);
+	inline	String &	operator =(String &&s) noexcept;
 	inline	String &	operator =(const char *s);
 	inline	String &	operator +=(const String &s);
 	inline	String &	operator +=(const char *s);
@@ -122,8 +162,14 @@ public:
 	inline	bool		operator !=(const char *s) const;
 
 protected:
+	virtual	StringCharCompare charCompare() const;
 		int		compare(const char *s) const;
+		int		compareContent(const byte *a, const byte *b, int len) const;
+	virtual	uint64		computeHash() const;
 		void		realloc(int aNewSize);
+private:
+	inline	void		initContent();
+		void		growCapacity(int aMinCapacity);
 };
 
 String operator +(const String &s1, const String &s2);
@@ -142,6 +188,9 @@ public:
 	virtual	bool		instanceOf(ObjectID id) const;
 	virtual	ObjectID	getObjectID() const;
 #endif
+protected:
+	virtual	StringCharCompare charCompare() const;
+	virtual	uint64		computeHash() const;
 };
 
 /*
@@ -160,6 +209,14 @@ inline char &String::at(int aIndex) const
 	return (char &)mContent[aIndex];
 }
 
+/**
+ *	@returns number of characters the string can hold without reallocation
+ */
+inline int String::capacity() const
+{
+	return mCapacity;
+}
+
 /**
  *	Removes the last character of the string if string length is non-zero.
  */
@@ -174,7 +231,8 @@ inline bool String::chop()
 }
 
 /**
- *	@returns a string content ptr
+ *	@returns a string content ptr (always 0-terminated, valid until the
+ *	next modification of the string)
  */
 inline byte *String::content() const
 {
@@ -198,6 +256,14 @@ inline char String::firstChar() const
 	return at(0);
 }
 
+/**
+ *	Forget the cached hash (needed after modifying the content directly).
+ */
+inline void String::invalidateHash()
+{
+	mHash.store(STRING_HASH_NONE, std::memory_order_relaxed);
+}
+
 /**
  *	@returns true if string is empty.
  */
@@ -223,6 +289,15 @@ inline int String::length() const
 	return mLength;
 }
 
+inline void String::initContent()
+{
+	mLength = 0;
+	mCapacity = STRING_INLINE_CAPACITY;
+	mContent = mInline;
+	invalidateHash();
+	mInline[0] = 0;
+}
+
 inline char &String::operator [](int aIndex) const
 {
 	return at(aIndex);
@@ -234,6 +309,12 @@ inline String &String::operator =(const String &s)
 	return *this;
 }
 
+inline String &String::operator =(String &&s) noexcept
+{
+	assign(std::move(s));
+	return *this;
+}
+
 inline String &String::operator =(const char *s)
 {
 	assign(s);
@@ -0,0 +1,239 @@
+/*
+ *	PearBox
+ *	strbuilder.cc
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "snprintf.h"
+#include "strbuilder.h"
+
+extern char hexchars[17];
+
+/*
+ *	flush() writes up to this many chunks with one writev()
+ */
+#define STRINGBUILDER_FLUSH_IOV		32
+
+StringBuilder::StringBuilder()
+{
+	mFirst = mLast = NULL;
+	mLength = 0;
+	mNextChunkSize = STRINGBUILDER_CHUNK_MIN;
+}
+
+StringBuilder::~StringBuilder()
+{
+	Chunk *c = mFirst;
+	while (c) {
+		Chunk *next = c->next;
+		free(c);
+		c = next;
+	}
+}
+
+/*
+ *	appends a new chunk with room for at least |minSize| bytes
+ */
+StringBuilder::Chunk *StringBuilder::newChunk(uint minSize)
+{
+	uint size = MAX(mNextChunkSize, minSize);
+	Chunk *c = (Chunk *)malloc(offsetof(Chunk, data) + size);
+	if (!c) throw std::bad_alloc();
+	c->next = NULL;
+	c->size = size;
+	c->used = 0;
+	if (mLast) {
+		mLast->next = c;
+	} else {
+		mFirst = c;
+	}
+	mLast = c;
+	if (mNextChunkSize < STRINGBUILDER_CHUNK_MAX) mNextChunkSize *= 2;
+	return c;
+}
+
+/*
+ *	@returns pointer to |size| contiguous bytes at the end of the text
+ *	(the caller has to account for them)
+ */
+byte *StringBuilder::reserve(uint size)
+{
+	Chunk *c = mLast;
+	if (!c || c->size - c->used < size) c = newChunk(size);
+	return c->data + c->used;
+}
+
+StringBuilder &StringBuilder::append(const byte *buf, uint len)
+{
+	while (len) {
+		Chunk *c = mLast;
+		if (!c || c->used == c->size) c = newChunk(len);
+		uint n = MIN(len, c->size - c->used);
+		memcpy(c->data + c->used, buf, n);
+		c->used += n;
+		mLength += n;
+		buf += n;
+		len -= n;
+	}
+	return *this;
+}
+
+StringBuilder &StringBuilder::append(const String &s)
+{
+	return append(s.content(), s.length());
+}
+
+StringBuilder &StringBuilder::append(const char *s)
+{
+	if (s) append((const byte *)s, strlen(s));
+	return *this;
+}
+
+StringBuilder &StringBuilder::appendChar(char c)
+{
+	Chunk *l = mLast;
+	if (!l || l->used == l->size) l = newChunk(1);
+	l->data[l->used++] = c;
+	mLength++;
+	return *this;
+}
+
+StringBuilder &StringBuilder::appendChar(char c, uint count)
+{
+	while (count) {
+		Chunk *l = mLast;
+		if (!l || l->used == l->size) l = newChunk(count);
+		uint n = MIN(count, l->size - l->used);
+		memset(l->data + l->used, c, n);
+		l->used += n;
+		mLength += n;
+		count -= n;
+	}
+	return *this;
+}
+
+StringBuilder &StringBuilder::appendInt(sint64 i)
+{
+	if (i < 0) {
+		appendChar('-');
+		return appendUInt(-(uint64)i);
+	}
+	return appendUInt(i);
+}
+
+StringBuilder &StringBuilder::appendUInt(uint64 u)
+{
+	byte buf[20];
+	byte *p = buf + sizeof buf;
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	return append(p, buf + sizeof buf - p);
+}
+
+StringBuilder &StringBuilder::appendHex(uint64 u, int digits)
+{
+	byte buf[16];
+	byte *p = buf + sizeof buf;
+	do {
+		*--p = hexchars[u & 0xf];
+		u >>= 4;
+	} while (u);
+	int n = buf + sizeof buf - p;
+	if (digits > n) appendChar('0', digits - n);
+	return append(p, n);
+}
+
+StringBuilder &StringBuilder::appendFormat(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	appendVFormat(fmt, args);
+	va_end(args);
+	return *this;
+}
+
+StringBuilder &StringBuilder::appendVFormat(const char *fmt, va_list args)
+{
+	/*
+	 *	format directly into the last chunk, if the result
+	 *	(possibly) doesn't fit, retry with more room
+	 */
+	uint size = mLast ? mLast->size - mLast->used : 0;
+	if (size < 64) size = 64;
+	while (true) {
+		byte *buf = reserve(size);
+		va_list a;
+		va_copy(a, args);
+		uint r = ht_vsnprintf((char *)buf, size, fmt, a);
+		va_end(a);
+		if (r < size-1) {
+			mLast->used += r;
+			mLength += r;
+			return *this;
+		}
+		size *= 2;
+	}
+}
+
+void StringBuilder::clear()
+{
+	if (!mFirst) return;
+	Chunk *c = mFirst->next;
+	while (c) {
+		Chunk *next = c->next;
+		free(c);
+		c = next;
+	}
+	mFirst->next = NULL;
+	mFirst->used = 0;
+	mLast = mFirst;
+	mLength = 0;
+}
+
+uint StringBuilder::flush(Stream &stream)
+{
+	uint r = mLength;
+	struct iovec iov[STRINGBUILDER_FLUSH_IOV];
+	int n = 0;
+	for (Chunk *c = mFirst; c; c = c->next) {
+		if (!c->used) continue;
+		iov[n].iov_base = c->data;
+		iov[n].iov_len = c->used;
+		if (++n == STRINGBUILDER_FLUSH_IOV) {
+			stream.writevx(iov, n);
+			n = 0;
+		}
+	}
+	if (n) stream.writevx(iov, n);
+	clear();
+	return r;
+}
+
+String &StringBuilder::toString(String &result) const
+{
+	result.clear();
+	result.reserve(mLength);
+	for (Chunk *c = mFirst; c; c = c->next) {
+		result.append(c->data, c->used);
+	}
+	return result;
+}
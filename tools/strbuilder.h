@@ -0,0 +1,116 @@
+/*
+ *	PearBox
+ *	strbuilder.h
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License version 2 as
+ *	published by the Free Software Foundation.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef __STRBUILDER_H__
+#define __STRBUILDER_H__
+
+#include <stdarg.h>
+
+#include "str.h"
+#include "stream.h"
+
+/*
+ *	chunk sizes start at STRINGBUILDER_CHUNK_MIN and double
+ *	up to STRINGBUILDER_CHUNK_MAX
+ */
+#define STRINGBUILDER_CHUNK_MIN		256
+#define STRINGBUILDER_CHUNK_MAX		(64*1024)
+
+/**
+ *	Builds large texts piece by piece.
+ *	The text is kept in a list of chunks, so appending never moves
+ *	what has been appended before. Use <i>flush()</i> to write the text
+ *	to a stream or <i>toString()</i> to get it as one String.
+ */
+class StringBuilder {
+	struct Chunk {
+		Chunk *next;
+		uint size;
+		uint used;
+		byte data[1];
+	};
+
+	Chunk *mFirst;
+	Chunk *mLast;
+	uint mLength;
+	uint mNextChunkSize;
+
+		Chunk *		newChunk(uint minSize);
+		byte *		reserve(uint size);
+
+				StringBuilder(const StringBuilder &);		// not implemented
+	StringBuilder &		operator =(const StringBuilder &);		// not implemented
+public:
+				StringBuilder();
+				~StringBuilder();
+
+		StringBuilder &	append(const String &s);
+		StringBuilder &	append(const char *s);
+		StringBuilder &	append(const byte *buf, uint len);
+		StringBuilder &	appendChar(char c);
+		StringBuilder &	appendChar(char c, uint count);
+/**
+ *	Appends |i| in decimal.
+ */
+		StringBuilder &	appendInt(sint64 i);
+/**
+ *	Appends |u| in decimal.
+ */
+		StringBuilder &	appendUInt(uint64 u);
+/**
+ *	Appends |u| in (lower case) hex, without prefix.
+ *	@param digits minimum number of digits (zero padded)
+ */
+		StringBuilder &	appendHex(uint64 u, int digits = 0);
+/**
+ *	Appends text formatted like ht_printf() does.
+ */
+		StringBuilder &	appendFormat(const char *fmt, ...);
+		StringBuilder &	appendVFormat(const char *fmt, va_list args);
+/**
+ *	Empties the builder (keeps the first chunk for reuse).
+ */
+		void		clear();
+/**
+ *	Writes the text to |stream| and empties the builder.
+ *	@returns number of bytes written
+ */
+		uint		flush(Stream &stream);
+	inline	bool		isEmpty() const;
+	inline	uint		length() const;
+/**
+ *	Assigns the text to |result| (with a single allocation).
+ */
+		String &	toString(String &result) const;
+};
+
+/*
+ *	inline functions
+ */
+
+inline bool StringBuilder::isEmpty() const
+{
+	return mLength == 0;
+}
+
+inline uint StringBuilder::length() const
+{
+	return mLength;
+}
+
+#endif /* __STRBUILDER_H__ */
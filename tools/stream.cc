@@ -25,10 +25,27 @@
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
+#include <stdint.h>
+#include <sys/mman.h>
 #include <sys/stat.h>	/* for mode definitions */
 #include <sys/types.h>	/* for mode definitions */
 #include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#define HAVE_SENDFILE
+#if __GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27)
+#define HAVE_COPY_FILE_RANGE
+#endif
+#endif
 
+#include "crc32c.h"
 #include "debug.h"
 #include "except.h"
 #include "sys.h"
@@ -62,6 +79,8 @@ public:
  *	Stream
  */
 #define STREAM_COPYBUF_SIZE	(64*1024)
+// readv()/writev() fallbacks gather smaller requests into one read()/write()
+#define STREAM_GATHER_SIZE	(4*1024)
 
 Stream::Stream()
 {
@@ -208,6 +227,73 @@ void Stream::readx(void *buf, uint size)
 		throw IOException(EIO);
 	}	    
 }
+
+static size_t iovSize(const struct iovec *iov, int iovcnt)
+{
+	size_t r = 0;
+	for (int i = 0; i < iovcnt; i++) r += iov[i].iov_len;
+	return r;
+}
+
+/*
+ *	reads into |iov| with one read() per buffer, until one comes up short
+ */
+static uint readPieces(Stream *stream, const struct iovec *iov, int iovcnt)
+{
+	uint r = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		uint k = stream->read(iov[i].iov_base, iov[i].iov_len);
+		r += k;
+		if (k != iov[i].iov_len) break;
+	}
+	return r;
+}
+
+/*
+ *	writes |iov| with one write() per buffer, until one comes up short
+ */
+static uint writePieces(Stream *stream, const struct iovec *iov, int iovcnt)
+{
+	uint r = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		uint k = stream->write(iov[i].iov_base, iov[i].iov_len);
+		r += k;
+		if (k != iov[i].iov_len) break;
+	}
+	return r;
+}
+
+/**
+ *	Scatter read from stream.
+ *	Read into the <i>iovcnt</i> buffers described by <i>iov</i>, one
+ *	after the other. Like <i>read()</i>, less than requested is read
+ *	on (temporary) end-of-file. The default implementation reads small
+ *	requests in one piece and scatters them, streams that can do better
+ *	(like <i>LocalFileFD</i>) override this.
+ *
+ *	@param iov array of buffers
+ *	@param iovcnt number of buffers
+ *	@returns number of bytes read
+ *	@throws IOException
+ */
+uint Stream::readv(const struct iovec *iov, int iovcnt)
+{
+	if (iovcnt == 1) return read(iov[0].iov_base, iov[0].iov_len);
+	size_t total = iovSize(iov, iovcnt);
+	uint r = 0;
+	if (total <= STREAM_GATHER_SIZE) {
+		byte buf[STREAM_GATHER_SIZE];
+		uint n = read(buf, total);
+		for (int i = 0; i < iovcnt && r < n; i++) {
+			uint k = MIN(iov[i].iov_len, n - r);
+			memcpy(iov[i].iov_base, buf + r, k);
+			r += k;
+		}
+	} else {
+		r = readPieces(this, iov, iovcnt);
+	}
+	return r;
+}
 /*
 void Stream::removeEventListener(StreamEventListener *l)
 {
@@ -246,6 +332,48 @@ void Stream::writex(const void *buf, uint size)
 	if (write(buf, size) != size) throw IOException(EIO);
 }
 
+/**
+ *	Gather write to stream.
+ *	Write the <i>iovcnt</i> buffers described by <i>iov</i>, one after
+ *	the other, like a single <i>write()</i> of their concatenation.
+ *	The default implementation concatenates small requests and writes
+ *	them in one piece, streams that can do better (like
+ *	<i>LocalFileFD</i>) override this.
+ *
+ *	@param iov array of buffers
+ *	@param iovcnt number of buffers
+ *	@returns number of bytes written
+ *	@throws IOException
+ */
+uint Stream::writev(const struct iovec *iov, int iovcnt)
+{
+	if (iovcnt == 1) return write(iov[0].iov_base, iov[0].iov_len);
+	size_t total = iovSize(iov, iovcnt);
+	if (total <= STREAM_GATHER_SIZE) {
+		byte buf[STREAM_GATHER_SIZE];
+		uint n = 0;
+		for (int i = 0; i < iovcnt; i++) {
+			memcpy(buf + n, iov[i].iov_base, iov[i].iov_len);
+			n += iov[i].iov_len;
+		}
+		return write(buf, n);
+	}
+	return writePieces(this, iov, iovcnt);
+}
+
+/**
+ *	Exact gather write to stream, see <i>writev()</i>.
+ *	If less than all bytes are written, IOException is thrown.
+ *
+ *	@param iov array of buffers
+ *	@param iovcnt number of buffers
+ *	@throws IOException
+ */
+void Stream::writevx(const struct iovec *iov, int iovcnt)
+{
+	if (writev(iov, iovcnt) != iovSize(iov, iovcnt)) throw IOException(EIO);
+}
+
 /*
  *   StreamLayer
  */
@@ -281,11 +409,21 @@ uint StreamLayer::read(void *buf, uint size)
 	return mStream->read(buf, size);
 }
 
+uint StreamLayer::readv(const struct iovec *iov, int iovcnt)
+{
+	return mStream->readv(iov, iovcnt);
+}
+
 uint StreamLayer::write(const void *buf, uint size)
 {
 	return mStream->write(buf, size);
 }
 
+uint StreamLayer::writev(const struct iovec *iov, int iovcnt)
+{
+	return mStream->writev(iov, iovcnt);
+}
+
 Stream *StreamLayer::getLayered() const
 {
 	return mStream;
@@ -307,6 +445,12 @@ File::File()
 }
 
 #define FILE_TRANSFER_BUFSIZE 4*1024
+// fileMove() moves chunks of this size (per thread)
+#define FILE_MOVE_BUFSIZE (1024*1024)
+// max. size of a wave of chunks moved in parallel
+#define FILE_MOVE_WAVE (64*1024*1024)
+// threads used by LocalFileFD for moving data
+#define FILE_MOVE_THREADS 4
 /**
  *	Low-level control function.
  *	@param cmd file control command number
@@ -321,37 +465,139 @@ int File::cntl(uint cmd, ...)
 	return ret;
 }
 
-void fileMove(File *file, FileOfs src, FileOfs dest, FileOfs size)
-{
-	if (dest < src) {
-		char tbuf[FILE_TRANSFER_BUFSIZE];
-		while (size != 0) {
-			FileOfs k = size;
-			if (k > sizeof tbuf) k = sizeof tbuf;
-			file->seek(src);
-			file->readx(tbuf, k);
-			file->seek(dest);
-			file->writex(tbuf, k);
+/*
+ *	moves |size| bytes chunkwise, from the top down if |up|
+ */
+static void fileMoveChunks(File *file, FileOfs src, FileOfs dest, FileOfs size, byte *buf, bool up)
+{
+	while (size) {
+		uint k = MIN(size, FILE_MOVE_BUFSIZE);
+		FileOfs o = up ? size - k : 0;
+		file->readAtx(src + o, buf, k);
+		file->writeAtx(dest + o, buf, k);
+		if (!up) {
 			src += k;
 			dest += k;
-			size -= k;
 		}
-	} else if (dest > src) {
-		src += size;
-		dest += size;
-		char tbuf[FILE_TRANSFER_BUFSIZE];
-		while (size != 0) {
-			FileOfs k = size;
-			if (k > sizeof tbuf) k = sizeof tbuf;
-			src -= k;
-			dest -= k;
-			file->seek(src);
-			file->readx(tbuf, k);
-			file->seek(dest);
-			file->writex(tbuf, k);
-			size -= k;
+		size -= k;
+	}
+}
+
+/*
+ *	lets fileMove()'s workers wait for each other, once start()ed
+ */
+class FileMoveBarrier {
+	std::mutex mMutex;
+	std::condition_variable mCond;
+	size_t mCount;
+	size_t mWaiting;
+	uint mGeneration;
+public:
+	FileMoveBarrier()
+	{
+		mCount = 0;
+		mWaiting = 0;
+		mGeneration = 0;
+	}
+
+	/*
+	 *	releases the first wait() of all |count| threads
+	 */
+	void start(size_t count)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mCount = count;
+		release();
+	}
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		uint generation = mGeneration;
+		mWaiting++;
+		if (!release()) {
+			mCond.wait(lock, [&] { return mGeneration != generation; });
+		}
+	}
+private:
+	bool release()
+	{
+		if (!mCount || mWaiting < mCount) return false;
+		mWaiting = 0;
+		mGeneration++;
+		mCond.notify_all();
+		return true;
+	}
+};
+
+/**
+ *	Move |size| bytes inside of |file| from |src| to |dest| (the ranges
+ *	may overlap). The file pointer is not used.
+ *
+ *	With |threads| > 1 and ranges far enough apart, the data is moved in
+ *	waves of at most |src|-|dest| bytes (so a wave doesn't read what it
+ *	writes), each split between |threads| threads that are started
+ *	once and wait for each other between waves. This requires a
+ *	thread-safe <i>readAt()</i>/<i>writeAt()</i>, like LocalFileFD's.
+ *
+ *	@throws IOException
+ */
+void fileMove(File *file, FileOfs src, FileOfs dest, FileOfs size, int threads)
+{
+	if (src == dest || !size) return;
+	bool up = dest > src;
+	FileOfs wave = MIN(up ? dest - src : src - dest, (FileOfs)FILE_MOVE_WAVE);
+	if (threads < 2 || wave < 2*FILE_MOVE_BUFSIZE || size < 2*FILE_MOVE_BUFSIZE) threads = 1;
+	byte *buf = (byte*)malloc((size_t)threads * FILE_MOVE_BUFSIZE);
+	if (!buf) throw std::bad_alloc();
+	if (threads == 1) {
+		try {
+			fileMoveChunks(file, src, dest, size, buf, up);
+		} catch (...) {
+			free(buf);
+			throw;
+		}
+		free(buf);
+		return;
+	}
+	FileMoveBarrier barrier;
+	std::atomic<int> error(0);
+	auto worker = [&](int i) {
+		barrier.wait();	// until all workers are started
+		for (FileOfs done = 0; done < size; done += wave) {
+			FileOfs w = MIN(wave, size - done);
+			FileOfs o = up ? size - done - w : done;
+			FileOfs part = (w + threads - 1) / threads;
+			if (!error && i*part < w) {
+				FileOfs po = o + i*part;
+				FileOfs pl = MIN(part, w - i*part);
+				try {
+					fileMoveChunks(file, src + po, dest + po, pl, buf + (size_t)i * FILE_MOVE_BUFSIZE, up);
+				} catch (const IOException &e) {
+					error = e.mPosixErrno ? e.mPosixErrno : EIO;
+				} catch (...) {
+					error = EIO;
+				}
+			}
+			// the next wave overwrites what this one reads
+			barrier.wait();
 		}
+	};
+	std::vector<std::thread> workers;
+	std::exception_ptr spawnError;
+	try {
+		workers.reserve(threads);
+		for (int i = 0; i < threads; i++) workers.emplace_back(worker, i);
+	} catch (...) {
+		// the started workers walk the waves without moving anything
+		spawnError = std::current_exception();
+		error = EAGAIN;
 	}
+	barrier.start(workers.size());
+	for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+	free(buf);
+	if (spawnError) std::rethrow_exception(spawnError);
+	if (error) throw IOException(error);
 }
 
 /**
@@ -470,6 +716,44 @@ void File::pstat(pstat_t &s) const
 	s.caps = 0;
 }
 
+/**
+ *	Read from file at a given position.
+ *	Reads up to <i>size</i> bytes at <i>offset</i> into <i>buf</i>,
+ *	without using or modifying the current file pointer. Files that
+ *	override this (like <i>LocalFileFD</i>) can be read from several
+ *	threads at once, the default implementation seeks and is not
+ *	thread-safe.
+ *
+ *	@param offset file position to read from
+ *	@param buf pointer to buffer that receives the data
+ *	@param size number of bytes to read
+ *	@returns number of bytes read
+ *	@throws IOException
+ */
+uint File::readAt(FileOfs offset, void *buf, uint size)
+{
+	FileOfs t = tell();
+	uint r;
+	try {
+		seek(offset);
+		r = read(buf, size);
+	} catch (...) {
+		seek(t);
+		throw;
+	}
+	seek(t);
+	return r;
+}
+
+/**
+ *	Read exactly <i>size</i> bytes at <i>offset</i>, see <i>readAt()</i>.
+ *	@throws IOException
+ */
+void File::readAtx(FileOfs offset, void *buf, uint size)
+{
+	if (readAt(offset, buf, size) != size) throw IOException(EIO);
+}
+
 /**
  *	Set current file pointer.
  *	@param offset new value for current file pointer
@@ -519,6 +803,41 @@ int File::vcntl(uint cmd, va_list vargs)
 	return ENOSYS;
 }
 
+/**
+ *	Write to file at a given position.
+ *	Writes <i>size</i> bytes from <i>buf</i> at <i>offset</i>, without
+ *	using or modifying the current file pointer (see <i>readAt()</i>).
+ *
+ *	@param offset file position to write to
+ *	@param buf pointer to buffer that holds at least <i>size</i> bytes
+ *	@param size number of bytes to write
+ *	@returns number of bytes written
+ *	@throws IOException
+ */
+uint File::writeAt(FileOfs offset, const void *buf, uint size)
+{
+	FileOfs t = tell();
+	uint r;
+	try {
+		seek(offset);
+		r = write(buf, size);
+	} catch (...) {
+		seek(t);
+		throw;
+	}
+	seek(t);
+	return r;
+}
+
+/**
+ *	Write exactly <i>size</i> bytes at <i>offset</i>, see <i>writeAt()</i>.
+ *	@throws IOException
+ */
+void File::writeAtx(FileOfs offset, const void *buf, uint size)
+{
+	if (writeAt(offset, buf, size) != size) throw IOException(EIO);
+}
+
 /*
  *	FileLayer
  */
@@ -578,6 +897,16 @@ uint FileLayer::read(void *buf, uint size)
 	return mFile->read(buf, size);
 }
 
+uint FileLayer::readAt(FileOfs offset, void *buf, uint size)
+{
+	return mFile->readAt(offset, buf, size);
+}
+
+uint FileLayer::readv(const struct iovec *iov, int iovcnt)
+{
+	return mFile->readv(iov, iovcnt);
+}
+
 void FileLayer::seek(FileOfs offset)
 {
 	return mFile->seek(offset);
@@ -619,11 +948,58 @@ uint FileLayer::write(const void *buf, uint size)
 	return mFile->write(buf, size);
 }
 
-#if 0
+uint FileLayer::writeAt(FileOfs offset, const void *buf, uint size)
+{
+	return mFile->writeAt(offset, buf, size);
+}
+
+uint FileLayer::writev(const struct iovec *iov, int iovcnt)
+{
+	return mFile->writev(iov, iovcnt);
+}
+
 /*
  *	LocalFileFD
  */
 
+// largest piece handed to copy_file_range()/sendfile() at once
+#define LOCALFILEFD_COPY_CHUNK	(1024*1024*1024)
+
+/*
+ *	pread()/pwrite() until done, end of file or error
+ */
+static uint preadFull(int fd, void *aBuf, uint size, FileOfs ofs)
+{
+	byte *buf = (byte*)aBuf;
+	uint r = 0;
+	while (r < size) {
+		ssize_t k = ::pread(fd, buf + r, size - r, ofs + r);
+		if (k < 0) {
+			if (errno == EINTR) continue;
+			throw IOException(errno);
+		}
+		if (!k) break;
+		r += k;
+	}
+	return r;
+}
+
+static uint pwriteFull(int fd, const void *aBuf, uint size, FileOfs ofs)
+{
+	const byte *buf = (const byte*)aBuf;
+	uint r = 0;
+	while (r < size) {
+		ssize_t k = ::pwrite(fd, buf + r, size - r, ofs + r);
+		if (k < 0) {
+			if (errno == EINTR) continue;
+			throw IOException(errno);
+		}
+		if (!k) break;
+		r += k;
+	}
+	return r;
+}
+
 /**
  *	create open file
  */
@@ -632,7 +1008,9 @@ LocalFileFD::LocalFileFD(const String &aFilename, IOAccessMode am, FileOpenMode
 {
 	mOpenMode = om;
 	fd = -1;
+	plainFd = -1;
 	own_fd = false;
+	offset = 0;
 	int e = setAccessMode(am);
 	if (e) throw IOException(e);
 	mOpenMode = FOM_EXISTS;
@@ -646,8 +1024,12 @@ LocalFileFD::LocalFileFD(int f, bool own_f, IOAccessMode am)
 {
 	mFilename = NULL;
 	fd = f;
+	plainFd = -1;
 	own_fd = own_f;
-	offset = 0;
+	off_t o = ::lseek(fd, 0, SEEK_CUR);
+	offset = (o == (off_t)-1) ? 0 : o;
+	// can't reopen |fd| without O_DIRECT
+	if (am & IOAM_DIRECT) throw IOException(EINVAL);
 	int e = File::setAccessMode(am);
 	if (e) throw IOException(e);
 }
@@ -655,6 +1037,247 @@ LocalFileFD::LocalFileFD(int f, bool own_f, IOAccessMode am)
 LocalFileFD::~LocalFileFD()
 {
 	if (own_fd && (fd>=0)) ::close(fd);
+	if (plainFd >= 0) ::close(plainFd);
+}
+
+/*
+ *	copies |size| bytes (less on end of file) from |sfd| at |sofs| to
+ *	|dfd| at |dofs|, preferably without leaving the kernel
+ */
+static FileOfs copyFdRange(int sfd, FileOfs sofs, int dfd, FileOfs dofs, FileOfs size)
+{
+	enum { VIA_COPY_FILE_RANGE, VIA_SENDFILE, VIA_BUFFER } via;
+#if defined(HAVE_COPY_FILE_RANGE)
+	via = VIA_COPY_FILE_RANGE;
+#elif defined(HAVE_SENDFILE)
+	via = VIA_SENDFILE;
+#else
+	via = VIA_BUFFER;
+#endif
+	byte *buf = NULL;
+	FileOfs r = 0;
+	while (r < size) {
+		size_t k = MIN(size - r, (FileOfs)LOCALFILEFD_COPY_CHUNK);
+		ssize_t c;
+		switch (via) {
+#ifdef HAVE_COPY_FILE_RANGE
+		case VIA_COPY_FILE_RANGE: {
+			loff_t si = sofs + r, di = dofs + r;
+			c = ::copy_file_range(sfd, &si, dfd, &di, k, 0);
+			// not supported (by kernel or file systems)
+			if (c < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+				via = VIA_SENDFILE;
+				continue;
+			}
+			break;
+		}
+#endif
+#ifdef HAVE_SENDFILE
+		case VIA_SENDFILE: {
+			// sendfile() writes at (and moves) the file pointer of |dfd|
+			off_t si = sofs + r;
+			if (::lseek(dfd, dofs + r, SEEK_SET) == (off_t)-1) {
+				c = -1;
+				break;
+			}
+			c = ::sendfile(dfd, sfd, &si, k);
+			if (c < 0 && (errno == ENOSYS || errno == EINVAL)) {
+				via = VIA_BUFFER;
+				continue;
+			}
+			break;
+		}
+#endif
+		default:
+			if (!buf) {
+				buf = (byte*)malloc(STREAM_COPYBUF_SIZE);
+				if (!buf) throw std::bad_alloc();
+			}
+			c = ::pread(sfd, buf, MIN(k, STREAM_COPYBUF_SIZE), sofs + r);
+			if (c > 0) {
+				ssize_t w = 0;
+				while (w < c) {
+					ssize_t x = ::pwrite(dfd, buf + w, c - w, dofs + r + w);
+					if (x < 0 && errno == EINTR) continue;
+					if (x <= 0) {
+						int e = x ? errno : EIO;
+						free(buf);
+						throw IOException(e);
+					}
+					w += x;
+				}
+			}
+		}
+		if (c < 0) {
+			if (errno == EINTR) continue;
+			int e = errno;
+			free(buf);
+			throw IOException(e);
+		}
+		if (!c) break;
+		r += c;
+	}
+	free(buf);
+	return r;
+}
+
+/*
+ *	copies up to |count| bytes from the file pointer to the file pointer
+ *	of |dest| (file descriptor |dfd|). Holes in the source are skipped
+ *	where they would be written beyond the end of |dest|, so they
+ *	stay holes.
+ */
+FileOfs LocalFileFD::copyFdTo(LocalFileFD *dest, int dfd, FileOfs count)
+{
+	FileOfs end = getSize();
+	FileOfs s = offset;
+	if (s >= end) return 0;
+	if (count < end - s) end = s + count;
+	FileOfs d = dest->offset;
+	FileOfs dsize = dest->getSize();
+	while (s < end) {
+		FileOfs data = s, hole = end;
+#ifdef SEEK_DATA
+		off_t k = ::lseek(fd, s, SEEK_DATA);
+		if (k != (off_t)-1) {
+			data = MIN((FileOfs)k, end);
+			k = ::lseek(fd, data, SEEK_HOLE);
+			if (k != (off_t)-1) hole = MIN((FileOfs)k, end);
+		} else if (errno == ENXIO) {
+			// only a hole left
+			data = end;
+		}
+#endif
+		if (data > s) {
+			// the part of the hole inside of |dest| has to be written
+			FileOfs n = 0;
+			if (d < dsize) n = MIN(data - s, dsize - d);
+			if (n && copyFdRange(fd, s, dfd, d, n) != n) break;
+			d += data - s;
+			s = data;
+		}
+		if (s < hole) {
+			FileOfs n = copyFdRange(fd, s, dfd, d, hole - s);
+			s += n;
+			d += n;
+			if (s != hole) break;
+		}
+	}
+	if (d > dsize) {
+		int e = sys_truncate_fd(dfd, d);
+		if (e) throw IOException(e);
+	}
+	FileOfs r = s - offset;
+	// the file pointers may have been moved by sendfile()/SEEK_DATA
+	offset = ::lseek(fd, s, SEEK_SET);
+	dest->offset = ::lseek(dfd, d, SEEK_SET);
+	return r;
+}
+
+/*
+ *	the destination of a copy in the kernel: an unlayered LocalFileFD
+ *	(cropping, buffering, mmap or stdio layers would be bypassed)
+ *	open for writing, but not for appending, neither file in
+ *	IOAM_DIRECT mode
+ */
+LocalFileFD *LocalFileFD::copyTarget(Stream *stream, int &dfd)
+{
+	LocalFileFD *dest = dynamic_cast<LocalFileFD*>(stream);
+	if (!dest || dest == this) return NULL;
+	// O_DIRECT descriptors would need aligned transfers
+	if (plainFd >= 0 || dest->plainFd >= 0) return NULL;
+	if (!(getAccessMode() & IOAM_READ) || !(dest->getAccessMode() & IOAM_WRITE)) return NULL;
+	if (dest->cntl(FCNTL_GET_FD, &dfd)) return NULL;
+	int fl = ::fcntl(dfd, F_GETFL);
+	if (fl == -1 || (fl & O_APPEND)) return NULL;
+	return dest;
+}
+
+/**
+ *	Copies in the kernel (copy_file_range() or sendfile()) if |stream|
+ *	is a LocalFileFD too, keeping holes of the source as far as possible.
+ */
+uint LocalFileFD::copyAllTo(Stream *stream)
+{
+	int dfd;
+	LocalFileFD *dest = copyTarget(stream, dfd);
+	if (!dest) return File::copyAllTo(stream);
+	return copyFdTo(dest, dfd, getSize());
+}
+
+/**
+ *	see copyAllTo()
+ */
+uint LocalFileFD::copyTo(Stream *stream, uint count)
+{
+	int dfd;
+	LocalFileFD *dest = copyTarget(stream, dfd);
+	if (!dest) return File::copyTo(stream, count);
+	return copyFdTo(dest, dfd, count);
+}
+
+/**
+ *	Removes the range in place (fallocate() with FALLOC_FL_COLLAPSE_RANGE)
+ *	if offset and size are multiples of the file system block size and
+ *	the file system supports it, otherwise moves the data behind it with
+ *	several threads.
+ */
+void LocalFileFD::del(uint size)
+{
+	if (!(getAccessMode() & IOAM_WRITE)) throw IOException(EACCES);
+	FileOfs t = offset;
+	FileOfs fsize = getSize();
+	if (t+size > fsize) throw IOException(EINVAL);
+	if (t+size < fsize && !shiftRange(t, size, true)) {
+		fileMove(this, t+size, t, fsize-t-size, FILE_MOVE_THREADS);
+	}
+	truncate(fsize-size);
+}
+
+/*
+ *	O_DIRECT transfers need aligned memory, offsets and sizes. The aligned
+ *	middle of a request goes to |fd|, unaligned heads and tails (and
+ *	requests whose memory can't be aligned with the offset) to |plainFd|,
+ *	the same file opened without O_DIRECT.
+ */
+static bool directSplit(FileOfs ofs, const void *buf, uint size, uint &head, uint &middle)
+{
+	if (((uintptr_t)buf - ofs) % DIRECT_IO_ALIGN) return false;
+	head = MIN(size, (DIRECT_IO_ALIGN - ofs % DIRECT_IO_ALIGN) % DIRECT_IO_ALIGN);
+	middle = (size - head) & ~(DIRECT_IO_ALIGN - 1);
+	return middle != 0;
+}
+
+uint LocalFileFD::directRead(FileOfs ofs, void *aBuf, uint size)
+{
+	byte *buf = (byte*)aBuf;
+	uint head, middle;
+	if (!directSplit(ofs, buf, size, head, middle)) return preadFull(plainFd, buf, size, ofs);
+	uint r = 0;
+	if (head) {
+		r = preadFull(plainFd, buf, head, ofs);
+		if (r != head) return r;
+	}
+	uint k = preadFull(fd, buf + r, middle, ofs + r);
+	r += k;
+	if (k != middle || r == size) return r;
+	return r + preadFull(plainFd, buf + r, size - r, ofs + r);
+}
+
+uint LocalFileFD::directWrite(FileOfs ofs, const void *aBuf, uint size)
+{
+	const byte *buf = (const byte*)aBuf;
+	uint head, middle;
+	if (!directSplit(ofs, buf, size, head, middle)) return pwriteFull(plainFd, buf, size, ofs);
+	uint r = 0;
+	if (head) {
+		r = pwriteFull(plainFd, buf, head, ofs);
+		if (r != head) return r;
+	}
+	uint k = pwriteFull(fd, buf + r, middle, ofs + r);
+	r += k;
+	if (k != middle || r == size) return r;
+	return r + pwriteFull(plainFd, buf + r, size - r, ofs + r);
 }
 
 String &LocalFileFD::getDesc(String &result) const
@@ -671,42 +1294,99 @@ String &LocalFileFD::getFilename(String &result) const
 
 FileOfs LocalFileFD::getSize() const
 {
-	uint t = tell();
-	uint r = ::lseek(fd, 0, SEEK_END);
-	lseek(fd, t, SEEK_SET);
-	return r;
+	// fstat instead of seeking, so it can be used concurrently with readAt()
+	pstat_t s;
+	int e = sys_pstat_fd(s, fd);
+	if (e) throw IOException(e);
+	return s.size;
+}
+
+/**
+ *	Inserts in place (fallocate() with FALLOC_FL_INSERT_RANGE) if
+ *	possible, see del().
+ */
+void LocalFileFD::insert(const void *buf, uint size)
+{
+	if (!(getAccessMode() & IOAM_WRITE)) throw IOException(EACCES);
+	FileOfs t = offset;
+	FileOfs fsize = getSize();
+	if (t < fsize && !shiftRange(t, size, false)) {
+		truncate(fsize+size);
+		fileMove(this, t, t+size, fsize-t, FILE_MOVE_THREADS);
+	}
+	writex(buf, size);
 }
 
 uint LocalFileFD::read(void *buf, uint size)
 {
 	if (!(getAccessMode() & IOAM_READ)) throw IOException(EACCES);
-	errno = 0;
-	uint r = ::read(fd, buf, size);
-	int e = errno;
-	if (e) {
-		off_t r = ::lseek(fd, 0, SEEK_SET);
-		offset = r;
+	if (plainFd >= 0) {
+		uint r = directRead(offset, buf, size);
+		offset = ::lseek(fd, offset + r, SEEK_SET);
+		return r;
+	}
+	ssize_t r = ::read(fd, buf, size);
+	if (r < 0) {
+		int e = errno;
+		offset = ::lseek(fd, 0, SEEK_CUR);
 		if (e != EAGAIN) throw IOException(e);
 		return 0;
-	} else {
-		offset += r;
-		return r;
-	}		
+	}
+	offset += r;
+	return r;
 }
 
-void LocalFileFD::seek(FileOfs o)
+/**
+ *	Uses pread(), doesn't touch the file pointer and may be called
+ *	concurrently from several threads.
+ */
+uint LocalFileFD::readAt(FileOfs ofs, void *buf, uint size)
 {
-	if (o == offset) return;
-	off_t r = ::lseek(fd, o, SEEK_SET);
-	offset = r;
-	if (offset != o) throw IOException(EIO);
+	if (!(getAccessMode() & IOAM_READ)) throw IOException(EACCES);
+	if (plainFd >= 0) return directRead(ofs, buf, size);
+	return preadFull(fd, buf, size, ofs);
 }
 
-int LocalFileFD::setAccessMode(IOAccessMode am)
+/**
+ *	Uses readv(), one system call for up to IOV_MAX buffers.
+ */
+uint LocalFileFD::readv(const struct iovec *iov, int iovcnt)
 {
-	IOAccessMode orig_access_mode = getAccessMode();
-	int e = setAccessModeInternal(am);
-	if (e && setAccessModeInternal(orig_access_mode))
+	if (!(getAccessMode() & IOAM_READ)) throw IOException(EACCES);
+	if (plainFd >= 0) return File::readv(iov, iovcnt);
+	uint r = 0;
+	while (iovcnt) {
+		int n = MIN(iovcnt, IOV_MAX);
+		ssize_t k = ::readv(fd, iov, n);
+		if (k < 0) {
+			int e = errno;
+			if (e == EINTR) continue;
+			offset = ::lseek(fd, 0, SEEK_CUR);
+			if (e != EAGAIN) throw IOException(e);
+			break;
+		}
+		offset += k;
+		r += k;
+		if ((size_t)k != iovSize(iov, n)) break;
+		iov += n;
+		iovcnt -= n;
+	}
+	return r;
+}
+
+void LocalFileFD::seek(FileOfs o)
+{
+	if (o == offset) return;
+	off_t r = ::lseek(fd, o, SEEK_SET);
+	if (r == (off_t)-1) throw IOException(errno);
+	offset = r;
+}
+
+int LocalFileFD::setAccessMode(IOAccessMode am)
+{
+	IOAccessMode orig_access_mode = getAccessMode();
+	int e = setAccessModeInternal(am);
+	if (e && setAccessModeInternal(orig_access_mode))
 		throw IOException(e);
 	return e;
 }
@@ -722,6 +1402,10 @@ int LocalFileFD::setAccessModeInternal(IOAccessMode am)
 		// FIXME: race condition here, how to reopen a fd atomically ?
 		close(fd);
 		fd = -1;
+		if (plainFd >= 0) {
+			close(plainFd);
+			plainFd = -1;
+		}
 	}
 	File::setAccessMode(IOAM_NULL);
 
@@ -747,10 +1431,26 @@ int LocalFileFD::setAccessModeInternal(IOAccessMode am)
 	int e = 0;
 	if (am != IOAM_NULL) {
 		pstat_t s;
-		fd = ::open(mFilename, mode);
+		fd = ::open(mFilename.contentChar(), mode, 0666);
 		if (fd < 0) e = errno;
+#ifdef O_DIRECT
+		if (!e && (am & IOAM_DIRECT)) {
+			// the first descriptor serves unaligned transfers. If the
+			// file system doesn't support O_DIRECT, it serves all.
+			int d = ::open(mFilename.contentChar(), (mode & ~(O_CREAT | O_TRUNC)) | O_DIRECT);
+			if (d >= 0) {
+				plainFd = fd;
+				fd = d;
+			} else if (errno != EINVAL) {
+				e = errno;
+				::close(fd);
+				fd = -1;
+			}
+		}
+#endif
 		if (!e) {
 			own_fd = true;
+			offset = ::lseek(fd, 0, SEEK_CUR);
 			e = sys_pstat_fd(s, fd);
 			if (!e) {
 				if (HT_S_ISDIR(s.mode)) {
@@ -759,6 +1459,14 @@ int LocalFileFD::setAccessModeInternal(IOAccessMode am)
 					e = EINVAL;
 				}
 			}
+			if (e) {
+				::close(fd);
+				fd = -1;
+				if (plainFd >= 0) {
+					::close(plainFd);
+					plainFd = -1;
+				}
+			}
 		}
 	}
 	return e ? e : File::setAccessMode(am);
@@ -777,6 +1485,68 @@ void LocalFileFD::truncate(FileOfs newsize)
 	if (e) throw IOException(e);
 }
 
+/*
+ *	FCNTL_ADVISE, FCNTL_READAHEAD and FCNTL_SYNC_RANGE on |fd|
+ *	@returns ENOSYS for other commands
+ */
+static int fdCacheCntl(int fd, uint cmd, va_list vargs)
+{
+	switch (cmd) {
+		case FCNTL_ADVISE: {	// MmapAdvice advice, FileOfs offset, FileOfs size
+			int advice = va_arg(vargs, int);
+			FileOfs offset = va_arg(vargs, FileOfs);
+			FileOfs size = va_arg(vargs, FileOfs);
+#ifdef POSIX_FADV_NORMAL
+			int a;
+			switch (advice) {
+				case MMAP_ADVICE_SEQUENTIAL: a = POSIX_FADV_SEQUENTIAL; break;
+				case MMAP_ADVICE_RANDOM: a = POSIX_FADV_RANDOM; break;
+				case MMAP_ADVICE_WILLNEED: a = POSIX_FADV_WILLNEED; break;
+				case MMAP_ADVICE_DONTNEED: a = POSIX_FADV_DONTNEED; break;
+				default: a = POSIX_FADV_NORMAL; break;
+			}
+			return posix_fadvise(fd, offset, size, a);
+#else
+			return 0;
+#endif
+		}
+		case FCNTL_READAHEAD: {	// FileOfs offset, FileOfs size
+			FileOfs offset = va_arg(vargs, FileOfs);
+			FileOfs size = va_arg(vargs, FileOfs);
+#ifdef __linux__
+			if (!size) {
+				struct stat st;
+				if (::fstat(fd, &st)) return errno;
+				if ((FileOfs)st.st_size <= offset) return 0;
+				size = st.st_size - offset;
+			}
+			if (::readahead(fd, offset, size)) return errno;
+			return 0;
+#elif defined(POSIX_FADV_WILLNEED)
+			return posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+#else
+			return 0;
+#endif
+		}
+		case FCNTL_SYNC_RANGE: {	// FileOfs offset, FileOfs size, bool wait
+			FileOfs offset = va_arg(vargs, FileOfs);
+			FileOfs size = va_arg(vargs, FileOfs);
+			bool wait = va_arg(vargs, int);
+#ifdef __linux__
+			// starts (and waits for) writeback of the data only,
+			// it doesn't commit metadata like fdatasync() does
+			uint flags = SYNC_FILE_RANGE_WRITE;
+			if (wait) flags |= SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WAIT_AFTER;
+			if (::sync_file_range(fd, offset, size, flags)) return errno;
+#else
+			if (wait && ::fsync(fd)) return errno;
+#endif
+			return 0;
+		}
+	}
+	return ENOSYS;
+}
+
 int LocalFileFD::vcntl(uint cmd, va_list vargs)
 {
 	switch (cmd) {
@@ -792,27 +1562,110 @@ int LocalFileFD::vcntl(uint cmd, va_list vargs)
 			*pfd = fd;
 			return 0;
 		}
+		case FCNTL_ADVISE:
+		case FCNTL_READAHEAD:
+		case FCNTL_SYNC_RANGE:
+			// with IOAM_DIRECT, only the buffered descriptor uses the page cache
+			return fdCacheCntl(plainFd >= 0 ? plainFd : fd, cmd, vargs);
 	}
 	return File::vcntl(cmd, vargs);
 }
 
+/*
+ *	inserts a hole of |size| bytes at |ofs| or removes |size| bytes at
+ *	|ofs| (if |collapse|) without moving data, if the file system can.
+ *	@returns false if not possible
+ */
+bool LocalFileFD::shiftRange(FileOfs ofs, FileOfs size, bool collapse)
+{
+#if defined(FALLOC_FL_INSERT_RANGE) && defined(FALLOC_FL_COLLAPSE_RANGE)
+	struct stat st;
+	if (::fstat(fd, &st) || st.st_blksize <= 0) return false;
+	if (ofs % st.st_blksize || size % st.st_blksize) return false;
+	if (::fallocate(fd, collapse ? FALLOC_FL_COLLAPSE_RANGE : FALLOC_FL_INSERT_RANGE, ofs, size) == 0) return true;
+	if (errno == EOPNOTSUPP || errno == EINVAL || errno == ENOSYS) return false;
+	throw IOException(errno);
+#else
+	return false;
+#endif
+}
+
 uint LocalFileFD::write(const void *buf, uint size)
 {
 	if (!(getAccessMode() & IOAM_WRITE)) throw IOException(EACCES);
-	errno = 0;
-	uint r = ::write(fd, buf, size);
-	int e = errno;
-	if (e) {
-		off_t r = ::lseek(fd, 0, SEEK_SET);
-		offset = r;
+	if (plainFd >= 0) {
+		uint r = directWrite(offset, buf, size);
+		offset = ::lseek(fd, offset + r, SEEK_SET);
+		return r;
+	}
+	ssize_t r = ::write(fd, buf, size);
+	if (r < 0) {
+		int e = errno;
+		offset = ::lseek(fd, 0, SEEK_CUR);
 		if (e != EAGAIN) throw IOException(e);
 		return 0;
-	} else {
-		offset += r;
-		return r;
-	}		
+	}
+	offset += r;
+	return r;
+}
+
+/**
+ *	Uses pwrite(), doesn't touch the file pointer and may be called
+ *	concurrently from several threads. (Opened with FOM_APPEND, the data
+ *	is appended regardless of |ofs|.)
+ */
+uint LocalFileFD::writeAt(FileOfs ofs, const void *buf, uint size)
+{
+	if (!(getAccessMode() & IOAM_WRITE)) throw IOException(EACCES);
+	if (plainFd >= 0) return directWrite(ofs, buf, size);
+	return pwriteFull(fd, buf, size, ofs);
+}
+
+/**
+ *	Uses writev(), one system call for up to IOV_MAX buffers.
+ */
+uint LocalFileFD::writev(const struct iovec *iov, int iovcnt)
+{
+	if (!(getAccessMode() & IOAM_WRITE)) throw IOException(EACCES);
+	if (plainFd >= 0) return File::writev(iov, iovcnt);
+	uint r = 0;
+	while (iovcnt) {
+		int n = MIN(iovcnt, IOV_MAX);
+		ssize_t k = ::writev(fd, iov, n);
+		if (k < 0) {
+			int e = errno;
+			if (e == EINTR) continue;
+			offset = ::lseek(fd, 0, SEEK_CUR);
+			if (e != EAGAIN) throw IOException(e);
+			break;
+		}
+		offset += k;
+		r += k;
+		if ((size_t)k != iovSize(iov, n)) break;
+		iov += n;
+		iovcnt -= n;
+	}
+	return r;
+}
+
+/**
+ *	Allocate a buffer for IOAM_DIRECT transfers.
+ *	@param size size in bytes (rounded up to DIRECT_IO_ALIGN)
+ *	@returns buffer aligned to DIRECT_IO_ALIGN, to be freed with directFree()
+ *	@throws std::bad_alloc
+ */
+void *directAlloc(size_t size)
+{
+	void *p;
+	size = (size + DIRECT_IO_ALIGN - 1) & ~(size_t)(DIRECT_IO_ALIGN - 1);
+	if (posix_memalign(&p, DIRECT_IO_ALIGN, size ? size : DIRECT_IO_ALIGN)) throw std::bad_alloc();
+	return p;
+}
+
+void directFree(void *p)
+{
+	free(p);
 }
-#endif
 
 /*
  *	StdIoFile
@@ -987,6 +1840,14 @@ int LocalFile::vcntl(uint cmd, va_list vargs)
 			}
 			break;
 		}
+		case FCNTL_ADVISE:
+		case FCNTL_READAHEAD:
+		case FCNTL_SYNC_RANGE:
+			if (file) {
+				if (cmd == FCNTL_SYNC_RANGE && fflush(file)) return errno;
+				return fdCacheCntl(fileno(file), cmd, vargs);
+			}
+			break;
 	}
 	return File::vcntl(cmd, vargs);
 }
@@ -1077,6 +1938,335 @@ FileOfs ConstMemMapFile::tell() const
 	return pos;
 }
 
+/*
+ *	MmapFile
+ */
+static FileOfs mmapPageRound(FileOfs size)
+{
+	static FileOfs pagesize = sysconf(_SC_PAGESIZE);
+	return (size + pagesize - 1) & ~(pagesize - 1);
+}
+
+MmapFile::MmapFile(const String &aFilename, IOAccessMode am, FileOpenMode om)
+ : File(), mFilename(aFilename)
+{
+	mOpenMode = om;
+	fd = -1;
+	mBase = NULL;
+	mSize = 0;
+	mMapSize = 0;
+	pos = 0;
+	int e = setAccessMode(am);
+	if (e) throw IOException(e);
+	mOpenMode = FOM_EXISTS;
+}
+
+MmapFile::~MmapFile()
+{
+	if (mBase) munmap(mBase, mMapSize);
+	if (fd >= 0) ::close(fd);
+}
+
+/**
+ *	Give the kernel a hint about the access pattern for
+ *	[|offset|, |offset|+|size|) (|size| == 0 means: up to the end).
+ */
+void MmapFile::advise(MmapAdvice advice, FileOfs offset, FileOfs size)
+{
+	FileOfs start, end;
+	if (!pageRange(offset, size, start, end)) return;
+	int a;
+	switch (advice) {
+		case MMAP_ADVICE_SEQUENTIAL: a = MADV_SEQUENTIAL; break;
+		case MMAP_ADVICE_RANDOM: a = MADV_RANDOM; break;
+		case MMAP_ADVICE_WILLNEED: a = MADV_WILLNEED; break;
+		case MMAP_ADVICE_DONTNEED: a = MADV_DONTNEED; break;
+		default: a = MADV_NORMAL; break;
+	}
+	// only a hint, errors don't matter
+	madvise(mBase + start, end - start, a);
+}
+
+void MmapFile::extend(FileOfs newsize)
+{
+	if (mSize > newsize) throw IOException(EINVAL);
+	if (mSize == newsize) return;
+	resize(newsize);
+}
+
+/**
+ *	@returns pointer to the file content (getSize() bytes),
+ *	NULL if the file is empty
+ */
+byte *MmapFile::getBufPtr() const
+{
+	return mSize ? mBase : NULL;
+}
+
+String &MmapFile::getDesc(String &result) const
+{
+	result = mFilename;
+	return result;
+}
+
+String &MmapFile::getFilename(String &result) const
+{
+	result = mFilename;
+	return result;
+}
+
+FileOfs MmapFile::getSize() const
+{
+	return mSize;
+}
+
+void MmapFile::pstat(pstat_t &s) const
+{
+	sys_pstat_fd(s, fd);
+}
+
+uint MmapFile::read(void *buf, uint size)
+{
+	if (!(getAccessMode() & IOAM_READ)) throw IOException(EACCES);
+	if (pos >= mSize) return 0;
+	if (size > mSize - pos) size = mSize - pos;
+	memcpy(buf, mBase + pos, size);
+	pos += size;
+	return size;
+}
+
+uint MmapFile::readAt(FileOfs offset, void *buf, uint size)
+{
+	if (!(getAccessMode() & IOAM_READ)) throw IOException(EACCES);
+	if (offset >= mSize) return 0;
+	if (size > mSize - offset) size = mSize - offset;
+	memcpy(buf, mBase + offset, size);
+	return size;
+}
+
+/*
+ *	the mapped pages covering [|offset|, |offset|+|size|)
+ *	(|size| == 0 means: up to the end) as [|start|, |end|)
+ *	@returns false if there are none
+ */
+bool MmapFile::pageRange(FileOfs offset, FileOfs size, FileOfs &start, FileOfs &end) const
+{
+	if (!mBase) return false;
+	start = offset & ~(mmapPageRound(1) - 1);
+	if (start >= mMapSize) return false;
+	end = size ? mmapPageRound(offset + size) : mMapSize;
+	if (end > mMapSize) end = mMapSize;
+	return true;
+}
+
+/*
+ *	(re-)maps the first |newMapSize| bytes of the file
+ */
+void MmapFile::remap(FileOfs newMapSize)
+{
+	if (newMapSize == mMapSize) return;
+	if (newMapSize > (FileOfs)SIZE_MAX) throw IOException(EFBIG);
+	void *p;
+	if (!newMapSize) {
+		munmap(mBase, mMapSize);
+		p = NULL;
+	} else if (mBase) {
+#ifdef MREMAP_MAYMOVE
+		p = mremap(mBase, mMapSize, newMapSize, MREMAP_MAYMOVE);
+#else
+		munmap(mBase, mMapSize);
+		mBase = NULL;
+		mMapSize = 0;
+		p = mmap(NULL, newMapSize, PROT_READ | ((getAccessMode() & IOAM_WRITE) ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+#endif
+	} else {
+		p = mmap(NULL, newMapSize, PROT_READ | ((getAccessMode() & IOAM_WRITE) ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+	}
+	if (p == MAP_FAILED) throw IOException(errno);
+	mBase = (byte*)p;
+	mMapSize = newMapSize;
+}
+
+/*
+ *	changes the file size. Growing, the mapping grows geometrically
+ *	(the pages beyond the end of file are never touched), so appending
+ *	doesn't remap every time.
+ */
+void MmapFile::resize(FileOfs newsize)
+{
+	if (!(getAccessMode() & IOAM_WRITE)) throw IOException(EACCES);
+	int e = sys_truncate_fd(fd, newsize);
+	if (e) throw IOException(e);
+	if (newsize > mMapSize) {
+		remap(mmapPageRound(MAX(newsize, mMapSize*2)));
+	} else if (newsize < mSize) {
+		remap(mmapPageRound(newsize));
+	}
+	mSize = newsize;
+	mcount++;
+}
+
+void MmapFile::seek(FileOfs offset)
+{
+	pos = offset;
+}
+
+int MmapFile::setAccessMode(IOAccessMode am)
+{
+	IOAccessMode orig_access_mode = getAccessMode();
+	int e = setAccessModeInternal(am);
+	if (e && setAccessModeInternal(orig_access_mode))
+		throw IOException(e);
+	return e;
+}
+
+int MmapFile::setAccessModeInternal(IOAccessMode am)
+{
+	if (getAccessMode() == am) return 0;
+	if (mBase) munmap(mBase, mMapSize);
+	mBase = NULL;
+	mMapSize = 0;
+	mSize = 0;
+	if (fd >= 0) ::close(fd);
+	fd = -1;
+	File::setAccessMode(IOAM_NULL);
+	if (am == IOAM_NULL) return 0;
+
+	// a writable shared mapping needs a readable fd as well
+	int mode = (am & IOAM_WRITE) ? O_RDWR : O_RDONLY;
+	if (mOpenMode == FOM_CREATE) mode |= O_CREAT | O_TRUNC;
+	fd = ::open(mFilename.contentChar(), mode, 0666);
+	if (fd < 0) return errno;
+	pstat_t s;
+	int e = sys_pstat_fd(s, fd);
+	if (!e) {
+		if (HT_S_ISDIR(s.mode)) {
+			e = EISDIR;
+		} else if (!HT_S_ISREG(s.mode)) {
+			e = EINVAL;
+		}
+	}
+	if (e) {
+		::close(fd);
+		fd = -1;
+		return e;
+	}
+	File::setAccessMode(am);
+	try {
+		remap(mmapPageRound(s.size));
+	} catch (const IOException &x) {
+		File::setAccessMode(IOAM_NULL);
+		::close(fd);
+		fd = -1;
+		return x.mPosixErrno;
+	}
+	mSize = s.size;
+	if (mOpenMode == FOM_APPEND) pos = mSize;
+	return 0;
+}
+
+/**
+ *	Write modified pages to disk.
+ *	@param wait wait until written (otherwise only schedule it)
+ */
+void MmapFile::sync(bool wait)
+{
+	if (!mBase) return;
+	if (msync(mBase, mMapSize, wait ? MS_SYNC : MS_ASYNC)) throw IOException(errno);
+}
+
+FileOfs MmapFile::tell() const
+{
+	return pos;
+}
+
+void MmapFile::truncate(FileOfs newsize)
+{
+	if (mSize < newsize) throw IOException(EINVAL);
+	if (mSize == newsize) return;
+	resize(newsize);
+}
+
+int MmapFile::vcntl(uint cmd, va_list vargs)
+{
+	switch (cmd) {
+		case FCNTL_MODS_FLUSH:
+			try {
+				sync();
+			} catch (const IOException &x) {
+				return x.mPosixErrno;
+			}
+			return 0;
+		case FCNTL_FLUSH_STAT: {
+			// pick up size changes made by others
+			pstat_t s;
+			int e = sys_pstat_fd(s, fd);
+			if (e) return e;
+			if (s.size != mSize) {
+				try {
+					remap(mmapPageRound(s.size));
+				} catch (const IOException &x) {
+					return x.mPosixErrno;
+				}
+				mSize = s.size;
+			}
+			return 0;
+		}
+		case FCNTL_GET_FD: {	// (int &fd)
+			int *pfd = va_arg(vargs, int*);
+			*pfd = fd;
+			return 0;
+		}
+		// the mapping is what's read and written, so these work on it
+		case FCNTL_ADVISE: {	// MmapAdvice advice, FileOfs offset, FileOfs size
+			MmapAdvice advice = (MmapAdvice)va_arg(vargs, int);
+			FileOfs offset = va_arg(vargs, FileOfs);
+			FileOfs size = va_arg(vargs, FileOfs);
+			advise(advice, offset, size);
+			return 0;
+		}
+		case FCNTL_READAHEAD: {	// FileOfs offset, FileOfs size
+			FileOfs offset = va_arg(vargs, FileOfs);
+			FileOfs size = va_arg(vargs, FileOfs);
+			advise(MMAP_ADVICE_WILLNEED, offset, size);
+			return 0;
+		}
+		case FCNTL_SYNC_RANGE: {	// FileOfs offset, FileOfs size, bool wait
+			FileOfs offset = va_arg(vargs, FileOfs);
+			FileOfs size = va_arg(vargs, FileOfs);
+			bool wait = va_arg(vargs, int);
+			FileOfs start, end;
+			if (!pageRange(offset, size, start, end)) return 0;
+			if (msync(mBase + start, end - start, wait ? MS_SYNC : MS_ASYNC)) return errno;
+			return 0;
+		}
+	}
+	return File::vcntl(cmd, vargs);
+}
+
+uint MmapFile::write(const void *buf, uint size)
+{
+	if (!(getAccessMode() & IOAM_WRITE)) throw IOException(EACCES);
+	if (!size) return 0;
+	if (pos + size > mSize) resize(pos + size);
+	memcpy(mBase + pos, buf, size);
+	pos += size;
+	return size;
+}
+
+/**
+ *	Writes within the file don't remap and may be done concurrently,
+ *	writes beyond the end resize the file and must not.
+ */
+uint MmapFile::writeAt(FileOfs offset, const void *buf, uint size)
+{
+	if (!(getAccessMode() & IOAM_WRITE)) throw IOException(EACCES);
+	if (!size) return 0;
+	if (offset + size > mSize) resize(offset + size);
+	memcpy(mBase + offset, buf, size);
+	return size;
+}
+
 /*
  *	A file layer, representing a cropped version of a file
  */
@@ -1144,6 +2334,21 @@ uint CroppedFile::read(void *buf, uint size)
 	return FileLayer::read(buf, size);
 }
 
+uint CroppedFile::readAt(FileOfs offset, void *buf, uint size)
+{
+	if (mHasCropSize) {
+		if (offset >= mCropSize) return 0;
+		if (size > mCropSize - offset) size = mCropSize - offset;
+	}
+	return FileLayer::readAt(offset + mCropStart, buf, size);
+}
+
+uint CroppedFile::readv(const struct iovec *iov, int iovcnt)
+{
+	// not passed through, read() does the cropping
+	return File::readv(iov, iovcnt);
+}
+
 void CroppedFile::seek(FileOfs offset)
 {
 /*	if (mHasCropSize) {
@@ -1166,10 +2371,36 @@ void CroppedFile::truncate(FileOfs newsize)
 	throw IOException(ENOSYS);
 }
 
-uint CroppedFile::write(const void *buf, uint size)
+/**
+ *	Translates the range of FCNTL_ADVISE, FCNTL_READAHEAD and
+ *	FCNTL_SYNC_RANGE into the layered file (clipped to the crop).
+ */
+int CroppedFile::vcntl(uint cmd, va_list vargs)
 {
-	FileOfs offset = FileLayer::tell();
-	if (offset<mCropStart) return 0;
+	switch (cmd) {
+		case FCNTL_ADVISE:
+		case FCNTL_READAHEAD:
+		case FCNTL_SYNC_RANGE: {
+			int advice = (cmd == FCNTL_ADVISE) ? va_arg(vargs, int) : 0;
+			FileOfs offset = va_arg(vargs, FileOfs);
+			FileOfs size = va_arg(vargs, FileOfs);
+			if (mHasCropSize) {
+				if (offset >= mCropSize) return 0;
+				if (!size || size > mCropSize - offset) size = mCropSize - offset;
+			}
+			offset += mCropStart;
+			if (cmd == FCNTL_ADVISE) return mFile->cntl(cmd, advice, offset, size);
+			if (cmd == FCNTL_READAHEAD) return mFile->cntl(cmd, offset, size);
+			return mFile->cntl(cmd, offset, size, va_arg(vargs, int));
+		}
+	}
+	return FileLayer::vcntl(cmd, vargs);
+}
+
+uint CroppedFile::write(const void *buf, uint size)
+{
+	FileOfs offset = FileLayer::tell();
+	if (offset<mCropStart) return 0;
 	if (mHasCropSize) {
 		if (offset >= mCropStart+mCropSize) return 0;
 		if (offset+size >= mCropStart+mCropSize) size = mCropStart+mCropSize-offset;
@@ -1177,6 +2408,823 @@ uint CroppedFile::write(const void *buf, uint size)
 	return FileLayer::write(buf, size);
 }
 
+uint CroppedFile::writeAt(FileOfs offset, const void *buf, uint size)
+{
+	if (mHasCropSize) {
+		if (offset >= mCropSize) return 0;
+		if (size > mCropSize - offset) size = mCropSize - offset;
+	}
+	return FileLayer::writeAt(offset + mCropStart, buf, size);
+}
+
+uint CroppedFile::writev(const struct iovec *iov, int iovcnt)
+{
+	// not passed through, write() does the cropping
+	return File::writev(iov, iovcnt);
+}
+
+/*
+ *	BufferedStream
+ */
+BufferedStream::BufferedStream(Stream *stream, bool own_stream, uint readAhead, uint writeBehind)
+: StreamLayer(stream, own_stream)
+{
+	mReadAhead = readAhead;
+	mWriteBehind = writeBehind;
+	mBufSize = MAX(readAhead + BUFFERED_PUSHBACK, writeBehind);
+	mBuf = (byte*)malloc(mBufSize);
+	if (!mBuf) throw std::bad_alloc();
+	mPos = mFill = 0;
+	mDirty = false;
+}
+
+BufferedStream::~BufferedStream()
+{
+	try {
+		flush();
+	} catch (const Exception &) {
+	}
+	free(mBuf);
+}
+
+/*
+ *	reads more data, behind what's buffered
+ *	@returns number of bytes added
+ */
+uint BufferedStream::fill()
+{
+	uint keep = MIN(mPos, BUFFERED_PUSHBACK);
+	if (mPos > keep) {
+		memmove(mBuf, mBuf + mPos - keep, mFill - mPos + keep);
+		mFill -= mPos - keep;
+		mPos = keep;
+	}
+	uint r = mStream->read(mBuf + mFill, mBufSize - mFill);
+	mFill += r;
+	return r;
+}
+
+/**
+ *	Mark |size| bytes (obtained by <i>getReadBuffer()</i>) as read.
+ */
+void BufferedStream::consume(uint size)
+{
+	if (size > mFill - mPos) throw IOException(EINVAL);
+	mPos += size;
+}
+
+/**
+ *	Write pending data to the layered stream.
+ *	@throws IOException
+ */
+void BufferedStream::flush()
+{
+	if (!mDirty) return;
+	mDirty = false;
+	uint n = mFill;
+	mPos = mFill = 0;
+	mStream->writex(mBuf, n);
+}
+
+/**
+ *	Zero-copy read access.
+ *	@param size receives the number of bytes available (0 on EOF)
+ *	@returns pointer to the buffered data, valid until the next
+ *	operation on this stream. Call <i>consume()</i> for the bytes used.
+ */
+const byte *BufferedStream::getReadBuffer(uint &size)
+{
+	flush();
+	if (mPos == mFill) fill();
+	size = mFill - mPos;
+	return mBuf + mPos;
+}
+
+/**
+ *	Read without consuming.
+ *	@returns number of bytes copied to |buf| (less than |size| on EOF
+ *	or if |size| exceeds the buffer)
+ */
+uint BufferedStream::peek(void *buf, uint size)
+{
+	flush();
+	while (mFill - mPos < size && fill());
+	uint r = MIN(size, mFill - mPos);
+	memcpy(buf, mBuf + mPos, r);
+	return r;
+}
+
+uint BufferedStream::read(void *aBuf, uint size)
+{
+	flush();
+	byte *buf = (byte*)aBuf;
+	uint r = 0;
+	while (size) {
+		if (mPos == mFill) {
+			if (size >= mReadAhead) return r + mStream->read(buf, size);
+			if (!fill()) break;
+		}
+		uint k = MIN(size, mFill - mPos);
+		memcpy(buf, mBuf + mPos, k);
+		mPos += k;
+		buf += k;
+		size -= k;
+		r += k;
+	}
+	return r;
+}
+
+uint BufferedStream::readv(const struct iovec *iov, int iovcnt)
+{
+	return readPieces(this, iov, iovcnt);
+}
+
+int BufferedStream::setAccessMode(IOAccessMode mode)
+{
+	flush();
+	mPos = mFill = 0;
+	return StreamLayer::setAccessMode(mode);
+}
+
+/**
+ *	Push back the last |size| bytes read. Possible for at least
+ *	BUFFERED_PUSHBACK bytes read through the buffer.
+ *	@throws IOException if not possible
+ */
+void BufferedStream::unread(uint size)
+{
+	if (mDirty || size > mPos) throw IOException(EINVAL);
+	mPos -= size;
+}
+
+uint BufferedStream::write(const void *buf, uint size)
+{
+	if (!mDirty) mPos = mFill = 0;
+	if (mFill + size > mWriteBehind) {
+		flush();
+		if (size >= mWriteBehind) return mStream->write(buf, size);
+	}
+	memcpy(mBuf + mFill, buf, size);
+	mFill += size;
+	mPos = mFill;
+	mDirty = true;
+	return size;
+}
+
+/**
+ *	The pieces are collected in the buffer (large ones are passed on
+ *	by <i>write()</i>).
+ */
+uint BufferedStream::writev(const struct iovec *iov, int iovcnt)
+{
+	return writePieces(this, iov, iovcnt);
+}
+
+/*
+ *	BufferedFile
+ *
+ *	The buffer holds the file content at [mBufOfs, mBufOfs+mFill), the
+ *	logical position is mBufOfs+mPos. If clean, the layered file is
+ *	positioned at mBufOfs+mFill, if dirty (mPos == mFill) at mBufOfs.
+ */
+BufferedFile::BufferedFile(File *file, bool own_file, uint readAhead, uint writeBehind)
+: FileLayer(file, own_file)
+{
+	mReadAhead = readAhead;
+	mWriteBehind = writeBehind;
+	mBufSize = MAX(readAhead + BUFFERED_PUSHBACK, writeBehind);
+	mBuf = (byte*)malloc(mBufSize);
+	if (!mBuf) throw std::bad_alloc();
+	mBufOfs = file->tell();
+	mPos = mFill = 0;
+	mDirty = false;
+}
+
+BufferedFile::~BufferedFile()
+{
+	try {
+		flush();
+	} catch (const Exception &) {
+	}
+	free(mBuf);
+}
+
+uint BufferedFile::fill()
+{
+	uint keep = MIN(mPos, BUFFERED_PUSHBACK);
+	if (mPos > keep) {
+		uint drop = mPos - keep;
+		memmove(mBuf, mBuf + drop, mFill - drop);
+		mBufOfs += drop;
+		mFill -= drop;
+		mPos = keep;
+	}
+	uint r = mFile->read(mBuf + mFill, mBufSize - mFill);
+	mFill += r;
+	return r;
+}
+
+/*
+ *	writes pending data and empties the buffer, leaving the layered
+ *	file at the logical position
+ */
+void BufferedFile::invalidate()
+{
+	flush();
+	if (mFill) {
+		mBufOfs += mPos;
+		mPos = mFill = 0;
+		mFile->seek(mBufOfs);
+	}
+}
+
+/*
+ *	after operations that may move the layered file's position
+ */
+void BufferedFile::resync()
+{
+	mBufOfs = mFile->tell();
+	mPos = mFill = 0;
+}
+
+void BufferedFile::consume(uint size)
+{
+	if (size > mFill - mPos) throw IOException(EINVAL);
+	mPos += size;
+}
+
+void BufferedFile::del(uint size)
+{
+	invalidate();
+	FileLayer::del(size);
+	resync();
+}
+
+void BufferedFile::extend(FileOfs newsize)
+{
+	invalidate();
+	FileLayer::extend(newsize);
+	resync();
+}
+
+/**
+ *	Write pending data to the layered file.
+ *	@throws IOException
+ */
+void BufferedFile::flush()
+{
+	if (!mDirty) return;
+	mDirty = false;
+	uint n = mFill;
+	mPos = mFill = 0;
+	mFile->seek(mBufOfs);
+	mFile->writex(mBuf, n);
+	mBufOfs += n;
+}
+
+FileOfs BufferedFile::getSize() const
+{
+	FileOfs s = FileLayer::getSize();
+	if (mDirty && mBufOfs + mFill > s) s = mBufOfs + mFill;
+	return s;
+}
+
+/**
+ *	Zero-copy read access, see BufferedStream::getReadBuffer().
+ */
+const byte *BufferedFile::getReadBuffer(uint &size)
+{
+	flush();
+	if (mPos == mFill) fill();
+	size = mFill - mPos;
+	return mBuf + mPos;
+}
+
+void BufferedFile::insert(const void *buf, uint size)
+{
+	invalidate();
+	FileLayer::insert(buf, size);
+	resync();
+}
+
+uint BufferedFile::peek(void *buf, uint size)
+{
+	flush();
+	while (mFill - mPos < size && fill());
+	uint r = MIN(size, mFill - mPos);
+	memcpy(buf, mBuf + mPos, r);
+	return r;
+}
+
+uint BufferedFile::read(void *aBuf, uint size)
+{
+	flush();
+	byte *buf = (byte*)aBuf;
+	uint r = 0;
+	while (size) {
+		if (mPos == mFill) {
+			if (size >= mReadAhead) {
+				mBufOfs += mFill;
+				mPos = mFill = 0;
+				uint k = mFile->read(buf, size);
+				mBufOfs += k;
+				return r + k;
+			}
+			if (!fill()) break;
+		}
+		uint k = MIN(size, mFill - mPos);
+		memcpy(buf, mBuf + mPos, k);
+		mPos += k;
+		buf += k;
+		size -= k;
+		r += k;
+	}
+	return r;
+}
+
+/**
+ *	Pending writes are flushed first, the buffer is bypassed.
+ */
+uint BufferedFile::readAt(FileOfs offset, void *buf, uint size)
+{
+	flush();
+	return FileLayer::readAt(offset, buf, size);
+}
+
+uint BufferedFile::readv(const struct iovec *iov, int iovcnt)
+{
+	return readPieces(this, iov, iovcnt);
+}
+
+void BufferedFile::seek(FileOfs offset)
+{
+	if (!mDirty && offset >= mBufOfs && offset <= mBufOfs + mFill) {
+		mPos = offset - mBufOfs;
+		return;
+	}
+	if (mDirty && offset == mBufOfs + mPos) return;
+	flush();
+	mFile->seek(offset);
+	mBufOfs = offset;
+	mPos = mFill = 0;
+}
+
+int BufferedFile::setAccessMode(IOAccessMode mode)
+{
+	invalidate();
+	int r = FileLayer::setAccessMode(mode);
+	resync();
+	return r;
+}
+
+FileOfs BufferedFile::tell() const
+{
+	return mBufOfs + mPos;
+}
+
+void BufferedFile::truncate(FileOfs newsize)
+{
+	invalidate();
+	FileLayer::truncate(newsize);
+	resync();
+}
+
+void BufferedFile::unread(uint size)
+{
+	if (mDirty || size > mPos) throw IOException(EINVAL);
+	mPos -= size;
+}
+
+int BufferedFile::vcntl(uint cmd, va_list vargs)
+{
+	invalidate();
+	int r = FileLayer::vcntl(cmd, vargs);
+	resync();
+	return r;
+}
+
+uint BufferedFile::write(const void *buf, uint size)
+{
+	if (!mDirty) invalidate();
+	if (mFill + size > mWriteBehind) {
+		flush();
+		if (size >= mWriteBehind) {
+			uint k = mFile->write(buf, size);
+			mBufOfs += k;
+			return k;
+		}
+	}
+	memcpy(mBuf + mFill, buf, size);
+	mFill += size;
+	mPos = mFill;
+	mDirty = true;
+	return size;
+}
+
+/**
+ *	Pending writes are flushed and the buffer is emptied first, as it
+ *	could overlap the range written, the write bypasses the buffer.
+ */
+uint BufferedFile::writeAt(FileOfs offset, const void *buf, uint size)
+{
+	invalidate();
+	return FileLayer::writeAt(offset, buf, size);
+}
+
+/**
+ *	The pieces are collected in the buffer (large ones are passed on
+ *	by <i>write()</i>).
+ */
+uint BufferedFile::writev(const struct iovec *iov, int iovcnt)
+{
+	return writePieces(this, iov, iovcnt);
+}
+
+/*
+ *	ChecksumStream
+ */
+ChecksumStream::ChecksumStream(Stream *stream, bool own_stream)
+: StreamLayer(stream, own_stream)
+{
+	reset();
+}
+
+/**
+ *	@returns CRC32C of the data passed through since construction
+ *	or the last <i>reset()</i>
+ */
+uint32 ChecksumStream::getChecksum() const
+{
+	return mChecksum;
+}
+
+/**
+ *	@returns number of bytes passed through since construction
+ *	or the last <i>reset()</i>
+ */
+FileOfs ChecksumStream::getCount() const
+{
+	return mCount;
+}
+
+uint ChecksumStream::read(void *buf, uint size)
+{
+	uint r = StreamLayer::read(buf, size);
+	mChecksum = crc32c(mChecksum, buf, r);
+	mCount += r;
+	return r;
+}
+
+uint ChecksumStream::readv(const struct iovec *iov, int iovcnt)
+{
+	uint r = StreamLayer::readv(iov, iovcnt);
+	uint k = r;
+	for (int i = 0; i < iovcnt && k; i++) {
+		uint n = MIN(k, iov[i].iov_len);
+		mChecksum = crc32c(mChecksum, iov[i].iov_base, n);
+		k -= n;
+	}
+	mCount += r;
+	return r;
+}
+
+void ChecksumStream::reset()
+{
+	mChecksum = 0;
+	mCount = 0;
+}
+
+uint ChecksumStream::write(const void *buf, uint size)
+{
+	uint r = StreamLayer::write(buf, size);
+	mChecksum = crc32c(mChecksum, buf, r);
+	mCount += r;
+	return r;
+}
+
+uint ChecksumStream::writev(const struct iovec *iov, int iovcnt)
+{
+	uint r = StreamLayer::writev(iov, iovcnt);
+	uint k = r;
+	for (int i = 0; i < iovcnt && k; i++) {
+		uint n = MIN(k, iov[i].iov_len);
+		mChecksum = crc32c(mChecksum, iov[i].iov_base, n);
+		k -= n;
+	}
+	mCount += r;
+	return r;
+}
+
+/*
+ *	ChecksumFile
+ */
+
+// Block::fill of a block whose checksum is unknown
+#define CHECKSUM_UNKNOWN	0xffffffff
+
+/*
+ *	format of saveChecksums()/loadChecksums(), all little endian:
+ *	8 bytes magic, 4 bytes block size, 8 bytes block count,
+ *	then 4 bytes per block
+ */
+#define CHECKSUM_MAGIC		"PBCRC32C"
+#define CHECKSUM_HEADER_SIZE	20
+// checksums converted at once
+#define CHECKSUM_IO_COUNT	1024
+
+static void putLE(byte *p, uint64 v, int size)
+{
+	for (int i = 0; i < size; i++) p[i] = v >> (8*i);
+}
+
+static uint64 getLE(const byte *p, int size)
+{
+	uint64 v = 0;
+	for (int i = size-1; i >= 0; i--) v = (v << 8) | p[i];
+	return v;
+}
+
+ChecksumFile::ChecksumFile(File *file, bool own_file, uint blockSize)
+: FileLayer(file, own_file)
+{
+	if (!blockSize || blockSize == CHECKSUM_UNKNOWN) throw IOException(EINVAL);
+	mBlockSize = blockSize;
+	mBlocks = NULL;
+	mBlockCount = 0;
+	mExpected = NULL;
+	mExpectedCount = 0;
+}
+
+ChecksumFile::~ChecksumFile()
+{
+	free(mBlocks);
+	free(mExpected);
+}
+
+/*
+ *	updates the checksums of the blocks touched by the |size| bytes at
+ *	|offset|, which were just read or written from |buf| (0-bytes
+ *	if |buf| is NULL)
+ */
+void ChecksumFile::account(FileOfs offset, const byte *buf, FileOfs size, bool reading)
+{
+	while (size) {
+		FileOfs b = offset / mBlockSize;
+		uint start = offset % mBlockSize;
+		uint n = MIN(size, (FileOfs)(mBlockSize - start));
+		Block &k = block(b);
+		if (start == 0) {
+			// (re)starting the block
+			k.crc = buf ? crc32c(0, buf, n) : crc32cZeros(0, n);
+			k.fill = n;
+			if (reading) check(b);
+		} else if (k.fill != CHECKSUM_UNKNOWN && start <= k.fill && start + n > k.fill) {
+			if (!reading && start != k.fill) {
+				// rewrites bytes already covered
+				k.fill = CHECKSUM_UNKNOWN;
+			} else {
+				uint skip = k.fill - start;
+				k.crc = buf ? crc32c(k.crc, buf + skip, n - skip) : crc32cZeros(k.crc, n - skip);
+				k.fill = start + n;
+				if (reading) check(b);
+			}
+		} else if (!reading) {
+			k.fill = CHECKSUM_UNKNOWN;
+		}
+		offset += n;
+		if (buf) buf += n;
+		size -= n;
+	}
+}
+
+/*
+ *	before writing at |offset|: the file grows with 0-bytes up to there
+ */
+void ChecksumFile::accountGap(FileOfs offset)
+{
+	FileOfs b = offset / mBlockSize;
+	uint start = offset % mBlockSize;
+	// continuing a block, the common case, needs no getSize()
+	if (start && b < mBlockCount && mBlocks[b].fill == start) return;
+	FileOfs size = getSize();
+	if (offset > size) account(size, NULL, offset - size, false);
+}
+
+void ChecksumFile::accountIov(FileOfs offset, const struct iovec *iov, int iovcnt, uint size, bool reading)
+{
+	for (int i = 0; i < iovcnt && size; i++) {
+		uint n = MIN(size, iov[i].iov_len);
+		account(offset, (const byte*)iov[i].iov_base, n, reading);
+		offset += n;
+		size -= n;
+	}
+}
+
+/*
+ *	@returns block |b|, the list is extended as needed
+ */
+ChecksumFile::Block &ChecksumFile::block(FileOfs b)
+{
+	if (b >= mBlockCount) {
+		Block *n = (Block*)realloc(mBlocks, (b + 1) * sizeof *mBlocks);
+		if (!n) throw std::bad_alloc();
+		memset(n + mBlockCount, 0, (b + 1 - mBlockCount) * sizeof *mBlocks);
+		mBlocks = n;
+		mBlockCount = b + 1;
+	}
+	return mBlocks[b];
+}
+
+/*
+ *	compares block |b| with its expected checksum, once it is complete
+ */
+void ChecksumFile::check(FileOfs b)
+{
+	if (b >= mExpectedCount) return;
+	const Block &k = mBlocks[b];
+	if (k.fill < mBlockSize) {
+		// only the last block may be shorter
+		if (b != mExpectedCount - 1 || b * mBlockSize + k.fill != getSize()) return;
+	}
+	if (k.crc != mExpected[b]) throw IOException(EIO);
+}
+
+void ChecksumFile::del(uint size)
+{
+	FileOfs t = tell();
+	FileLayer::del(size);
+	invalidate(t);
+}
+
+void ChecksumFile::extend(FileOfs newsize)
+{
+	FileOfs size = getSize();
+	FileLayer::extend(newsize);
+	if (newsize > size) account(size, NULL, newsize - size, false);
+}
+
+/**
+ *	@returns number of blocks of the file (the last one may be shorter)
+ */
+FileOfs ChecksumFile::getBlockCount() const
+{
+	return (getSize() + mBlockSize - 1) / mBlockSize;
+}
+
+uint ChecksumFile::getBlockSize() const
+{
+	return mBlockSize;
+}
+
+/**
+ *	@returns true and the CRC32C of block |b| in |crc|, if known
+ */
+bool ChecksumFile::getChecksum(FileOfs b, uint32 &crc) const
+{
+	if (b >= mBlockCount) return false;
+	const Block &k = mBlocks[b];
+	if (k.fill == CHECKSUM_UNKNOWN || !k.fill) return false;
+	if (k.fill < mBlockSize && b * mBlockSize + k.fill != getSize()) return false;
+	crc = k.crc;
+	return true;
+}
+
+void ChecksumFile::insert(const void *buf, uint size)
+{
+	FileOfs t = tell();
+	FileLayer::insert(buf, size);
+	invalidate(t);
+}
+
+/*
+ *	the content from |from| on has moved
+ */
+void ChecksumFile::invalidate(FileOfs from)
+{
+	FileOfs b = from / mBlockSize;
+	if (b >= mBlockCount) return;
+	if (mBlocks[b].fill > from % mBlockSize) mBlocks[b].fill = CHECKSUM_UNKNOWN;
+	for (b++; b < mBlockCount; b++) mBlocks[b].fill = CHECKSUM_UNKNOWN;
+}
+
+/**
+ *	Reads checksums written by <i>saveChecksums()</i>. From now on, reads
+ *	completing a block compare its checksum with the loaded one.
+ *	@throws IOException (EINVAL if the format or block size don't match)
+ */
+void ChecksumFile::loadChecksums(Stream &stream)
+{
+	byte buf[CHECKSUM_IO_COUNT * 4];
+	stream.readx(buf, CHECKSUM_HEADER_SIZE);
+	if (memcmp(buf, CHECKSUM_MAGIC, 8) != 0 || getLE(buf + 8, 4) != mBlockSize) {
+		throw IOException(EINVAL);
+	}
+	FileOfs count = getLE(buf + 12, 8);
+	if (count > SIZE_MAX / 4) throw IOException(EINVAL);
+	uint32 *e = (uint32*)malloc(count ? count * 4 : 1);
+	if (!e) throw std::bad_alloc();
+	try {
+		for (FileOfs i = 0; i < count; ) {
+			uint n = MIN(count - i, (FileOfs)CHECKSUM_IO_COUNT);
+			stream.readx(buf, n * 4);
+			for (uint j = 0; j < n; j++) e[i+j] = getLE(buf + 4*j, 4);
+			i += n;
+		}
+	} catch (...) {
+		free(e);
+		throw;
+	}
+	free(mExpected);
+	mExpected = e;
+	mExpectedCount = count;
+}
+
+uint ChecksumFile::read(void *buf, uint size)
+{
+	FileOfs t = tell();
+	uint r = FileLayer::read(buf, size);
+	account(t, (const byte*)buf, r, true);
+	return r;
+}
+
+uint ChecksumFile::readAt(FileOfs offset, void *buf, uint size)
+{
+	uint r = FileLayer::readAt(offset, buf, size);
+	account(offset, (const byte*)buf, r, true);
+	return r;
+}
+
+uint ChecksumFile::readv(const struct iovec *iov, int iovcnt)
+{
+	FileOfs t = tell();
+	uint r = FileLayer::readv(iov, iovcnt);
+	accountIov(t, iov, iovcnt, r, true);
+	return r;
+}
+
+/**
+ *	Writes the checksums of all blocks to |stream|.
+ *	@throws IOException (EINVAL if a checksum is unknown)
+ */
+void ChecksumFile::saveChecksums(Stream &stream) const
+{
+	byte buf[CHECKSUM_IO_COUNT * 4];
+	FileOfs count = getBlockCount();
+	memcpy(buf, CHECKSUM_MAGIC, 8);
+	putLE(buf + 8, mBlockSize, 4);
+	putLE(buf + 12, count, 8);
+	stream.writex(buf, CHECKSUM_HEADER_SIZE);
+	for (FileOfs i = 0; i < count; ) {
+		uint n = MIN(count - i, (FileOfs)CHECKSUM_IO_COUNT);
+		for (uint j = 0; j < n; j++) {
+			uint32 crc;
+			if (!getChecksum(i+j, crc)) throw IOException(EINVAL);
+			putLE(buf + 4*j, crc, 4);
+		}
+		stream.writex(buf, n * 4);
+		i += n;
+	}
+}
+
+void ChecksumFile::truncate(FileOfs newsize)
+{
+	FileOfs size = getSize();
+	FileLayer::truncate(newsize);
+	if (newsize > size) {
+		account(size, NULL, newsize - size, false);
+	} else {
+		invalidate(newsize);
+		FileOfs n = (newsize + mBlockSize - 1) / mBlockSize;
+		if (n < mBlockCount) mBlockCount = n;
+	}
+}
+
+uint ChecksumFile::write(const void *buf, uint size)
+{
+	FileOfs t = tell();
+	accountGap(t);
+	uint r = FileLayer::write(buf, size);
+	account(t, (const byte*)buf, r, false);
+	return r;
+}
+
+uint ChecksumFile::writeAt(FileOfs offset, const void *buf, uint size)
+{
+	accountGap(offset);
+	uint r = FileLayer::writeAt(offset, buf, size);
+	account(offset, (const byte*)buf, r, false);
+	return r;
+}
+
+uint ChecksumFile::writev(const struct iovec *iov, int iovcnt)
+{
+	FileOfs t = tell();
+	accountGap(t);
+	uint r = FileLayer::writev(iov, iovcnt);
+	accountIov(t, iov, iovcnt, r, false);
+	return r;
+}
+
 /*
  *	NullFile
  */
@@ -1240,20 +3288,32 @@ uint NullFile::write(const void *buf, uint size)
  *	MemoryFile
  */
 
-#define MEMORYFILE_GROW_FACTOR_NUM		4
-#define MEMORYFILE_GROW_FACTOR_DENOM		3
-#define MEMORYFILE_MIN_BUFSIZE			32
+/*
+ *	The content is kept in chunks. Chunk sizes start at
+ *	MEMORYFILE_CHUNK_MIN and double up to MEMORYFILE_CHUNK_MAX (both
+ *	powers of 2), so the chunk holding an offset is found in O(1),
+ *	small files stay small and growing never moves the content.
+ *	Allocated bytes beyond the end of file are always 0.
+ */
+#define MEMORYFILE_CHUNK_MIN			(4*1024)
+#define MEMORYFILE_CHUNK_MAX			(2*1024*1024)
+#define MEMORYFILE_GEOM_CHUNKS			(__builtin_ctz(MEMORYFILE_CHUNK_MAX / MEMORYFILE_CHUNK_MIN))
+// end of the chunks of growing size
+#define MEMORYFILE_GEOM_END			((FileOfs)MEMORYFILE_CHUNK_MAX - MEMORYFILE_CHUNK_MIN)
+// copyTo() writes up to this many chunks with one writev()
+#define MEMORYFILE_WRITEOUT_IOV			64
 
-MemoryFile::MemoryFile(FileOfs o, uint size, IOAccessMode mode) : File()
+MemoryFile::MemoryFile(FileOfs o, FileOfs size, IOAccessMode mode, bool hugePages) : File()
 {
 	ofs = o;
-	dsize = size;
-	buf = NULL;
-	ibufsize = size;
-	if (ibufsize < MEMORYFILE_MIN_BUFSIZE) ibufsize = MEMORYFILE_MIN_BUFSIZE;
-	resizeBuf(ibufsize);
-	memset(buf, 0, dsize);
+	dsize = 0;
+	mChunks = NULL;
+	mChunkCount = 0;
+	mChunkAlloc = 0;
+	mHugePages = hugePages;
 	mcount = 0;
+	reserve(size);
+	dsize = size;
 
 	pos = 0;
 	int e = setAccessMode(mode);
@@ -1262,34 +3322,136 @@ MemoryFile::MemoryFile(FileOfs o, uint size, IOAccessMode mode) : File()
 
 MemoryFile::~MemoryFile()
 {
-	free(buf);
+	freeChunks(0);
+	free(mChunks);
 }
 
-byte *MemoryFile::getBufPtr() const
+/*
+ *	allocates chunk number |mChunkCount| (zeroed)
+ */
+void MemoryFile::allocChunk()
+{
+	if (mChunkCount == mChunkAlloc) {
+		uint n = mChunkAlloc ? mChunkAlloc*2 : 16;
+		byte **c = (byte**)realloc(mChunks, n * sizeof *c);
+		if (!c) throw std::bad_alloc();
+		mChunks = c;
+		mChunkAlloc = n;
+	}
+	size_t size = chunkSize(mChunkCount);
+	void *p = NULL;
+	if (mHugePages && size == MEMORYFILE_CHUNK_MAX) {
+#ifdef MAP_HUGETLB
+		// reserved huge pages
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#else
+		p = MAP_FAILED;
+#endif
+		if (p == MAP_FAILED) {
+			// transparent huge pages need an aligned mapping
+			byte *q = (byte*)mmap(NULL, 2*size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (q == MAP_FAILED) throw std::bad_alloc();
+			byte *a = (byte*)(((uintptr_t)q + size - 1) & ~(uintptr_t)(size - 1));
+			if (a > q) munmap(q, a - q);
+			munmap(a + size, q + size - a);
+#ifdef MADV_HUGEPAGE
+			madvise(a, size, MADV_HUGEPAGE);
+#endif
+			p = a;
+		}
+	} else {
+		p = calloc(1, size);
+		if (!p) throw std::bad_alloc();
+	}
+	mChunks[mChunkCount++] = (byte*)p;
+}
+
+/*
+ *	chunk number and offset in the chunk for |o| (relative to |ofs|)
+ */
+uint MemoryFile::chunkIndex(FileOfs o, size_t &inChunk)
 {
-	return buf;
+	uint i;
+	if (o < MEMORYFILE_GEOM_END) {
+		i = 63 - __builtin_clzll(o / MEMORYFILE_CHUNK_MIN + 1);
+	} else {
+		i = MEMORYFILE_GEOM_CHUNKS + (o - MEMORYFILE_GEOM_END) / MEMORYFILE_CHUNK_MAX;
+	}
+	inChunk = o - chunkStart(i);
+	return i;
+}
+
+size_t MemoryFile::chunkSize(uint i)
+{
+	return (i < MEMORYFILE_GEOM_CHUNKS) ? (size_t)MEMORYFILE_CHUNK_MIN << i : MEMORYFILE_CHUNK_MAX;
+}
+
+FileOfs MemoryFile::chunkStart(uint i)
+{
+	if (i < MEMORYFILE_GEOM_CHUNKS) return (FileOfs)MEMORYFILE_CHUNK_MIN * ((1 << i) - 1);
+	return MEMORYFILE_GEOM_END + (FileOfs)(i - MEMORYFILE_GEOM_CHUNKS) * MEMORYFILE_CHUNK_MAX;
+}
+
+/**
+ *	Copies up to the end, in pieces of less than 4 GiB (the result
+ *	is summed up like by <i>Stream::copyAllTo()</i>).
+ */
+uint MemoryFile::copyAllTo(Stream *stream)
+{
+	uint result = 0;
+	while (pos < dsize) {
+		uint k = MIN(dsize - pos, (FileOfs)0xffffffff);
+		uint t = copyTo(stream, k);
+		result += t;
+		if (t != k) break;
+	}
+	return result;
+}
+
+/**
+ *	Zero-copy writeout: copies from the file pointer in pieces of up
+ *	to MEMORYFILE_WRITEOUT_IOV chunks, each with one <i>writev()</i>.
+ */
+uint MemoryFile::copyTo(Stream *stream, uint count)
+{
+	struct iovec iov[MEMORYFILE_WRITEOUT_IOV];
+	uint r = 0;
+	while (count && pos < dsize) {
+		int n = getChunks(pos+ofs, count, iov, MEMORYFILE_WRITEOUT_IOV);
+		uint want = 0;
+		for (int i = 0; i < n; i++) want += iov[i].iov_len;
+		uint k = stream->writev(iov, n);
+		pos += k;
+		r += k;
+		count -= k;
+		if (k != want) break;
+	}
+	return r;
 }
 
 void MemoryFile::extend(FileOfs newsize)
 {
-	// MemoryFiles may not be > 2G
-	if (newsize > 0x7fffffff) throw IOException(EINVAL);
 	if (newsize < getSize()) throw IOException(EINVAL);
 	if (newsize == getSize()) return;
-	while (bufsize<newsize) extendBuf();
-	memset(buf+dsize, 0, newsize-dsize);
+	reserve(newsize);
 	dsize = newsize;
 	mcount++;
 }
 
-void MemoryFile::extendBuf()
-{
-	resizeBuf(extendBufSize(bufsize));
-}
-
-uint MemoryFile::extendBufSize(uint bufsize)
+/*
+ *	frees the chunks from number |first| on
+ */
+void MemoryFile::freeChunks(uint first)
 {
-	return bufsize * MEMORYFILE_GROW_FACTOR_NUM / MEMORYFILE_GROW_FACTOR_DENOM;
+	while (mChunkCount > first) {
+		mChunkCount--;
+		size_t size = chunkSize(mChunkCount);
+		if (mHugePages && size == MEMORYFILE_CHUNK_MAX) {
+			munmap(mChunks[mChunkCount], size);
+		} else {
+			free(mChunks[mChunkCount]);
+		}
+	}
 }
 
 IOAccessMode MemoryFile::getAccessMode() const
@@ -1297,6 +3459,38 @@ IOAccessMode MemoryFile::getAccessMode() const
 	return Stream::getAccessMode();
 }
 
+/**
+ *	Describes the content in [|offset|, |offset|+|size|) (clipped to the
+ *	file size) as pieces of memory, eg. to write it out with writev().
+ *	The pointers are valid until the file is truncated or destroyed.
+ *
+ *	@param offset start (a file offset)
+ *	@param size number of bytes
+ *	@param iov array that receives the pieces
+ *	@param iovcnt size of |iov|
+ *	@returns number of pieces (less than needed if |iovcnt| is too small)
+ */
+int MemoryFile::getChunks(FileOfs offset, FileOfs size, struct iovec *iov, int iovcnt) const
+{
+	if (offset < ofs) throw IOException(EINVAL);
+	FileOfs o = offset - ofs;
+	if (o >= dsize) return 0;
+	if (size > dsize - o) size = dsize - o;
+	int n = 0;
+	size_t c;
+	uint i = chunkIndex(o, c);
+	while (size && n < iovcnt) {
+		size_t k = MIN(size, (FileOfs)(chunkSize(i) - c));
+		iov[n].iov_base = mChunks[i] + c;
+		iov[n].iov_len = k;
+		n++;
+		size -= k;
+		i++;
+		c = 0;
+	}
+	return n;
+}
+
 String &MemoryFile::getDesc(String &result) const
 {
 	result = "MemoryFile";
@@ -1316,23 +3510,35 @@ void MemoryFile::pstat(pstat_t &s) const
 
 uint MemoryFile::read(void *b, uint size)
 {
-	if ((pos+size) > dsize) {
-		if (pos >= dsize) return 0;
-		size = dsize-pos;
+	if (pos >= dsize) return 0;
+	if (size > dsize-pos) size = dsize-pos;
+	byte *p = (byte*)b;
+	size_t c;
+	uint i = chunkIndex(pos, c);
+	uint r = size;
+	while (size) {
+		size_t k = MIN(size, chunkSize(i) - c);
+		memcpy(p, mChunks[i] + c, k);
+		p += k;
+		size -= k;
+		i++;
+		c = 0;
 	}
-	memcpy(b, buf+pos, size);
-	pos += size;
-	return size;
+	pos += r;
+	return r;
 }
 
-void MemoryFile::resizeBuf(uint newsize)
+uint MemoryFile::readv(const struct iovec *iov, int iovcnt)
 {
-	bufsize = newsize;
-
-	ASSERT(dsize <= bufsize);
+	return readPieces(this, iov, iovcnt);
+}
 
-	buf = (byte*)realloc(buf, bufsize ? bufsize : 1);
-	if (!buf) throw std::bad_alloc();
+/*
+ *	makes sure there are chunks for |size| bytes
+ */
+void MemoryFile::reserve(FileOfs size)
+{
+	while (chunkStart(mChunkCount) < size) allocChunk();
 }
 
 void MemoryFile::seek(FileOfs o)
@@ -1349,16 +3555,6 @@ int	MemoryFile::setAccessMode(IOAccessMode mode)
 	return 0;
 }
 
-uint MemoryFile::shrinkBufSize(uint bufsize)
-{
-	return bufsize * MEMORYFILE_GROW_FACTOR_DENOM / MEMORYFILE_GROW_FACTOR_NUM;
-}
-
-void MemoryFile::shrinkBuf()
-{
-	resizeBuf(shrinkBufSize(bufsize));
-}
-
 FileOfs MemoryFile::tell() const
 {
 	return pos+ofs;
@@ -1366,20 +3562,60 @@ FileOfs MemoryFile::tell() const
 
 void MemoryFile::truncate(FileOfs newsize)
 {
+	if (newsize < dsize) {
+		// keep the bytes beyond the end 0
+		size_t c;
+		uint i = chunkIndex(newsize, c);
+		uint keep = (c || !i) ? i+1 : i;
+		if (i < keep && i < mChunkCount) {
+			memset(mChunks[i] + c, 0, MIN(chunkSize(i) - c, dsize - newsize));
+		}
+		freeChunks(keep);
+	} else {
+		reserve(newsize);
+	}
 	dsize = newsize;
-
-	uint s = ibufsize;
-	while (s<dsize) s = extendBufSize(s);
-	
-	resizeBuf(s);
 	mcount++;
 }
 
+/*
+ *	copies |size| bytes to the file pointer
+ */
+void MemoryFile::put(const void *b, uint size)
+{
+	const byte *p = (const byte*)b;
+	size_t c;
+	uint i = chunkIndex(pos, c);
+	while (size) {
+		size_t k = MIN(size, chunkSize(i) - c);
+		memmove(mChunks[i] + c, p, k);
+		p += k;
+		pos += k;
+		size -= k;
+		i++;
+		c = 0;
+	}
+}
+
 uint MemoryFile::write(const void *b, uint size)
 {
-	while (pos+size >= bufsize) extendBuf();
-	memmove(((byte*)buf)+pos, b, size);
-	pos += size;
+	if (!size) return 0;
+	reserve(pos+size);
+	put(b, size);
+	if (pos>dsize) dsize = pos;
+	mcount++;
+	return size;
+}
+
+/**
+ *	Reserves (at most) once for all pieces.
+ */
+uint MemoryFile::writev(const struct iovec *iov, int iovcnt)
+{
+	size_t size = iovSize(iov, iovcnt);
+	if (!size) return 0;
+	reserve(pos+size);
+	for (int i = 0; i < iovcnt; i++) put(iov[i].iov_base, iov[i].iov_len);
 	if (pos>dsize) dsize = pos;
 	mcount++;
 	return size;
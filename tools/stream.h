@@ -23,6 +23,7 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 #include "data.h"
 #include "str.h"
@@ -34,9 +35,16 @@ class String;
 enum IOAccessModeAtomic {
 	IOAM_NULL = 0,
 	IOAM_READ = 1,
-	IOAM_WRITE = 2
+	IOAM_WRITE = 2,
+	IOAM_DIRECT = 4		// bypass the page cache (LocalFileFD only)
 };
 
+/*
+ *	IOAM_DIRECT transfers with memory, offsets and sizes aligned to this
+ *	bypass the page cache, others are done through the cache
+ */
+#define DIRECT_IO_ALIGN		4096
+
 typedef uint IOAccessMode;
 
 /**
@@ -60,10 +68,13 @@ public:
 	virtual	String &		getDesc(String &result) const;
 	virtual	uint			read(void *buf, uint size);
 		void			readx(void *buf, uint size);
+	virtual	uint			readv(const struct iovec *iov, int iovcnt);
 //		void			removeEventListener(StreamEventListener *l);
 	virtual	int			setAccessMode(IOAccessMode mode);
 	virtual	uint			write(const void *buf, uint size);
 		void			writex(const void *buf, uint size);
+	virtual	uint			writev(const struct iovec *iov, int iovcnt);
+		void			writevx(const struct iovec *iov, int iovcnt);
 };
 
 /**
@@ -82,8 +93,10 @@ public:
 	virtual IOAccessMode		getAccessMode() const;
 	virtual String &		getDesc(String &result) const;
 	virtual uint			read(void *buf, uint size);
+	virtual uint			readv(const struct iovec *iov, int iovcnt);
 	virtual int			setAccessMode(IOAccessMode mode);
 	virtual uint			write(const void *buf, uint size);
+	virtual uint			writev(const struct iovec *iov, int iovcnt);
 	/* new */
 		Stream *		getLayered() const;
 		void			setLayered(Stream *newLayered, bool ownNewLayered);
@@ -109,8 +122,24 @@ public:
 // different mod-counts do not necessarily imply different file states !
 #define FCNTL_GET_MOD_COUNT		0x0000000a	// int &mcount
 
+// Page cache hints and control for a range of a file (size 0 means
+// "up to the end of the file"). Offsets and sizes must be passed as FileOfs.
+// Hints are best-effort: files without a page cache return ENOSYS.
+#define FCNTL_ADVISE			0x0000000b	// MmapAdvice advice, FileOfs offset, FileOfs size
+#define FCNTL_READAHEAD			0x0000000c	// FileOfs offset, FileOfs size
+#define FCNTL_SYNC_RANGE		0x0000000d	// FileOfs offset, FileOfs size, bool wait
+
 #define IS_DIRTY_SINGLEBIT		0x80000000
 
+/* access pattern hints for MmapFile::advise() and FCNTL_ADVISE */
+enum MmapAdvice {
+	MMAP_ADVICE_NORMAL,
+	MMAP_ADVICE_SEQUENTIAL,
+	MMAP_ADVICE_RANDOM,
+	MMAP_ADVICE_WILLNEED,
+	MMAP_ADVICE_DONTNEED
+};
+
 /* File open mode */
 enum FileOpenMode {
 	FOM_EXISTS,
@@ -134,10 +163,14 @@ public:
 	virtual FileOfs			getSize() const;
 	virtual void			insert(const void *buf, uint size);
 	virtual void			pstat(pstat_t &s) const;
+	virtual uint			readAt(FileOfs offset, void *buf, uint size);
+		void			readAtx(FileOfs offset, void *buf, uint size);
 	virtual void			seek(FileOfs offset);
 	virtual FileOfs			tell() const;
 	virtual void			truncate(FileOfs newsize);
 	virtual int			vcntl(uint cmd, va_list vargs);
+	virtual uint			writeAt(FileOfs offset, const void *buf, uint size);
+		void			writeAtx(FileOfs offset, const void *buf, uint size);
 };
 
 /**
@@ -160,12 +193,16 @@ public:
 	virtual void			insert(const void *buf, uint size);
 	virtual void			pstat(pstat_t &s) const;
 	virtual uint			read(void *buf, uint size);
+	virtual uint			readAt(FileOfs offset, void *buf, uint size);
+	virtual uint			readv(const struct iovec *iov, int iovcnt);
 	virtual void			seek(FileOfs offset);
 	virtual int			setAccessMode(IOAccessMode mode);
 	virtual FileOfs			tell() const;
 	virtual void			truncate(FileOfs newsize);
 	virtual int			vcntl(uint cmd, va_list vargs);
 	virtual uint			write(const void *buf, uint size);
+	virtual uint			writeAt(FileOfs offset, const void *buf, uint size);
+	virtual uint			writev(const struct iovec *iov, int iovcnt);
 	/* new */
 		File *			getLayered() const;
 		void			setLayered(File *newLayered, bool ownNewLayered);
@@ -173,6 +210,8 @@ public:
 
 /**
  *	A local file (file descriptor [fd]).
+ *	Opened by name with IOAM_DIRECT, aligned transfers (see
+ *	DIRECT_IO_ALIGN and <i>directAlloc()</i>) bypass the page cache.
  */
 class LocalFileFD: public File {
 protected:
@@ -180,27 +219,41 @@ protected:
 	FileOpenMode	mOpenMode;
 
 	int fd;
+	int plainFd;		// same file without O_DIRECT, if IOAM_DIRECT
 	bool own_fd;
 
 	FileOfs offset;
 
+		FileOfs		copyFdTo(LocalFileFD *dest, int dfd, FileOfs count);
+		LocalFileFD *	copyTarget(Stream *stream, int &dfd);
+		uint		directRead(FileOfs ofs, void *buf, uint size);
+		uint		directWrite(FileOfs ofs, const void *buf, uint size);
 		int		setAccessModeInternal(IOAccessMode mode);
+		bool		shiftRange(FileOfs ofs, FileOfs size, bool collapse);
 public:
 
 				LocalFileFD(const String &aFilename, IOAccessMode mode, FileOpenMode aOpenMode);
 				LocalFileFD(int fd, bool own_fd, IOAccessMode mode);
 	virtual 		~LocalFileFD();
 	/* extends File */
+	virtual uint		copyAllTo(Stream *stream);
+	virtual uint		copyTo(Stream *stream, uint count);
+	virtual void		del(uint size);
 	virtual String &	getDesc(String &result) const;
 	virtual String &	getFilename(String &result) const;
 	virtual FileOfs		getSize() const;
+	virtual void		insert(const void *buf, uint size);
 	virtual uint		read(void *buf, uint size);
+	virtual uint		readAt(FileOfs offset, void *buf, uint size);
+	virtual uint		readv(const struct iovec *iov, int iovcnt);
 	virtual void		seek(FileOfs offset);
 	virtual int		setAccessMode(IOAccessMode mode);
 	virtual FileOfs 	tell() const;
 	virtual void		truncate(FileOfs newsize);
 	virtual int		vcntl(uint cmd, va_list vargs);
 	virtual uint		write(const void *buf, uint size);
+	virtual uint		writeAt(FileOfs offset, const void *buf, uint size);
+	virtual uint		writev(const struct iovec *iov, int iovcnt);
 };
 
 /**
@@ -274,6 +327,52 @@ public:
 	virtual uint		write(const void *buf, uint size);
 };
 
+/**
+ *	A local file, accessed through a (shared) memory mapping.
+ *	Opened with IOAM_WRITE, the mapping is writable and writes go
+ *	directly to the file. Writing beyond the end extends the file.
+ *	Pointers obtained by <i>getBufPtr()</i> are invalidated by
+ *	<i>extend()</i>, <i>truncate()</i>, writes beyond the end and
+ *	<i>setAccessMode()</i>.
+ */
+class MmapFile: public File {
+protected:
+	String		mFilename;
+	FileOpenMode	mOpenMode;
+	int		fd;
+	byte *		mBase;
+	FileOfs		mSize;
+	FileOfs		mMapSize;
+	FileOfs		pos;
+
+		bool		pageRange(FileOfs offset, FileOfs size, FileOfs &start, FileOfs &end) const;
+		void		remap(FileOfs newMapSize);
+		void		resize(FileOfs newsize);
+		int		setAccessModeInternal(IOAccessMode mode);
+public:
+				MmapFile(const String &aFilename, IOAccessMode mode = IOAM_READ, FileOpenMode aOpenMode = FOM_EXISTS);
+	virtual			~MmapFile();
+	/* extends File */
+	virtual void		extend(FileOfs newsize);
+	virtual String &	getDesc(String &result) const;
+	virtual String &	getFilename(String &result) const;
+	virtual FileOfs		getSize() const;
+	virtual void		pstat(pstat_t &s) const;
+	virtual uint		read(void *buf, uint size);
+	virtual uint		readAt(FileOfs offset, void *buf, uint size);
+	virtual void		seek(FileOfs offset);
+	virtual int		setAccessMode(IOAccessMode mode);
+	virtual FileOfs		tell() const;
+	virtual void		truncate(FileOfs newsize);
+	virtual int		vcntl(uint cmd, va_list vargs);
+	virtual uint		write(const void *buf, uint size);
+	virtual uint		writeAt(FileOfs offset, const void *buf, uint size);
+	/* new */
+		void		advise(MmapAdvice advice, FileOfs offset = 0, FileOfs size = 0);
+		byte *		getBufPtr() const;
+		void		sync(bool wait = true);
+};
+
 /**
  *	A file layer, representing a cropped version of a file
  */
@@ -293,10 +392,189 @@ public:
 	virtual FileOfs	getSize() const;
 	virtual void		pstat(pstat_t &s) const;
 	virtual uint		read(void *buf, uint size);
+	virtual uint		readAt(FileOfs offset, void *buf, uint size);
+	virtual uint		readv(const struct iovec *iov, int iovcnt);
 	virtual void		seek(FileOfs offset);
 	virtual FileOfs 	tell() const;
 	virtual void		truncate(FileOfs newsize);
+	virtual int		vcntl(uint cmd, va_list vargs);
 	virtual uint		write(const void *buf, uint size);
+	virtual uint		writeAt(FileOfs offset, const void *buf, uint size);
+	virtual uint		writev(const struct iovec *iov, int iovcnt);
+};
+
+/*
+ *	default buffer sizes of BufferedStream and BufferedFile
+ */
+#define BUFFERED_READ_AHEAD		(64*1024)
+#define BUFFERED_WRITE_BEHIND		(64*1024)
+
+/*
+ *	this many bytes of already consumed data are kept on refills,
+ *	so at least that much can always be unread()
+ */
+#define BUFFERED_PUSHBACK		16
+
+/**
+ *	A stream layer, buffering reads and writes.
+ *	Reads are done in chunks of up to <i>readAhead</i> bytes, writes are
+ *	collected until <i>writeBehind</i> bytes are pending (or <i>flush()</i>
+ *	is called). Larger requests bypass the buffer, a size of 0 disables
+ *	buffering for that direction.
+ *	Errors of buffered writes are reported by the write that flushes
+ *	the buffer (or <i>flush()</i>). Writing discards data that has been
+ *	read ahead but not consumed.
+ */
+class BufferedStream: public StreamLayer {
+protected:
+	byte *mBuf;
+	uint mBufSize;
+	uint mReadAhead;
+	uint mWriteBehind;
+	uint mPos;
+	uint mFill;
+	bool mDirty;
+
+		uint		fill();
+public:
+				BufferedStream(Stream *stream, bool own_stream, uint readAhead = BUFFERED_READ_AHEAD, uint writeBehind = BUFFERED_WRITE_BEHIND);
+	virtual			~BufferedStream();
+	/* extends StreamLayer */
+	virtual	uint		read(void *buf, uint size);
+	virtual	uint		readv(const struct iovec *iov, int iovcnt);
+	virtual	int		setAccessMode(IOAccessMode mode);
+	virtual	uint		write(const void *buf, uint size);
+	virtual	uint		writev(const struct iovec *iov, int iovcnt);
+	/* new */
+		void		consume(uint size);
+		void		flush();
+		const byte *	getReadBuffer(uint &size);
+		uint		peek(void *buf, uint size);
+		void		unread(uint size);
+};
+
+/**
+ *	A file layer, buffering reads and writes (see BufferedStream).
+ *	<i>seek()</i> and <i>tell()</i> work on the logical position, seeks
+ *	inside the buffered range don't touch the layered file.
+ */
+class BufferedFile: public FileLayer {
+protected:
+	byte *mBuf;
+	uint mBufSize;
+	uint mReadAhead;
+	uint mWriteBehind;
+	FileOfs mBufOfs;
+	uint mPos;
+	uint mFill;
+	bool mDirty;
+
+		uint		fill();
+		void		invalidate();
+		void		resync();
+public:
+				BufferedFile(File *file, bool own_file, uint readAhead = BUFFERED_READ_AHEAD, uint writeBehind = BUFFERED_WRITE_BEHIND);
+	virtual			~BufferedFile();
+	/* extends FileLayer */
+	virtual void		del(uint size);
+	virtual void		extend(FileOfs newsize);
+	virtual FileOfs		getSize() const;
+	virtual void		insert(const void *buf, uint size);
+	virtual uint		read(void *buf, uint size);
+	virtual uint		readAt(FileOfs offset, void *buf, uint size);
+	virtual uint		readv(const struct iovec *iov, int iovcnt);
+	virtual void		seek(FileOfs offset);
+	virtual int		setAccessMode(IOAccessMode mode);
+	virtual FileOfs		tell() const;
+	virtual void		truncate(FileOfs newsize);
+	virtual int		vcntl(uint cmd, va_list vargs);
+	virtual uint		write(const void *buf, uint size);
+	virtual uint		writeAt(FileOfs offset, const void *buf, uint size);
+	virtual uint		writev(const struct iovec *iov, int iovcnt);
+	/* new */
+		void		consume(uint size);
+		void		flush();
+		const byte *	getReadBuffer(uint &size);
+		uint		peek(void *buf, uint size);
+		void		unread(uint size);
+};
+
+/**
+ *	A stream layer computing the CRC32C (see crc32c.h) of all data
+ *	read or written through it.
+ */
+class ChecksumStream: public StreamLayer {
+protected:
+	uint32		mChecksum;
+	FileOfs		mCount;
+public:
+				ChecksumStream(Stream *stream, bool own_stream);
+	/* extends StreamLayer */
+	virtual uint		read(void *buf, uint size);
+	virtual uint		readv(const struct iovec *iov, int iovcnt);
+	virtual uint		write(const void *buf, uint size);
+	virtual uint		writev(const struct iovec *iov, int iovcnt);
+	/* new */
+		uint32		getChecksum() const;
+		FileOfs		getCount() const;
+		void		reset();
+};
+
+/*
+ *	default block size of ChecksumFile
+ */
+#define CHECKSUM_BLOCK_SIZE		(1024*1024)
+
+/**
+ *	A file layer recording the CRC32C of each block of the file, as
+ *	data is read or written through it. A block's checksum is known once
+ *	all of it has passed through in order (from the start of the block,
+ *	in one or more transfers). Gaps written beyond the end of the file
+ *	count as zeros. Writes elsewhere in a block make its checksum
+ *	unknown until the block is rewritten from its start.
+ *	With expected checksums (<i>loadChecksums()</i>), reads that complete a
+ *	block throw IOException(EIO) if its checksum doesn't match, so
+ *	a copy can be verified in the same pass that reads it.
+ *	Not safe for concurrent use (not even of <i>readAt()</i>/<i>writeAt()</i>).
+ */
+class ChecksumFile: public FileLayer {
+protected:
+	struct Block {
+		uint32	crc;
+		uint32	fill;	// bytes covered by |crc|, 0xffffffff if unknown
+	};
+	Block *		mBlocks;
+	FileOfs		mBlockCount;
+	uint32 *	mExpected;
+	FileOfs		mExpectedCount;
+	uint		mBlockSize;
+
+		void		account(FileOfs offset, const byte *buf, FileOfs size, bool reading);
+		void		accountGap(FileOfs offset);
+		void		accountIov(FileOfs offset, const struct iovec *iov, int iovcnt, uint size, bool reading);
+		Block &		block(FileOfs b);
+		void		check(FileOfs b);
+		void		invalidate(FileOfs from);
+public:
+				ChecksumFile(File *file, bool own_file, uint blockSize = CHECKSUM_BLOCK_SIZE);
+	virtual			~ChecksumFile();
+	/* extends FileLayer */
+	virtual void		del(uint size);
+	virtual void		extend(FileOfs newsize);
+	virtual void		insert(const void *buf, uint size);
+	virtual uint		read(void *buf, uint size);
+	virtual uint		readAt(FileOfs offset, void *buf, uint size);
+	virtual uint		readv(const struct iovec *iov, int iovcnt);
+	virtual void		truncate(FileOfs newsize);
+	virtual uint		write(const void *buf, uint size);
+	virtual uint		writeAt(FileOfs offset, const void *buf, uint size);
+	virtual uint		writev(const struct iovec *iov, int iovcnt);
+	/* new */
+		FileOfs		getBlockCount() const;
+		uint		getBlockSize() const;
+		bool		getChecksum(FileOfs b, uint32 &crc) const;
+		void		loadChecksums(Stream &stream);
+		void		saveChecksums(Stream &stream) const;
 };
 
 /**
@@ -320,39 +598,56 @@ public:
 
 /**
  *	A file, existing only in memory.
+ *	The content is kept in a list of chunks (see <i>getChunks()</i>),
+ *	so appending never copies what has been written before.
+ *	With |hugePages|, large chunks are backed by huge pages (reserved
+ *	ones if available, transparent ones otherwise).
  */
 class MemoryFile: public File {
 protected:
 	FileOfs ofs;
 	FileOfs pos;
-	uint bufsize, dsize, ibufsize;
-	byte *buf;
-
-	virtual	uint		extendBufSize(uint bufsize);
-	virtual	uint		shrinkBufSize(uint bufsize);
-		void		extendBuf();
-		void		shrinkBuf();
-		void		resizeBuf(uint newsize);
+	FileOfs dsize;
+	byte **mChunks;
+	uint mChunkCount;
+	uint mChunkAlloc;
+	bool mHugePages;
+
+		void		allocChunk();
+	static	uint		chunkIndex(FileOfs o, size_t &inChunk);
+	static	size_t		chunkSize(uint i);
+	static	FileOfs		chunkStart(uint i);
+		void		freeChunks(uint first);
+		void		put(const void *buf, uint size);
+		void		reserve(FileOfs size);
 public:
-				MemoryFile(FileOfs ofs = 0, uint size = 0, IOAccessMode mode = IOAM_READ | IOAM_WRITE);
+				MemoryFile(FileOfs ofs = 0, FileOfs size = 0, IOAccessMode mode = IOAM_READ | IOAM_WRITE, bool hugePages = false);
 	virtual 		~MemoryFile();
 	/* extends File */
+	virtual uint		copyAllTo(Stream *stream);
+	virtual uint		copyTo(Stream *stream, uint count);
 	virtual void		extend(FileOfs newsize);
 	virtual IOAccessMode	getAccessMode() const;
 	virtual String &	getDesc(String &result) const;
 	virtual FileOfs		getSize() const;
 	virtual void		pstat(pstat_t &s) const;
 	virtual uint		read(void *buf, uint size);
+	virtual uint		readv(const struct iovec *iov, int iovcnt);
 	virtual void		seek(FileOfs offset);
 	virtual int		setAccessMode(IOAccessMode mode);
 	virtual FileOfs 	tell() const;
 	virtual void		truncate(FileOfs newsize);
 	virtual uint		write(const void *buf, uint size);
+	virtual uint		writev(const struct iovec *iov, int iovcnt);
 	/* new */
-		byte *		getBufPtr() const;
+		int		getChunks(FileOfs offset, FileOfs size, struct iovec *iov, int iovcnt) const;
 };
 
-void fileMove(File *file, FileOfs src, FileOfs dest, FileOfs size);
+void fileMove(File *file, FileOfs src, FileOfs dest, FileOfs size, int threads = 1);
+
+/** allocate/free buffers aligned to DIRECT_IO_ALIGN (for IOAM_DIRECT) */
+void *directAlloc(size_t size);
+void directFree(void *p);
 
 /** read string from file (zero-terminated, 8-bit chars) */
 char *fgetstrz(File *file);
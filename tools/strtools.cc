@@ -32,6 +32,11 @@
 #include <cstdlib>
 #include <cstring>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define HAVE_X86_SEARCH_KERNELS
+#include <immintrin.h>
+#endif
+
 char hexchars[17]="0123456789abcdef";
 
 char *ht_strdup(const char *str)
@@ -347,16 +352,403 @@ void memdowncase(byte *buf, int len)
 	}
 }
 
-byte *ht_memmem(const byte *haystack, int haystack_len, const byte *needle, int needle_len)
+/*
+ *	memory search kernels
+ *
+ *	ht_memchr(), ht_memrchr() and ht_memmem() dispatch (once, at first use)
+ *	to SSE2 or AVX2 implementations depending on the cpu, with a scalar
+ *	fallback for everything else. Substring search filters candidate
+ *	positions by comparing first and last byte of the needle 16/32
+ *	positions at once and only then compares the whole needle.
+ *	ht_mismatch() and ht_mismatch_casefold() find the first position
+ *	where two buffers differ (the latter ignoring ASCII case).
+ */
+
+static byte *memchr_scalar(const byte *buf, int len, byte c)
 {
-	while (haystack_len && (haystack_len >= needle_len)) {
-		if (memcmp(haystack, needle, needle_len) == 0) return (byte*)haystack;
-		haystack++;
-		haystack_len--;
+	return (byte*)memchr(buf, c, len);
+}
+
+static byte *memrchr_scalar(const byte *buf, int len, byte c)
+{
+	while (len--) {
+		if (buf[len] == c) return (byte*)buf+len;
 	}
 	return NULL;
 }
 
+/* needle_len >= 2 and needle_len <= haystack_len */
+static byte *memmem_scalar(const byte *haystack, int haystack_len, const byte *needle, int needle_len)
+{
+	const byte *h = haystack;
+	const byte *end = haystack + haystack_len - needle_len;
+	while (h <= end) {
+		h = memchr_scalar(h, end-h+1, needle[0]);
+		if (!h) return NULL;
+		if (h[needle_len-1] == needle[needle_len-1]
+		 && memcmp(h+1, needle+1, needle_len-2) == 0) return (byte*)h;
+		h++;
+	}
+	return NULL;
+}
+
+static int mismatch_scalar(const byte *a, const byte *b, int len)
+{
+	int i = 0;
+	while (i < len && a[i] == b[i]) i++;
+	return i;
+}
+
+static inline byte ascii_fold(byte c)
+{
+	return (c >= 'A' && c <= 'Z') ? c+0x20 : c;
+}
+
+static int mismatch_casefold_scalar(const byte *a, const byte *b, int len)
+{
+	int i = 0;
+	while (i < len && !((a[i] | b[i]) & 0x80) && ascii_fold(a[i]) == ascii_fold(b[i])) i++;
+	return i;
+}
+
+#ifdef HAVE_X86_SEARCH_KERNELS
+
+static byte *memchr_sse2(const byte *buf, int len, byte c)
+{
+	const __m128i n = _mm_set1_epi8(c);
+	int i = 0;
+	for (; i+16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(buf+i));
+		uint m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, n));
+		if (m) return (byte*)buf + i + __builtin_ctz(m);
+	}
+	return memchr_scalar(buf+i, len-i, c);
+}
+
+static byte *memrchr_sse2(const byte *buf, int len, byte c)
+{
+	const __m128i n = _mm_set1_epi8(c);
+	while (len >= 16) {
+		len -= 16;
+		__m128i v = _mm_loadu_si128((const __m128i*)(buf+len));
+		uint m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, n));
+		if (m) return (byte*)buf + len + 31 - __builtin_clz(m);
+	}
+	return memrchr_scalar(buf, len, c);
+}
+
+static byte *memmem_sse2(const byte *haystack, int haystack_len, const byte *needle, int needle_len)
+{
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[needle_len-1]);
+	int candidates = haystack_len - needle_len + 1;
+	int i = 0;
+	for (; i+16 <= candidates; i += 16) {
+		__m128i f = _mm_loadu_si128((const __m128i*)(haystack+i));
+		__m128i l = _mm_loadu_si128((const __m128i*)(haystack+i+needle_len-1));
+		uint m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first), _mm_cmpeq_epi8(l, last)));
+		while (m) {
+			int k = i + __builtin_ctz(m);
+			if (memcmp(haystack+k+1, needle+1, needle_len-2) == 0) return (byte*)haystack+k;
+			m &= m-1;
+		}
+	}
+	return memmem_scalar(haystack+i, haystack_len-i, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static byte *memchr_avx2(const byte *buf, int len, byte c)
+{
+	const __m256i n = _mm256_set1_epi8(c);
+	int i = 0;
+	for (; i+64 <= len; i += 64) {
+		__m256i e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf+i)), n);
+		__m256i e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf+i+32)), n);
+		if (!_mm256_testz_si256(_mm256_or_si256(e0, e1), _mm256_or_si256(e0, e1))) {
+			uint m = _mm256_movemask_epi8(e0);
+			if (m) return (byte*)buf + i + __builtin_ctz(m);
+			m = _mm256_movemask_epi8(e1);
+			return (byte*)buf + i + 32 + __builtin_ctz(m);
+		}
+	}
+	for (; i+32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(buf+i));
+		uint m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, n));
+		if (m) return (byte*)buf + i + __builtin_ctz(m);
+	}
+	return memchr_sse2(buf+i, len-i, c);
+}
+
+__attribute__((target("avx2")))
+static byte *memrchr_avx2(const byte *buf, int len, byte c)
+{
+	const __m256i n = _mm256_set1_epi8(c);
+	while (len >= 32) {
+		len -= 32;
+		__m256i v = _mm256_loadu_si256((const __m256i*)(buf+len));
+		uint m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, n));
+		if (m) return (byte*)buf + len + 31 - __builtin_clz(m);
+	}
+	return memrchr_sse2(buf, len, c);
+}
+
+__attribute__((target("avx2")))
+static byte *memmem_avx2(const byte *haystack, int haystack_len, const byte *needle, int needle_len)
+{
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[needle_len-1]);
+	int candidates = haystack_len - needle_len + 1;
+	int i = 0;
+	for (; i+32 <= candidates; i += 32) {
+		__m256i f = _mm256_loadu_si256((const __m256i*)(haystack+i));
+		__m256i l = _mm256_loadu_si256((const __m256i*)(haystack+i+needle_len-1));
+		uint m = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(f, first), _mm256_cmpeq_epi8(l, last)));
+		while (m) {
+			int k = i + __builtin_ctz(m);
+			if (memcmp(haystack+k+1, needle+1, needle_len-2) == 0) return (byte*)haystack+k;
+			m &= m-1;
+		}
+	}
+	return memmem_sse2(haystack+i, haystack_len-i, needle, needle_len);
+}
+
+static int mismatch_sse2(const byte *a, const byte *b, int len)
+{
+	int i = 0;
+	for (; i+16 <= len; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b+i));
+		uint m = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xffff;
+		if (m) return i + __builtin_ctz(m);
+	}
+	return i + mismatch_scalar(a+i, b+i, len-i);
+}
+
+static inline __m128i ascii_fold_sse2(__m128i v)
+{
+	// bytes >= 0x80 are negative and never in 'A'..'Z'
+	__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A'-1)),
+		_mm_cmpgt_epi8(_mm_set1_epi8('Z'+1), v));
+	return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static int mismatch_casefold_sse2(const byte *a, const byte *b, int len)
+{
+	int i = 0;
+	for (; i+16 <= len; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b+i));
+		uint eq = _mm_movemask_epi8(_mm_cmpeq_epi8(ascii_fold_sse2(va), ascii_fold_sse2(vb)));
+		uint nonascii = _mm_movemask_epi8(_mm_or_si128(va, vb));
+		uint m = (eq ^ 0xffff) | nonascii;
+		if (m) return i + __builtin_ctz(m);
+	}
+	return i + mismatch_casefold_scalar(a+i, b+i, len-i);
+}
+
+__attribute__((target("avx2")))
+static int mismatch_avx2(const byte *a, const byte *b, int len)
+{
+	int i = 0;
+	for (; i+32 <= len; i += 32) {
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a+i));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b+i));
+		uint m = ~(uint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+		if (m) return i + __builtin_ctz(m);
+	}
+	return i + mismatch_sse2(a+i, b+i, len-i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ascii_fold_avx2(__m256i v)
+{
+	__m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A'-1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8('Z'+1), v));
+	return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static int mismatch_casefold_avx2(const byte *a, const byte *b, int len)
+{
+	int i = 0;
+	for (; i+32 <= len; i += 32) {
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a+i));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b+i));
+		uint eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(ascii_fold_avx2(va), ascii_fold_avx2(vb)));
+		uint nonascii = _mm256_movemask_epi8(_mm256_or_si256(va, vb));
+		uint m = ~eq | nonascii;
+		if (m) return i + __builtin_ctz(m);
+	}
+	return i + mismatch_casefold_sse2(a+i, b+i, len-i);
+}
+
+#endif /* HAVE_X86_SEARCH_KERNELS */
+
+struct SearchKernels {
+	byte *(*chr)(const byte *buf, int len, byte c);
+	byte *(*rchr)(const byte *buf, int len, byte c);
+	byte *(*mem)(const byte *haystack, int haystack_len, const byte *needle, int needle_len);
+	int (*mismatch)(const byte *a, const byte *b, int len);
+	int (*mismatchCasefold)(const byte *a, const byte *b, int len);
+};
+
+static SearchKernels selectSearchKernels()
+{
+	SearchKernels k = {memchr_scalar, memrchr_scalar, memmem_scalar,
+		mismatch_scalar, mismatch_casefold_scalar};
+#ifdef HAVE_X86_SEARCH_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		k.chr = memchr_avx2;
+		k.rchr = memrchr_avx2;
+		k.mem = memmem_avx2;
+		k.mismatch = mismatch_avx2;
+		k.mismatchCasefold = mismatch_casefold_avx2;
+	} else {
+		k.chr = memchr_sse2;
+		k.rchr = memrchr_sse2;
+		k.mem = memmem_sse2;
+		k.mismatch = mismatch_sse2;
+		k.mismatchCasefold = mismatch_casefold_sse2;
+	}
+#endif
+	return k;
+}
+
+static inline const SearchKernels &searchKernels()
+{
+	static const SearchKernels kernels = selectSearchKernels();
+	return kernels;
+}
+
+byte *ht_memchr(const byte *buf, int len, byte c)
+{
+	if (len <= 0) return NULL;
+	return searchKernels().chr(buf, len, c);
+}
+
+byte *ht_memrchr(const byte *buf, int len, byte c)
+{
+	if (len <= 0) return NULL;
+	return searchKernels().rchr(buf, len, c);
+}
+
+/**
+ *	@returns index of the first byte differing in |a| and |b| or |len|
+ */
+int ht_mismatch(const byte *a, const byte *b, int len)
+{
+	if (len <= 0) return 0;
+	return searchKernels().mismatch(a, b, len);
+}
+
+/**
+ *	like ht_mismatch(), but 'A'-'Z' and 'a'-'z' are considered equal.
+ *	Also stops at the first byte >= 0x80 (in either buffer).
+ */
+int ht_mismatch_casefold(const byte *a, const byte *b, int len)
+{
+	if (len <= 0) return 0;
+	return searchKernels().mismatchCasefold(a, b, len);
+}
+
+byte *ht_memmem(const byte *haystack, int haystack_len, const byte *needle, int needle_len)
+{
+	if (needle_len > haystack_len || haystack_len <= 0) return NULL;
+	if (needle_len <= 0) return (byte*)haystack;
+	if (needle_len == 1) return ht_memchr(haystack, haystack_len, needle[0]);
+	return searchKernels().mem(haystack, haystack_len, needle, needle_len);
+}
+
+/*
+ *	hashing (a wyhash variant)
+ */
+
+static const uint64 hash_secret[4] = {
+	0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+	0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+static inline void hash_mum(uint64 &a, uint64 &b)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 r = (unsigned __int128)a * b;
+	a = (uint64)r;
+	b = (uint64)(r >> 64);
+#else
+	uint64 ha = a >> 32, hb = b >> 32, la = (uint32)a, lb = (uint32)b;
+	uint64 rh = ha*hb, rm0 = ha*lb, rm1 = hb*la, rl = la*lb;
+	uint64 t = rl + (rm0 << 32);
+	uint64 c = t < rl;
+	uint64 lo = t + (rm1 << 32);
+	c += lo < t;
+	a = lo;
+	b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64 hash_mix(uint64 a, uint64 b)
+{
+	hash_mum(a, b);
+	return a ^ b;
+}
+
+static inline uint64 hash_r8(const byte *p)
+{
+	uint64 v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint64 hash_r4(const byte *p)
+{
+	uint32 v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+uint64 ht_hash64(const void *buf, size_t len, uint64 seed)
+{
+	const byte *p = (const byte*)buf;
+	uint64 a, b;
+	seed ^= hash_mix(seed ^ hash_secret[0], hash_secret[1]);
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (hash_r4(p) << 32) | hash_r4(p + ((len >> 3) << 2));
+			b = (hash_r4(p+len-4) << 32) | hash_r4(p + len - 4 - ((len >> 3) << 2));
+		} else if (len) {
+			a = ((uint64)p[0] << 16) | ((uint64)p[len >> 1] << 8) | p[len-1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+		if (i > 48) {
+			uint64 seed1 = seed, seed2 = seed;
+			do {
+				seed = hash_mix(hash_r8(p) ^ hash_secret[1], hash_r8(p+8) ^ seed);
+				seed1 = hash_mix(hash_r8(p+16) ^ hash_secret[2], hash_r8(p+24) ^ seed1);
+				seed2 = hash_mix(hash_r8(p+32) ^ hash_secret[3], hash_r8(p+40) ^ seed2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		while (i > 16) {
+			seed = hash_mix(hash_r8(p) ^ hash_secret[1], hash_r8(p+8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = hash_r8(p+i-16);
+		b = hash_r8(p+i-8);
+	}
+	a ^= hash_secret[1];
+	b ^= seed;
+	hash_mum(a, b);
+	return hash_mix(a ^ hash_secret[0] ^ len, b ^ hash_secret[1]);
+}
+
 /* common string parsing functions */
 void whitespaces(const char *&str)
 {
@@ -382,30 +774,149 @@ bool waitforchar(const char *&str, char b)
 	return true;
 }
 
-static bool bnstr2int(const char *&str, uint64 &u64, int base)
+/*
+ *	integer parsing
+ *
+ *	Digits are converted 8 at a time where possible (SWAR, on little
+ *	endian machines): all 8 bytes are checked to be digits of the base
+ *	in parallel and then combined into the value with a few
+ *	multiplications/shifts.
+ */
+
+#define SWAR_ONES	0x0101010101010101ULL
+#define SWAR_HIGH	0x8080808080808080ULL
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define HAVE_SWAR_INT_PARSER
+#endif
+
+#ifdef HAVE_SWAR_INT_PARSER
+
+/*
+ *	@returns mask with the high bit of each byte set if it is in [lo, hi]
+ *	(bytes of |x| must be < 0x80)
+ */
+static inline uint64 swar_in_range(uint64 x, byte lo, byte hi)
 {
-	u64 = 0;
-	uint64 ubase = base;
+	uint64 ge = x + SWAR_ONES * (0x80 - lo);
+	uint64 gt = x + SWAR_ONES * (0x7f - hi);
+	return ge & ~gt & SWAR_HIGH;
+}
+
+/* converts the 8 decimal digits at |s|, @returns false if not all are digits */
+static inline bool swar_dec8(const char *s, uint64 &v)
+{
+	uint64 x;
+	memcpy(&x, s, 8);
+	if ((x & SWAR_HIGH) || swar_in_range(x, '0', '9') != SWAR_HIGH) return false;
+	x -= SWAR_ONES * '0';
+	x = (x * 10 + (x >> 8)) & 0x00ff00ff00ff00ffULL;
+	x = (x * 100 + (x >> 16)) & 0x0000ffff0000ffffULL;
+	v = (x * 10000 + (x >> 32)) & 0xffffffffULL;
+	return true;
+}
+
+/* converts the 8 hex digits at |s|, @returns false if not all are hex digits */
+static inline bool swar_hex8(const char *s, uint64 &v)
+{
+	uint64 x;
+	memcpy(&x, s, 8);
+	if (x & SWAR_HIGH) return false;
+	uint64 digit = swar_in_range(x, '0', '9');
+	uint64 letter = swar_in_range(x | (SWAR_ONES * 0x20), 'a', 'f');
+	if ((digit | letter) != SWAR_HIGH) return false;
+	// '0'-'9' -> 0-9, 'a'-'f'/'A'-'F' -> 10-15 (letters have bit 6 set)
+	x = (x & (SWAR_ONES * 0x0f)) + ((x >> 6) & SWAR_ONES) * 9;
+	x = ((x << 4) | (x >> 8)) & 0x00ff00ff00ff00ffULL;
+	x = ((x << 8) | (x >> 16)) & 0x0000ffff0000ffffULL;
+	v = ((x << 16) | (x >> 32)) & 0xffffffffULL;
+	return true;
+}
+
+#endif /* HAVE_SWAR_INT_PARSER */
+
+/*
+ *	converts |len| digits of base |base|
+ *	@returns false if a character isn't a digit or on overflow
+ */
+static bool digits2int(const char *s, int len, uint64 &u64, int base)
+{
+	uint64 v = 0;
 	int i = 0;
-	do {
-		int c = hexdigit(*str);
-		if ((c == -1) || (c >= base)) return (i == 0) ? false : true;
-		u64 *= ubase;
-		u64 += c;
-		str++;
-		i++;
-	} while (*str);
+#ifdef HAVE_SWAR_INT_PARSER
+	if (base == 10) {
+		for (; i+8 <= len; i += 8) {
+			uint64 d;
+			if (!swar_dec8(s+i, d)) return false;
+			if (__builtin_mul_overflow(v, 100000000ULL, &v)
+			 || __builtin_add_overflow(v, d, &v)) return false;
+		}
+	} else if (base == 16) {
+		for (; i+8 <= len; i += 8) {
+			uint64 d;
+			if (!swar_hex8(s+i, d)) return false;
+			if (v >> 32) return false;
+			v = (v << 32) | d;
+		}
+	}
+#endif
+	for (; i < len; i++) {
+		int c = hexdigit(s[i]);
+		if (c < 0 || c >= base) return false;
+		if (__builtin_mul_overflow(v, (uint64)base, &v)
+		 || __builtin_add_overflow(v, (uint64)c, &v)) return false;
+	}
+	u64 = v;
 	return true;
 }
 
+/**
+ *	Parses an integer at the start of |str|, advances |str| behind it.
+ *	A "0x" prefix selects base 16 if |defaultbase| is 10.
+ *	@returns false if there are no digits or on overflow
+ */
 bool parseIntStr(const char *&str, uint64 &u64, int defaultbase)
 {
 	int base = defaultbase;
-	if ((base == 10) && strncmp("0x", str, 2) == 0) {
+	const char *s = str;
+	if ((base == 10) && strncmp("0x", s, 2) == 0) {
+		s += 2;
+		base = 16;
+	}
+	int len = 0;
+	while (true) {
+		int c = hexdigit(s[len]);
+		if (c < 0 || c >= base) break;
+		len++;
+	}
+	if (!len || !digits2int(s, len, u64, base)) return false;
+	str = s+len;
+	return true;
+}
+
+/**
+ *	Parses the integer in the |len| characters at |str| (no more, no less).
+ *	If |defaultbase| is 10, "0x" prefix or PearPC suffix notation
+ *	(h: hex, o: octal, b: binary, d: decimal) select the base.
+ *	@returns false on syntax error or overflow
+ */
+bool parseIntBuf(const char *str, int len, uint64 &u64, int defaultbase)
+{
+	int base = defaultbase;
+	if (base == 10 && len > 2 && str[0] == '0' && str[1] == 'x') {
 		str += 2;
+		len -= 2;
 		base = 16;
+	} else if (base == 10 && len > 1) {
+		switch (str[len-1]) {
+		case 'h': case 'H': base = 16; len--; break;
+		case 'o': case 'O': base = 8; len--; break;
+		case 'b': case 'B': base = 2; len--; break;
+		case 'd': case 'D': len--; break;
+		}
 	}
-	return bnstr2int(str, u64, base);
+	if (len <= 0) return false;
+	return digits2int(str, len, u64, base);
 }
 
 /* hex/string functions */
@@ -433,17 +944,17 @@ bool hexb_ex(uint8 &result, const char *s)
 
 bool hexw_ex(uint16 &result, const char *s)
 {
-	uint8 v, w;
-	if (!hexb_ex(v, s) || !hexb_ex(w, s+2)) return false;
-	result = (v<<8) | w;
+	uint64 u;
+	if (strnlen(s, 4) < 4 || !digits2int(s, 4, u, 16)) return false;
+	result = u;
 	return true;
 }
 
 bool hexd_ex(uint32 &result, const char *s)
 {
-	uint16 v, w;
-	if (!hexw_ex(v, s) || !hexw_ex(w, s+4)) return false;
-	result = (v<<16) | w;
+	uint64 u;
+	if (strnlen(s, 8) < 8 || !digits2int(s, 8, u, 16)) return false;
+	result = u;
 	return true;
 }
 
@@ -44,7 +44,14 @@ int bin2str(char *result, const void *s, int len);
 void wide_char_to_multi_byte(char *result, const byte *unicode, int maxlen);
 
 void memdowncase(byte *buf, int len);
+byte *ht_memchr(const byte *buf, int len, byte c);
+byte *ht_memrchr(const byte *buf, int len, byte c);
 byte *ht_memmem(const byte *haystack, int haystack_len, const byte *needle, int needle_len);
+int ht_mismatch(const byte *a, const byte *b, int len);
+int ht_mismatch_casefold(const byte *a, const byte *b, int len);
+
+/* fast non-cryptographic 64-bit hash */
+uint64 ht_hash64(const void *buf, size_t len, uint64 seed = 0);
 
 /* common string parsing functions */
 void non_whitespaces(char *&str);
@@ -53,6 +60,7 @@ bool waitforchar(char *&str, char b);
 
 /* string evaluation functions */
 bool parseIntStr(const char *&str, uint64 &u64, int defaultbase);
+bool parseIntBuf(const char *str, int len, uint64 &u64, int defaultbase = 10);
 
 /* hex/string functions */
 int hexdigit(char a);